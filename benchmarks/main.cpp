@@ -0,0 +1,305 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2017 Thibaut Goetghebuer-Planchon <tessil@gmx.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Benchmarks of the main operations of the sparse hash table over all the
+ * combinations of key/value types, growth policies, sparsities and probing
+ * modes.
+ *
+ * Usage: tsl_sparse_map_benchmarks [nb_elements] [filter]
+ *
+ * Only the configurations whose name contains `filter` are run, e.g.
+ * "string/string/prime". The peak RSS never decreases during the lifetime of
+ * the process, run one configuration per process to get its own peak RSS.
+ */
+#include <tsl/sparse_map.h>
+#include <tsl/sparse_stream.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <ratio>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "utils.h"
+
+namespace {
+
+volatile std::uint64_t g_sink = 0;
+
+std::uint64_t checksum(std::int64_t value) {
+  return static_cast<std::uint64_t>(value);
+}
+
+std::uint64_t checksum(const std::string &value) { return value.size(); }
+
+std::uint64_t checksum(const bench::large_value &value) {
+  return value.data[0];
+}
+
+void check(bool condition, const char *message) {
+  if (!condition) {
+    std::fprintf(stderr, "Error: %s\n", message);
+    std::exit(1);
+  }
+}
+
+void print_header() {
+  std::printf("%-44s %-12s %14s %11s %15s %13s\n", "configuration",
+              "operation", "ops/s", "bytes/elem", "peak alloc MiB",
+              "peak RSS MiB");
+}
+
+/**
+ * Print a result line. `nb_bytes` is the number of bytes reported per element
+ * (the bytes allocated by the hash table, or the size of the serialized
+ * stream) and `peak_alloc` the maximum number of bytes allocated by the hash
+ * tables during the operation.
+ */
+void print_result(const std::string &configuration, const char *operation,
+                  std::size_t nb_ops, double seconds, std::size_t nb_bytes,
+                  std::size_t nb_elements, std::size_t peak_alloc) {
+  const double mib = 1024.0 * 1024.0;
+  std::printf("%-44s %-12s %14.0f %11.2f %15.2f %13.2f\n",
+              configuration.c_str(), operation,
+              (seconds > 0) ? double(nb_ops) / seconds : 0.0,
+              (nb_elements > 0) ? double(nb_bytes) / double(nb_elements) : 0.0,
+              double(peak_alloc) / mib, double(bench::peak_rss()) / mib);
+  std::fflush(stdout);
+}
+
+template <class Key, class T, class GrowthPolicy, tsl::sh::sparsity Sparsity,
+          tsl::sh::probing Probing>
+void run(const std::string &configuration, std::size_t nb_elements) {
+  using map_type =
+      bench::sparse_hash_map<Key, T, GrowthPolicy, Sparsity, Probing>;
+  using memory = bench::memory_counter;
+
+  const std::vector<Key> keys = bench::get_keys<Key>(nb_elements);
+  const std::vector<Key> missing_keys =
+      bench::get_keys<Key>(nb_elements, nb_elements);
+  const T value = bench::get_value<T>(1);
+  const std::size_t base_bytes = memory::current();
+
+  map_type map(0, std::hash<Key>(), std::equal_to<Key>(),
+               bench::counting_allocator<std::pair<Key, T>>(),
+               map_type::DEFAULT_MAX_LOAD_FACTOR);
+
+  // insert
+  {
+    memory::reset_peak();
+    bench::timer timer;
+    for (const Key &key : keys) {
+      map.insert(std::make_pair(key, value));
+    }
+    const double seconds = timer.elapsed_seconds();
+    check(map.size() == nb_elements, "insert");
+
+    print_result(configuration, "insert", nb_elements, seconds,
+                 memory::current() - base_bytes, map.size(),
+                 memory::peak() - base_bytes);
+  }
+
+  // find-hit
+  {
+    memory::reset_peak();
+    std::size_t nb_found = 0;
+    bench::timer timer;
+    for (const Key &key : keys) {
+      nb_found += (map.find(key) != map.end()) ? 1 : 0;
+    }
+    const double seconds = timer.elapsed_seconds();
+    check(nb_found == nb_elements, "find-hit");
+
+    print_result(configuration, "find-hit", nb_elements, seconds,
+                 memory::current() - base_bytes, map.size(),
+                 memory::peak() - base_bytes);
+  }
+
+  // find-miss
+  {
+    memory::reset_peak();
+    std::size_t nb_found = 0;
+    bench::timer timer;
+    for (const Key &key : missing_keys) {
+      nb_found += (map.find(key) != map.end()) ? 1 : 0;
+    }
+    const double seconds = timer.elapsed_seconds();
+    check(nb_found == 0, "find-miss");
+
+    print_result(configuration, "find-miss", nb_elements, seconds,
+                 memory::current() - base_bytes, map.size(),
+                 memory::peak() - base_bytes);
+  }
+
+  // iterate
+  {
+    memory::reset_peak();
+    std::uint64_t sum = 0;
+    bench::timer timer;
+    for (const auto &key_value : map) {
+      sum += checksum(key_value.first) + checksum(key_value.second);
+    }
+    const double seconds = timer.elapsed_seconds();
+    g_sink = g_sink + sum;
+
+    print_result(configuration, "iterate", map.size(), seconds,
+                 memory::current() - base_bytes, map.size(),
+                 memory::peak() - base_bytes);
+  }
+
+  // serialize
+  std::stringbuf stream;
+  {
+    memory::reset_peak();
+    bench::timer timer;
+    tsl::sh::stream_serializer serializer(stream);
+    map.serialize(serializer);
+    serializer.flush();
+    const double seconds = timer.elapsed_seconds();
+
+    print_result(configuration, "serialize", map.size(), seconds,
+                 stream.str().size(), map.size(), memory::peak() - base_bytes);
+  }
+
+  // deserialize
+  {
+    std::stringbuf input(stream.str());
+    stream.str(std::string());
+
+    const std::size_t bytes_before = memory::current();
+    memory::reset_peak();
+    bench::timer timer;
+    map_type map_deserialized(0, std::hash<Key>(), std::equal_to<Key>(),
+                              bench::counting_allocator<std::pair<Key, T>>(),
+                              map_type::DEFAULT_MAX_LOAD_FACTOR);
+    tsl::sh::stream_deserializer deserializer(input);
+    map_deserialized.deserialize(deserializer, true);
+    const double seconds = timer.elapsed_seconds();
+    check(map_deserialized.size() == map.size(), "deserialize");
+
+    print_result(configuration, "deserialize", map_deserialized.size(),
+                 seconds, memory::current() - bytes_before,
+                 map_deserialized.size(), memory::peak() - bytes_before);
+  }
+
+  // rehash
+  {
+    memory::reset_peak();
+    bench::timer timer;
+    map.rehash(map.bucket_count() * 2);
+    const double seconds = timer.elapsed_seconds();
+    check(map.size() == nb_elements, "rehash");
+
+    print_result(configuration, "rehash", map.size(), seconds,
+                 memory::current() - base_bytes, map.size(),
+                 memory::peak() - base_bytes);
+  }
+
+  // erase
+  {
+    memory::reset_peak();
+    std::size_t nb_erased = 0;
+    bench::timer timer;
+    for (const Key &key : keys) {
+      nb_erased += map.erase(key);
+    }
+    const double seconds = timer.elapsed_seconds();
+    check(nb_erased == nb_elements && map.empty(), "erase");
+
+    print_result(configuration, "erase", nb_elements, seconds,
+                 memory::current() - base_bytes, nb_elements,
+                 memory::peak() - base_bytes);
+  }
+}
+
+struct options {
+  std::size_t nb_elements;
+  std::string filter;
+};
+
+template <class Key, class T, class GrowthPolicy, tsl::sh::sparsity Sparsity>
+void run_probings(const std::string &configuration, const options &opts) {
+  for (const char *probing : {"linear", "quadratic"}) {
+    const std::string name = configuration + "/" + probing;
+    if (name.find(opts.filter) == std::string::npos) {
+      continue;
+    }
+
+    if (probing == std::string("linear")) {
+      run<Key, T, GrowthPolicy, Sparsity, tsl::sh::probing::linear>(
+          name, opts.nb_elements);
+    } else {
+      run<Key, T, GrowthPolicy, Sparsity, tsl::sh::probing::quadratic>(
+          name, opts.nb_elements);
+    }
+  }
+}
+
+template <class Key, class T, class GrowthPolicy>
+void run_sparsities(const std::string &configuration, const options &opts) {
+  run_probings<Key, T, GrowthPolicy, tsl::sh::sparsity::high>(
+      configuration + "/high", opts);
+  run_probings<Key, T, GrowthPolicy, tsl::sh::sparsity::medium>(
+      configuration + "/medium", opts);
+  run_probings<Key, T, GrowthPolicy, tsl::sh::sparsity::low>(
+      configuration + "/low", opts);
+}
+
+template <class Key, class T>
+void run_growth_policies(const std::string &configuration,
+                         const options &opts) {
+  run_sparsities<Key, T, tsl::sh::power_of_two_growth_policy<2>>(
+      configuration + "/power_of_two", opts);
+  run_sparsities<Key, T, tsl::sh::mod_growth_policy<std::ratio<3, 2>>>(
+      configuration + "/mod", opts);
+  run_sparsities<Key, T, tsl::sh::prime_growth_policy>(
+      configuration + "/prime", opts);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  options opts;
+  opts.nb_elements = 200000;
+  if (argc > 1) {
+    opts.nb_elements =
+        static_cast<std::size_t>(std::strtoull(argv[1], nullptr, 10));
+  }
+  if (argc > 2) {
+    opts.filter = argv[2];
+  }
+
+  print_header();
+  run_growth_policies<std::int64_t, std::int64_t>("int64/int64", opts);
+  run_growth_policies<std::string, std::string>("string/string", opts);
+  run_growth_policies<std::int64_t, bench::large_value>("int64/large", opts);
+
+  return 0;
+}
@@ -0,0 +1,317 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2017 Thibaut Goetghebuer-Planchon <tessil@gmx.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Replay a trace recorded by tsl::recording_sparse_map over all the
+ * combinations of growth policies, sparsities, probing modes and allocation
+ * backends, and report the throughput and the memory of each one.
+ *
+ * Usage: tsl_sparse_replay trace_file [filter]
+ *
+ * The keys of up to 8 bytes are replayed as 64-bits integers, the other keys
+ * as std::string. The values are replayed with the smallest of 8, 16, 64 or
+ * 256 bytes which can hold the recorded value size (256 bytes for the larger
+ * values). The keys are hashed with std::hash, a warning is printed if the
+ * trace was recorded with another hash function.
+ *
+ * Only the configurations whose name contains `filter` are run, e.g.
+ * "prime/low". The peak RSS never decreases during the lifetime of the
+ * process, run one configuration per process to get its own peak RSS.
+ */
+#include <tsl/recording_sparse_map.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <ratio>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "utils.h"
+
+namespace {
+
+/**
+ * Values of 16 and 64 bytes, `bench::large_value` is used for the larger
+ * values.
+ */
+struct small_value {
+  std::uint64_t data[2];
+};
+
+struct medium_value {
+  std::uint64_t data[8];
+};
+
+/**
+ * Operations of the trace with their keys, converted beforehand so that the
+ * replay only measures the map.
+ */
+template <class Key>
+struct replay_trace {
+  std::vector<tsl::sh::trace_op> ops;
+  std::vector<Key> keys;
+};
+
+volatile std::uint64_t g_sink = 0;
+
+std::uint64_t to_key(const std::string &bytes, std::uint64_t *) {
+  std::uint64_t key = 0;
+  std::memcpy(&key, bytes.data(), std::min(bytes.size(), sizeof(key)));
+
+  return key;
+}
+
+std::string to_key(const std::string &bytes, std::string *) { return bytes; }
+
+/**
+ * Read the records of `reader` and print a summary of the trace.
+ */
+template <class Key>
+replay_trace<Key> load(tsl::sh::trace_reader &reader) {
+  replay_trace<Key> trace;
+  std::vector<std::pair<std::uint64_t, Key>> hashed_keys;
+  std::size_t nb_ops[6] = {};
+  bool other_hash = false;
+
+  tsl::sh::trace_record record;
+  while (reader.read(record)) {
+    const Key key = to_key(record.key, static_cast<Key *>(nullptr));
+
+    trace.ops.push_back(record.op);
+    trace.keys.push_back(key);
+    nb_ops[static_cast<std::size_t>(record.op)]++;
+
+    if (record.op != tsl::sh::trace_op::clear) {
+      other_hash = other_hash ||
+                   record.hash != std::uint64_t(std::hash<Key>()(key));
+      hashed_keys.emplace_back(record.hash, key);
+    }
+  }
+
+  std::sort(hashed_keys.begin(), hashed_keys.end());
+  hashed_keys.erase(std::unique(hashed_keys.begin(), hashed_keys.end()),
+                    hashed_keys.end());
+  const std::size_t nb_distinct_keys = hashed_keys.size();
+  hashed_keys.erase(
+      std::unique(hashed_keys.begin(), hashed_keys.end(),
+                  [](const std::pair<std::uint64_t, Key> &lhs,
+                     const std::pair<std::uint64_t, Key> &rhs) {
+                    return lhs.first == rhs.first;
+                  }),
+      hashed_keys.end());
+  const std::size_t nb_distinct_hashes = hashed_keys.size();
+
+  std::printf(
+      "trace: %zu records (insert %zu, insert_or_assign %zu, find %zu, "
+      "erase %zu, clear %zu)%s\n",
+      trace.ops.size(), nb_ops[1], nb_ops[2], nb_ops[3], nb_ops[4], nb_ops[5],
+      reader.complete() ? "" : ", interrupted recording");
+  std::printf("trace: key size %zu, value size %zu, %zu distinct keys, %zu "
+              "distinct recorded hashes\n",
+              reader.key_size(), reader.value_size(), nb_distinct_keys,
+              nb_distinct_hashes);
+  if (other_hash) {
+    std::printf("warning: the trace was recorded with another hash function, "
+                "the replay uses std::hash\n");
+  }
+  std::printf("\n");
+
+  return trace;
+}
+
+void print_header() {
+  std::printf("%-36s %14s %11s %11s %13s %15s %13s\n", "configuration",
+              "ops/s", "final size", "bytes/elem", "final MiB",
+              "peak alloc MiB", "peak RSS MiB");
+}
+
+template <class Key, class T, class GrowthPolicy, tsl::sh::sparsity Sparsity,
+          tsl::sh::probing Probing>
+void replay(const std::string &configuration, const replay_trace<Key> &trace) {
+  using map_type =
+      bench::sparse_hash_map<Key, T, GrowthPolicy, Sparsity, Probing>;
+  using memory = bench::memory_counter;
+
+  const T value = T();
+  const std::size_t base_bytes = memory::current();
+  memory::reset_peak();
+
+  std::size_t nb_found = 0;
+  double seconds = 0;
+  std::size_t final_size = 0;
+  std::size_t final_bytes = 0;
+  {
+    map_type map(0, std::hash<Key>(), std::equal_to<Key>(),
+                 bench::counting_allocator<std::pair<Key, T>>(),
+                 map_type::DEFAULT_MAX_LOAD_FACTOR);
+
+    bench::timer timer;
+    for (std::size_t i = 0; i < trace.ops.size(); i++) {
+      const Key &key = trace.keys[i];
+      switch (trace.ops[i]) {
+        case tsl::sh::trace_op::insert:
+          map.try_emplace(key, value);
+          break;
+        case tsl::sh::trace_op::insert_or_assign:
+          map.insert_or_assign(key, value);
+          break;
+        case tsl::sh::trace_op::find:
+          nb_found += (map.find(key) != map.end()) ? 1 : 0;
+          break;
+        case tsl::sh::trace_op::erase:
+          map.erase(key);
+          break;
+        case tsl::sh::trace_op::clear:
+          map.clear();
+          break;
+        case tsl::sh::trace_op::end:
+          break;
+      }
+    }
+    seconds = timer.elapsed_seconds();
+
+    final_size = map.size();
+    final_bytes = memory::current() - base_bytes;
+  }
+  g_sink = g_sink + nb_found;
+
+  const double mib = 1024.0 * 1024.0;
+  std::printf(
+      "%-36s %14.0f %11zu %11.2f %13.2f %15.2f %13.2f\n",
+      configuration.c_str(),
+      (seconds > 0) ? double(trace.ops.size()) / seconds : 0.0, final_size,
+      (final_size > 0) ? double(final_bytes) / double(final_size) : 0.0,
+      double(final_bytes) / mib, double(memory::peak() - base_bytes) / mib,
+      double(bench::peak_rss()) / mib);
+  std::fflush(stdout);
+}
+
+template <class Key, class T, class GrowthPolicy, tsl::sh::sparsity Sparsity,
+          tsl::sh::probing Probing>
+void replay_backends(const std::string &configuration,
+                     const replay_trace<Key> &trace,
+                     const std::string &filter) {
+  const std::pair<const char *, bench::allocation_backend> backends[] = {
+      {"standard", bench::allocation_backend::standard},
+      {"pool", bench::allocation_backend::pool}};
+
+  for (const auto &backend : backends) {
+    const std::string name = configuration + "/" + backend.first;
+    if (name.find(filter) == std::string::npos) {
+      continue;
+    }
+
+    bench::current_allocation_backend() = backend.second;
+    replay<Key, T, GrowthPolicy, Sparsity, Probing>(name, trace);
+  }
+  bench::current_allocation_backend() = bench::allocation_backend::standard;
+}
+
+template <class Key, class T, class GrowthPolicy, tsl::sh::sparsity Sparsity>
+void replay_probings(const std::string &configuration,
+                     const replay_trace<Key> &trace,
+                     const std::string &filter) {
+  replay_backends<Key, T, GrowthPolicy, Sparsity, tsl::sh::probing::linear>(
+      configuration + "/linear", trace, filter);
+  replay_backends<Key, T, GrowthPolicy, Sparsity,
+                  tsl::sh::probing::quadratic>(configuration + "/quadratic",
+                                               trace, filter);
+}
+
+template <class Key, class T, class GrowthPolicy>
+void replay_sparsities(const std::string &configuration,
+                       const replay_trace<Key> &trace,
+                       const std::string &filter) {
+  replay_probings<Key, T, GrowthPolicy, tsl::sh::sparsity::high>(
+      configuration + "/high", trace, filter);
+  replay_probings<Key, T, GrowthPolicy, tsl::sh::sparsity::medium>(
+      configuration + "/medium", trace, filter);
+  replay_probings<Key, T, GrowthPolicy, tsl::sh::sparsity::low>(
+      configuration + "/low", trace, filter);
+}
+
+template <class Key, class T>
+void replay_growth_policies(const replay_trace<Key> &trace,
+                            const std::string &filter) {
+  replay_sparsities<Key, T, tsl::sh::power_of_two_growth_policy<2>>(
+      "power_of_two", trace, filter);
+  replay_sparsities<Key, T, tsl::sh::mod_growth_policy<std::ratio<3, 2>>>(
+      "mod", trace, filter);
+  replay_sparsities<Key, T, tsl::sh::prime_growth_policy>("prime", trace,
+                                                          filter);
+}
+
+template <class Key>
+void run(tsl::sh::trace_reader &reader, const std::string &filter) {
+  const replay_trace<Key> trace = load<Key>(reader);
+
+  print_header();
+  if (reader.value_size() <= sizeof(std::int64_t)) {
+    replay_growth_policies<Key, std::int64_t>(trace, filter);
+  } else if (reader.value_size() <= sizeof(small_value)) {
+    replay_growth_policies<Key, small_value>(trace, filter);
+  } else if (reader.value_size() <= sizeof(medium_value)) {
+    replay_growth_policies<Key, medium_value>(trace, filter);
+  } else {
+    replay_growth_policies<Key, bench::large_value>(trace, filter);
+  }
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::fprintf(stderr, "Usage: %s trace_file [filter]\n", argv[0]);
+    return 1;
+  }
+
+  std::ifstream file(argv[1], std::ios::binary);
+  if (!file) {
+    std::fprintf(stderr, "Error: couldn't open %s\n", argv[1]);
+    return 1;
+  }
+  const std::string filter = (argc > 2) ? argv[2] : "";
+
+  try {
+    tsl::sh::trace_reader reader(file);
+    if (reader.key_size() != 0 && reader.key_size() <= sizeof(std::uint64_t)) {
+      run<std::uint64_t>(reader, filter);
+    } else {
+      run<std::string>(reader, filter);
+    }
+  } catch (const std::exception &e) {
+    std::fprintf(stderr, "Error: %s\n", e.what());
+    return 1;
+  }
+
+  return 0;
+}
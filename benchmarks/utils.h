@@ -0,0 +1,319 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2017 Thibaut Goetghebuer-Planchon <tessil@gmx.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef TSL_BENCHMARKS_UTILS_H
+#define TSL_BENCHMARKS_UTILS_H
+
+#include <tsl/sparse_hash.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+// windows.h must be included first
+#include <psapi.h>
+#elif defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+namespace bench {
+
+/**
+ * Bytes currently allocated through `counting_allocator`, and the maximum
+ * reached since the last `reset_peak`.
+ */
+class memory_counter {
+ public:
+  static void add(std::size_t nb_bytes) noexcept {
+    current() += nb_bytes;
+    peak() = std::max(peak(), current());
+  }
+
+  static void remove(std::size_t nb_bytes) noexcept { current() -= nb_bytes; }
+
+  static void reset_peak() noexcept { peak() = current(); }
+
+  static std::size_t &current() noexcept {
+    static std::size_t nb_bytes = 0;
+    return nb_bytes;
+  }
+
+  static std::size_t &peak() noexcept {
+    static std::size_t nb_bytes = 0;
+    return nb_bytes;
+  }
+};
+
+/**
+ * Where `counting_allocator` takes its memory from:
+ * - `standard`: `std::allocator`;
+ * - `pool`: free lists by size class of 16 bytes for the blocks up to 4 KiB,
+ *   like the thread caches of the common malloc implementations. The freed
+ *   blocks are kept for later allocations of the same size class and never
+ *   given back to the system.
+ *
+ * The backend must not be changed while some memory allocated through
+ * `counting_allocator` is alive.
+ */
+enum class allocation_backend { standard, pool };
+
+inline allocation_backend &current_allocation_backend() noexcept {
+  static allocation_backend backend = allocation_backend::standard;
+  return backend;
+}
+
+class block_pool {
+ public:
+  static void *allocate(std::size_t nb_bytes) {
+    const std::size_t size_class = (nb_bytes + GRANULARITY - 1) / GRANULARITY;
+    if (size_class >= NB_SIZE_CLASSES) {
+      return ::operator new(nb_bytes);
+    }
+
+    std::vector<void *> &free_list = free_lists()[size_class];
+    if (free_list.empty()) {
+      return ::operator new(size_class * GRANULARITY);
+    }
+
+    void *ptr = free_list.back();
+    free_list.pop_back();
+    return ptr;
+  }
+
+  static void deallocate(void *ptr, std::size_t nb_bytes) {
+    const std::size_t size_class = (nb_bytes + GRANULARITY - 1) / GRANULARITY;
+    if (size_class >= NB_SIZE_CLASSES) {
+      ::operator delete(ptr);
+    } else {
+      free_lists()[size_class].push_back(ptr);
+    }
+  }
+
+ private:
+  static const std::size_t GRANULARITY = 16;
+  static const std::size_t NB_SIZE_CLASSES = 4096 / GRANULARITY + 1;
+
+  static std::vector<void *> *free_lists() {
+    static std::vector<void *> lists[NB_SIZE_CLASSES];
+    return lists;
+  }
+};
+
+/**
+ * Allocator counting the bytes it allocates in `memory_counter`, over the
+ * `current_allocation_backend()`. Only the memory allocated by the hash table
+ * itself is counted, not the memory allocated by the values (e.g. the buffer
+ * of a long std::string) nor the memory kept by the pool.
+ */
+template <class T>
+class counting_allocator {
+ public:
+  using value_type = T;
+
+  counting_allocator() noexcept {}
+
+  template <class U>
+  counting_allocator(const counting_allocator<U> &) noexcept {}
+
+  T *allocate(std::size_t n) {
+    T *ptr = (current_allocation_backend() == allocation_backend::pool)
+                 ? static_cast<T *>(block_pool::allocate(n * sizeof(T)))
+                 : std::allocator<T>().allocate(n);
+    memory_counter::add(n * sizeof(T));
+
+    return ptr;
+  }
+
+  void deallocate(T *ptr, std::size_t n) noexcept {
+    memory_counter::remove(n * sizeof(T));
+    if (current_allocation_backend() == allocation_backend::pool) {
+      block_pool::deallocate(ptr, n * sizeof(T));
+    } else {
+      std::allocator<T>().deallocate(ptr, n);
+    }
+  }
+
+  friend bool operator==(const counting_allocator &,
+                         const counting_allocator &) noexcept {
+    return true;
+  }
+
+  friend bool operator!=(const counting_allocator &,
+                         const counting_allocator &) noexcept {
+    return false;
+  }
+};
+
+template <class Key, class T>
+class key_select {
+ public:
+  using key_type = Key;
+
+  const key_type &operator()(
+      const std::pair<Key, T> &key_value) const noexcept {
+    return key_value.first;
+  }
+
+  key_type &operator()(std::pair<Key, T> &key_value) noexcept {
+    return key_value.first;
+  }
+};
+
+template <class Key, class T>
+class value_select {
+ public:
+  using value_type = T;
+
+  const value_type &operator()(
+      const std::pair<Key, T> &key_value) const noexcept {
+    return key_value.second;
+  }
+
+  value_type &operator()(std::pair<Key, T> &key_value) noexcept {
+    return key_value.second;
+  }
+};
+
+/**
+ * The probing mode is not a template parameter of tsl::sparse_map, which
+ * always uses quadratic probing. Use the underlying hash table directly to
+ * compare both modes.
+ */
+template <class Key, class T, class GrowthPolicy, tsl::sh::sparsity Sparsity,
+          tsl::sh::probing Probing>
+using sparse_hash_map = tsl::detail_sparse_hash::sparse_hash<
+    std::pair<Key, T>, key_select<Key, T>, value_select<Key, T>,
+    std::hash<Key>, std::equal_to<Key>, counting_allocator<std::pair<Key, T>>,
+    GrowthPolicy, tsl::sh::exception_safety::basic, Sparsity, Probing>;
+
+/**
+ * Peak resident set size of the process in bytes, 0 if unknown. The value
+ * never decreases during the lifetime of the process.
+ */
+inline std::size_t peak_rss() {
+#if defined(_WIN32)
+  PROCESS_MEMORY_COUNTERS counters;
+  if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+    return static_cast<std::size_t>(counters.PeakWorkingSetSize);
+  }
+  return 0;
+#elif defined(__unix__) || defined(__APPLE__)
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+#if defined(__APPLE__)
+  return static_cast<std::size_t>(usage.ru_maxrss);
+#else
+  return static_cast<std::size_t>(usage.ru_maxrss) * 1024;
+#endif
+#else
+  return 0;
+#endif
+}
+
+class timer {
+ public:
+  timer() : m_start(std::chrono::steady_clock::now()) {}
+
+  double elapsed_seconds() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         m_start)
+        .count();
+  }
+
+ private:
+  std::chrono::steady_clock::time_point m_start;
+};
+
+/**
+ * Value of 256 bytes, to measure the cost of moving large values around.
+ */
+struct large_value {
+  std::uint64_t data[32];
+};
+
+template <typename T>
+T get_value(std::uint64_t i);
+
+template <>
+inline std::int64_t get_value<std::int64_t>(std::uint64_t i) {
+  return static_cast<std::int64_t>(i);
+}
+
+template <>
+inline std::string get_value<std::string>(std::uint64_t i) {
+  // Longer than the small string buffer of the common implementations.
+  return "benchmark_key_" + std::to_string(i);
+}
+
+template <>
+inline large_value get_value<large_value>(std::uint64_t i) {
+  large_value value;
+  std::fill(std::begin(value.data), std::end(value.data), i);
+
+  return value;
+}
+
+/**
+ * Return `nb_keys` distinct keys in a random but reproducible order. The
+ * `nb_keys` keys following them in the sequence, `get_keys(nb_keys, nb_keys)`,
+ * are distinct from the first ones.
+ */
+template <typename Key>
+std::vector<Key> get_keys(std::size_t nb_keys, std::size_t offset = 0) {
+  std::vector<std::uint64_t> ids(nb_keys);
+  for (std::size_t i = 0; i < nb_keys; i++) {
+    // Spread the integer keys over the whole range, a multiplication by an odd
+    // constant is a bijection.
+    ids[i] = (i + offset) * UINT64_C(0x9E3779B97F4A7C15);
+  }
+
+  std::mt19937_64 generator(nb_keys + offset);
+  std::shuffle(ids.begin(), ids.end(), generator);
+
+  std::vector<Key> keys;
+  keys.reserve(nb_keys);
+  for (std::uint64_t id : ids) {
+    keys.push_back(get_value<Key>(id));
+  }
+
+  return keys;
+}
+
+}  // namespace bench
+
+#endif
@@ -0,0 +1,475 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2017 Thibaut Goetghebuer-Planchon <tessil@gmx.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef TSL_FROZEN_SPARSE_MAP_H
+#define TSL_FROZEN_SPARSE_MAP_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "sparse_hash.h"
+
+namespace tsl {
+
+/**
+ * Read-only hash map whose content lives directly in a contiguous block of
+ * memory with a fixed layout, typically a file mapped in memory with `mmap`.
+ * Opening a `frozen_sparse_map` over such a block doesn't read, allocate nor
+ * construct anything, the lookups run directly over the block. A huge table
+ * is thus usable immediately and the OS only loads the pages that are
+ * actually accessed.
+ *
+ * The block is created with `frozen_sparse_map::freeze` from any map (a
+ * `tsl::sparse_map`, a `std::unordered_map`, ...). As in `tsl::sparse_map`,
+ * the buckets are grouped by 64 with a bitmap telling which buckets of the
+ * group hold a value and the values of the group are packed, leaving no
+ * empty bucket in the block:
+ * - a header with the format version and the sizes of the types, to detect
+ *   an incompatible block;
+ * - for each group of 64 buckets, a 64-bits bitmap and the index of the
+ *   first value of the group in the values array;
+ * - the values array, aligned on the alignment of `value_type`.
+ *
+ * `Key` and `T` must be trivially copyable. The block is only readable on
+ * platforms with the same endianness, the same `sizeof(std::size_t)` and the
+ * same type sizes as the one that created it, and with a `Hash` that returns
+ * the same hashes. The block must be aligned on at least
+ * `frozen_sparse_map::alignment()` bytes (`mmap` returns page aligned
+ * addresses) and must stay valid while the `frozen_sparse_map` is used.
+ *
+ * The stored `value_type` is a simple struct with `first` and `second` members
+ * instead of a `std::pair`, which is not trivially copyable.
+ */
+template <class Key, class T, class Hash = std::hash<Key>,
+          class KeyEqual = std::equal_to<Key>>
+class frozen_sparse_map : private Hash, private KeyEqual {
+ public:
+  struct value_type {
+    Key first;
+    T second;
+  };
+
+  using key_type = Key;
+  using mapped_type = T;
+  using size_type = std::size_t;
+  using hasher = Hash;
+  using key_equal = KeyEqual;
+  using const_reference = const value_type &;
+  using const_pointer = const value_type *;
+  using const_iterator = const value_type *;
+  using iterator = const_iterator;
+
+  static_assert(std::is_trivially_copyable<Key>::value &&
+                    std::is_trivially_copyable<T>::value,
+                "Key and T must be trivially copyable.");
+
+  static const std::uint32_t FORMAT_VERSION = 1;
+
+ private:
+  static const std::size_t GROUP_NB_BUCKETS = 64;
+  static const std::size_t GROUP_SHIFT = 6;
+
+  struct header {
+    char magic[8];
+    std::uint32_t endianness;
+    std::uint32_t version;
+    std::uint64_t size_t_size;
+    std::uint64_t key_size;
+    std::uint64_t mapped_size;
+    std::uint64_t value_size;
+    std::uint64_t value_alignment;
+    std::uint64_t bucket_count;
+    std::uint64_t nb_elements;
+    std::uint64_t groups_offset;
+    std::uint64_t values_offset;
+    std::uint64_t total_size;
+  };
+
+  struct group {
+    std::uint64_t bitmap;
+    std::uint64_t values_index;
+  };
+
+  static const char *magic() noexcept { return "TSLFRZSM"; }
+  static const std::uint32_t ENDIANNESS_MARKER = 0x01020304;
+
+ public:
+  /**
+   * Alignment required for the block of memory.
+   */
+  static std::size_t alignment() noexcept {
+    return std::max(alignof(group), alignof(value_type));
+  }
+
+  /**
+   * Empty map not backed by any block.
+   */
+  explicit frozen_sparse_map(const Hash &hash = Hash(),
+                             const KeyEqual &equal = KeyEqual())
+      : Hash(hash),
+        KeyEqual(equal),
+        m_groups(nullptr),
+        m_values(nullptr),
+        m_mask(0),
+        m_nb_elements(0) {}
+
+  /**
+   * Open the map stored in the `size` bytes at `data`, as created by
+   * `freeze`. Throw `std::runtime_error` if the block is not a valid frozen
+   * map for these template parameters, is truncated or is not properly
+   * aligned.
+   *
+   * No copy is done, `data` must stay valid while the map is used.
+   */
+  frozen_sparse_map(const void *data, std::size_t size,
+                    const Hash &hash = Hash(),
+                    const KeyEqual &equal = KeyEqual())
+      : frozen_sparse_map(hash, equal) {
+    if (reinterpret_cast<std::uintptr_t>(data) % alignment() != 0) {
+      TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                            "The frozen map data is not properly aligned.");
+    }
+
+    if (size < sizeof(header)) {
+      TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                            "The frozen map data is truncated.");
+    }
+
+    header head;
+    std::memcpy(&head, data, sizeof(header));
+
+    if (std::memcmp(head.magic, magic(), sizeof(head.magic)) != 0) {
+      TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                            "The data is not a frozen map.");
+    }
+
+    if (head.endianness != ENDIANNESS_MARKER ||
+        head.version != FORMAT_VERSION ||
+        head.size_t_size != sizeof(std::size_t) ||
+        head.key_size != sizeof(Key) || head.mapped_size != sizeof(T) ||
+        head.value_size != sizeof(value_type) ||
+        head.value_alignment != alignof(value_type)) {
+      TSL_SH_THROW_OR_ABORT(
+          std::runtime_error,
+          "The frozen map was created with an incompatible format, platform "
+          "or types.");
+    }
+
+    const std::uint64_t nb_groups = nb_groups_for(head.bucket_count);
+    if (!tsl::detail_sparse_hash::is_power_of_two(
+            static_cast<std::size_t>(head.bucket_count)) ||
+        head.bucket_count > std::numeric_limits<std::size_t>::max() / 2 ||
+        head.nb_elements >= head.bucket_count ||
+        head.total_size != size ||
+        head.groups_offset % alignof(group) != 0 ||
+        head.values_offset % alignof(value_type) != 0 ||
+        head.groups_offset < sizeof(header) ||
+        head.values_offset < head.groups_offset ||
+        (head.values_offset - head.groups_offset) / sizeof(group) < nb_groups ||
+        head.values_offset > size ||
+        (size - head.values_offset) / sizeof(value_type) < head.nb_elements) {
+      TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                            "The frozen map data is corrupted or truncated.");
+    }
+
+    const char *bytes = static_cast<const char *>(data);
+    m_groups = reinterpret_cast<const group *>(bytes + head.groups_offset);
+    m_values = reinterpret_cast<const value_type *>(bytes + head.values_offset);
+    m_mask = static_cast<std::size_t>(head.bucket_count) - 1;
+    m_nb_elements = static_cast<std::size_t>(head.nb_elements);
+  }
+
+  /**
+   * Write the content of `map` in the frozen map format through `writer`.
+   * The written block can then be opened with the `frozen_sparse_map(const
+   * void*, std::size_t)` constructor.
+   *
+   * `map` can be any map type whose iterators point to values with `first`
+   * and `second` members convertible to `Key` and `T`, and whose keys are
+   * unique. `writer` must be a function object supporting the call
+   * `void operator()(const char* data, std::size_t size);`, it's called
+   * multiple times with consecutive parts of the block.
+   *
+   * `max_load_factor` is the maximum ratio between the number of values and
+   * the number of buckets. The lower it is, the shorter the probing is, at the
+   * expense of 16 bytes per group of 64 buckets.
+   *
+   * Return the size of the block in bytes.
+   */
+  template <class Map, class Writer>
+  static std::size_t freeze(const Map &map, Writer &&writer,
+                            const Hash &hash = Hash(),
+                            float max_load_factor = 0.5f) {
+    if (!(max_load_factor > 0.0f && max_load_factor < 1.0f)) {
+      TSL_SH_THROW_OR_ABORT(std::invalid_argument,
+                            "max_load_factor must be in ]0, 1[.");
+    }
+
+    using map_value_type =
+        typename std::iterator_traits<decltype(map.begin())>::value_type;
+
+    const std::size_t nb_elements = static_cast<std::size_t>(map.size());
+    const std::size_t bucket_count =
+        tsl::detail_sparse_hash::round_up_to_power_of_two(std::max<std::size_t>(
+            nb_elements + 1,
+            static_cast<std::size_t>(
+                std::ceil(float(nb_elements) / max_load_factor))));
+    const std::size_t mask = bucket_count - 1;
+    const std::size_t nb_groups =
+        static_cast<std::size_t>(nb_groups_for(bucket_count));
+
+    // Place the values in the buckets as the lookups will probe them.
+    std::vector<std::uint64_t> bitmaps(nb_groups, 0);
+    std::vector<std::pair<std::size_t, const map_value_type *>> placed;
+    placed.reserve(nb_elements);
+
+    for (const auto &value : map) {
+      const Key key = value.first;
+      std::size_t ibucket = hash(key) & mask;
+      std::size_t probe = 0;
+      while ((bitmaps[ibucket >> GROUP_SHIFT] &
+              (std::uint64_t(1) << (ibucket & (GROUP_NB_BUCKETS - 1)))) != 0) {
+        probe++;
+        ibucket = next_bucket(ibucket, probe, mask);
+      }
+
+      bitmaps[ibucket >> GROUP_SHIFT] |= std::uint64_t(1)
+                                         << (ibucket & (GROUP_NB_BUCKETS - 1));
+      placed.emplace_back(ibucket, std::addressof(value));
+    }
+
+    if (placed.size() != nb_elements) {
+      TSL_SH_THROW_OR_ABORT(std::invalid_argument,
+                            "The size of the map doesn't match its content.");
+    }
+
+    std::sort(placed.begin(), placed.end(),
+              [](const std::pair<std::size_t, const map_value_type *> &lhs,
+                 const std::pair<std::size_t, const map_value_type *> &rhs) {
+                return lhs.first < rhs.first;
+              });
+
+    header head;
+    std::memset(&head, 0, sizeof(header));
+    std::memcpy(head.magic, magic(), sizeof(head.magic));
+    head.endianness = ENDIANNESS_MARKER;
+    head.version = FORMAT_VERSION;
+    head.size_t_size = sizeof(std::size_t);
+    head.key_size = sizeof(Key);
+    head.mapped_size = sizeof(T);
+    head.value_size = sizeof(value_type);
+    head.value_alignment = alignof(value_type);
+    head.bucket_count = bucket_count;
+    head.nb_elements = nb_elements;
+    head.groups_offset = round_up(sizeof(header), alignof(group));
+    head.values_offset = round_up(
+        head.groups_offset + nb_groups * sizeof(group), alignof(value_type));
+    head.total_size = head.values_offset + nb_elements * sizeof(value_type);
+
+    buffered_writer<Writer> out(writer);
+    out.write(&head, sizeof(header));
+    out.write_padding(head.groups_offset - sizeof(header));
+
+    std::uint64_t values_index = 0;
+    for (const std::uint64_t bitmap : bitmaps) {
+      group grp;
+      grp.bitmap = bitmap;
+      grp.values_index = values_index;
+      out.write(&grp, sizeof(group));
+
+      values_index += static_cast<std::uint64_t>(
+          tsl::detail_popcount::popcountll(bitmap));
+    }
+    out.write_padding(static_cast<std::size_t>(
+        head.values_offset - head.groups_offset - nb_groups * sizeof(group)));
+
+    for (const auto &entry : placed) {
+      // Zero the padding bytes of the struct to write a deterministic block.
+      alignas(value_type) unsigned char storage[sizeof(value_type)];
+      std::memset(storage, 0, sizeof(value_type));
+      ::new (static_cast<void *>(storage))
+          value_type{entry.second->first, entry.second->second};
+      out.write(storage, sizeof(value_type));
+    }
+    out.flush();
+
+    return static_cast<std::size_t>(head.total_size);
+  }
+
+  /*
+   * Iterators, in the order of the buckets.
+   */
+  const_iterator begin() const noexcept { return m_values; }
+  const_iterator cbegin() const noexcept { return m_values; }
+  const_iterator end() const noexcept { return m_values + m_nb_elements; }
+  const_iterator cend() const noexcept { return end(); }
+
+  /*
+   * Capacity
+   */
+  bool empty() const noexcept { return m_nb_elements == 0; }
+  size_type size() const noexcept { return m_nb_elements; }
+  size_type bucket_count() const noexcept {
+    return m_groups == nullptr ? 0 : m_mask + 1;
+  }
+
+  /*
+   * Lookup
+   */
+  const T &at(const Key &key) const {
+    const auto it = find(key);
+    if (it == end()) {
+      TSL_SH_THROW_OR_ABORT(std::out_of_range, "Couldn't find key.");
+    }
+
+    return it->second;
+  }
+
+  size_type count(const Key &key) const { return find(key) != end() ? 1 : 0; }
+
+  bool contains(const Key &key) const { return find(key) != end(); }
+
+  const_iterator find(const Key &key) const {
+    return find(key, Hash::operator()(key));
+  }
+
+  /**
+   * Use the hash value `precalculated_hash` instead of hashing the key. The
+   * hash value should be the same as `hash_function()(key)`, otherwise the
+   * behaviour is undefined.
+   */
+  const_iterator find(const Key &key, std::size_t precalculated_hash) const {
+    if (m_groups == nullptr) {
+      return end();
+    }
+
+    std::size_t ibucket = precalculated_hash & m_mask;
+    std::size_t probe = 0;
+    while (probe <= m_mask) {
+      const group &grp = m_groups[ibucket >> GROUP_SHIFT];
+      const std::size_t index = ibucket & (GROUP_NB_BUCKETS - 1);
+      const std::uint64_t bit = std::uint64_t(1) << index;
+      if ((grp.bitmap & bit) == 0) {
+        return end();
+      }
+
+      const std::uint64_t ivalue =
+          grp.values_index + static_cast<std::uint64_t>(
+                                 tsl::detail_popcount::popcountll(
+                                     grp.bitmap & (bit - 1)));
+      // The group table is not validated on opening, check the bounds here.
+      if (ivalue >= m_nb_elements) {
+        return end();
+      }
+
+      if (KeyEqual::operator()(key, m_values[ivalue].first)) {
+        return m_values + ivalue;
+      }
+
+      probe++;
+      ibucket = next_bucket(ibucket, probe, m_mask);
+    }
+
+    return end();
+  }
+
+  /*
+   * Observers
+   */
+  hasher hash_function() const { return static_cast<const Hash &>(*this); }
+  key_equal key_eq() const { return static_cast<const KeyEqual &>(*this); }
+
+ private:
+  /**
+   * Accumulate the small writes in a buffer to call the writer with blocks of
+   * reasonable size.
+   */
+  template <class Writer>
+  class buffered_writer {
+   public:
+    explicit buffered_writer(Writer &writer) : m_writer(writer) {
+      m_buffer.reserve(BUFFER_SIZE);
+    }
+
+    void write(const void *data, std::size_t size) {
+      const char *bytes = static_cast<const char *>(data);
+      m_buffer.insert(m_buffer.end(), bytes, bytes + size);
+      if (m_buffer.size() >= BUFFER_SIZE) {
+        flush();
+      }
+    }
+
+    void write_padding(std::size_t size) {
+      m_buffer.insert(m_buffer.end(), size, '\0');
+    }
+
+    void flush() {
+      if (!m_buffer.empty()) {
+        m_writer(m_buffer.data(), m_buffer.size());
+        m_buffer.clear();
+      }
+    }
+
+   private:
+    static const std::size_t BUFFER_SIZE = 64 * 1024;
+
+    typename std::remove_reference<Writer>::type &m_writer;
+    std::vector<char> m_buffer;
+  };
+
+  static std::uint64_t nb_groups_for(std::uint64_t bucket_count) noexcept {
+    return std::max<std::uint64_t>(1, bucket_count >> GROUP_SHIFT);
+  }
+
+  static std::size_t next_bucket(std::size_t ibucket, std::size_t probe,
+                                 std::size_t mask) noexcept {
+    return (ibucket + probe) & mask;
+  }
+
+  static std::uint64_t round_up(std::uint64_t value,
+                                std::uint64_t multiple) noexcept {
+    return (value + multiple - 1) / multiple * multiple;
+  }
+
+ private:
+  const group *m_groups;
+  const value_type *m_values;
+  std::size_t m_mask;
+  std::size_t m_nb_elements;
+};
+
+}  // end namespace tsl
+
+#endif
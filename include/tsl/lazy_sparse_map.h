@@ -0,0 +1,338 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2017 Thibaut Goetghebuer-Planchon <tessil@gmx.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef TSL_LAZY_SPARSE_MAP_H
+#define TSL_LAZY_SPARSE_MAP_H
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+#include "frozen_sparse_map.h"
+#include "sparse_map.h"
+#include "sparse_set.h"
+
+namespace tsl {
+
+/**
+ * Mutable hash map opened over a `tsl::frozen_sparse_map` snapshot, typically
+ * a file mapped in memory with `mmap`.
+ *
+ * Opening the map doesn't read nor copy the snapshot, only its header is
+ * checked. The lookups run directly over the snapshot and the OS only loads
+ * the pages of the groups of buckets that are actually accessed. A value is
+ * copied from the snapshot into a mutable `tsl::sparse_map` overlay on the
+ * first access that may modify it (`operator[]`, non-const `at`). The inserted
+ * values also go into the overlay and the erased keys of the snapshot are
+ * remembered in a `tsl::sparse_set`, the snapshot itself is never written.
+ *
+ * A process which only touches a small part of a huge table during its
+ * lifetime thus only pays for this part, instead of deserializing the whole
+ * table at startup. `materialize` builds a complete `tsl::sparse_map` when
+ * the whole content is needed.
+ *
+ * A lookup checks the overlay, then the erased keys and then the snapshot.
+ * The key is only hashed once for the three. As with `tsl::frozen_sparse_map`,
+ * `Key` and `T` must be trivially copyable and the snapshot must stay valid
+ * while the map is used.
+ */
+template <class Key, class T, class Hash = std::hash<Key>,
+          class KeyEqual = std::equal_to<Key>,
+          class Allocator = std::allocator<std::pair<Key, T>>>
+class lazy_sparse_map {
+ public:
+  using frozen_map_type = tsl::frozen_sparse_map<Key, T, Hash, KeyEqual>;
+  using map_type = tsl::sparse_map<Key, T, Hash, KeyEqual, Allocator>;
+  using key_type = Key;
+  using mapped_type = T;
+  using size_type = std::size_t;
+  using hasher = Hash;
+  using key_equal = KeyEqual;
+
+ private:
+  using erased_set_type = tsl::sparse_set<
+      Key, Hash, KeyEqual,
+      typename std::allocator_traits<Allocator>::template rebind_alloc<Key>>;
+
+ public:
+  /**
+   * Open the map over `snapshot`.
+   */
+  explicit lazy_sparse_map(frozen_map_type snapshot = frozen_map_type())
+      : m_snapshot(snapshot),
+        m_overlay(0, snapshot.hash_function(), snapshot.key_eq()),
+        m_erased(0, snapshot.hash_function(), snapshot.key_eq()),
+        m_nb_elements(snapshot.size()) {}
+
+  /**
+   * Open the map over the `size` bytes at `data`, as created by
+   * `frozen_map_type::freeze`. Throw `std::runtime_error` if the block is not
+   * a valid frozen map, see `tsl::frozen_sparse_map`.
+   *
+   * No copy is done, `data` must stay valid while the map is used.
+   */
+  lazy_sparse_map(const void *data, std::size_t size,
+                  const Hash &hash = Hash(),
+                  const KeyEqual &equal = KeyEqual())
+      : lazy_sparse_map(frozen_map_type(data, size, hash, equal)) {}
+
+  /*
+   * Capacity
+   */
+  bool empty() const noexcept { return m_nb_elements == 0; }
+  size_type size() const noexcept { return m_nb_elements; }
+
+  /**
+   * Number of values held by the mutable overlay: the values inserted since
+   * the opening and the values copied from the snapshot on their first
+   * modifying access.
+   */
+  size_type overlay_size() const noexcept { return m_overlay.size(); }
+
+  /*
+   * Modifiers
+   */
+  void clear() {
+    m_snapshot = frozen_map_type(m_snapshot.hash_function(),
+                                 m_snapshot.key_eq());
+    m_overlay.clear();
+    m_erased.clear();
+    m_nb_elements = 0;
+  }
+
+  /**
+   * Insert `obj` as value of `key`, or assign it if `key` is already present.
+   * Return true if the key was inserted.
+   */
+  template <class M>
+  bool insert_or_assign(const key_type &key, M &&obj) {
+    const std::size_t hash = m_overlay.hash_function()(key);
+
+    auto it = m_overlay.find(key, hash);
+    if (it != m_overlay.end()) {
+      it.value() = std::forward<M>(obj);
+      return false;
+    }
+
+    const bool in_snapshot = find_in_snapshot(key, hash) != nullptr;
+    m_overlay.insert_or_assign(key, std::forward<M>(obj));
+    if (in_snapshot) {
+      return false;
+    }
+
+    m_erased.erase(key, hash);
+    m_nb_elements++;
+    return true;
+  }
+
+  /**
+   * Return the number of erased values (0 or 1).
+   */
+  size_type erase(const key_type &key) {
+    const std::size_t hash = m_overlay.hash_function()(key);
+
+    // An erased key of the snapshot is never in the overlay.
+    if (!m_erased.empty() && m_erased.count(key, hash) != 0) {
+      return 0;
+    }
+
+    const bool in_snapshot = m_snapshot.find(key, hash) != m_snapshot.end();
+    // Remember the erased key before touching the overlay so that an
+    // exception can't make the old value of the snapshot visible again.
+    if (in_snapshot) {
+      m_erased.insert(key);
+    }
+
+    const bool in_overlay = m_overlay.erase(key, hash) == 1;
+    if (!in_snapshot && !in_overlay) {
+      return 0;
+    }
+
+    m_nb_elements--;
+    return 1;
+  }
+
+  /**
+   * Return a reference to the value of `key`, copying it from the snapshot
+   * into the overlay on the first call for this key. Insert a default
+   * constructed value if the key is not present.
+   */
+  T &operator[](const key_type &key) {
+    const std::size_t hash = m_overlay.hash_function()(key);
+
+    T *value = find_or_fault(key, hash);
+    if (value != nullptr) {
+      return *value;
+    }
+
+    T &inserted = m_overlay.try_emplace(key).first.value();
+    m_erased.erase(key, hash);
+    m_nb_elements++;
+
+    return inserted;
+  }
+
+  /*
+   * Lookup
+   */
+
+  /**
+   * Return a reference to the value of `key`, copying it from the snapshot
+   * into the overlay on the first call for this key. Throw
+   * `std::out_of_range` if the key is not present.
+   */
+  T &at(const key_type &key) {
+    T *value = find_or_fault(key, m_overlay.hash_function()(key));
+    if (value == nullptr) {
+      TSL_SH_THROW_OR_ABORT(std::out_of_range, "Couldn't find key.");
+    }
+
+    return *value;
+  }
+
+  /**
+   * Same as the non-const `at` but never copies anything into the overlay.
+   */
+  const T &at(const key_type &key) const {
+    const T *value = find(key, m_overlay.hash_function()(key));
+    if (value == nullptr) {
+      TSL_SH_THROW_OR_ABORT(std::out_of_range, "Couldn't find key.");
+    }
+
+    return *value;
+  }
+
+  size_type count(const key_type &key) const { return contains(key) ? 1 : 0; }
+
+  bool contains(const key_type &key) const {
+    return find(key, m_overlay.hash_function()(key)) != nullptr;
+  }
+
+  /**
+   * Call `f(key, value)` for each value of the map. `f` must be a function
+   * object supporting the call `void operator()(const Key&, const T&);`.
+   *
+   * The values of the overlay are visited first, followed by the values of
+   * the snapshot that are still visible. All the pages of the snapshot are
+   * thus accessed.
+   */
+  template <class F>
+  void for_each(F &&f) const {
+    for (const auto &value : m_overlay) {
+      f(value.first, value.second);
+    }
+
+    const bool check_overlay = !m_overlay.empty();
+    const bool check_erased = !m_erased.empty();
+    for (const auto &value : m_snapshot) {
+      if ((check_overlay || check_erased) &&
+          is_shadowed(value.first, m_overlay.hash_function()(value.first))) {
+        continue;
+      }
+
+      f(value.first, value.second);
+    }
+  }
+
+  /**
+   * Copy the whole content of the map in a `tsl::sparse_map`.
+   */
+  map_type materialize() const {
+    map_type map(0, m_overlay.hash_function(), m_overlay.key_eq(),
+                 m_overlay.get_allocator());
+    map.reserve(size());
+    for_each(
+        [&](const Key &key, const T &value) { map.insert({key, value}); });
+
+    return map;
+  }
+
+  /*
+   * Observers
+   */
+  const frozen_map_type &snapshot() const noexcept { return m_snapshot; }
+  hasher hash_function() const { return m_overlay.hash_function(); }
+  key_equal key_eq() const { return m_overlay.key_eq(); }
+
+ private:
+  /**
+   * Return true if the value of `key` in the snapshot is hidden by the overlay
+   * or has been erased.
+   */
+  bool is_shadowed(const key_type &key, std::size_t hash) const {
+    return m_overlay.count(key, hash) != 0 || m_erased.count(key, hash) != 0;
+  }
+
+  /**
+   * Return the value of `key` in the snapshot if it has not been erased,
+   * nullptr otherwise. `key` must not be in the overlay.
+   */
+  const T *find_in_snapshot(const key_type &key, std::size_t hash) const {
+    if (!m_erased.empty() && m_erased.count(key, hash) != 0) {
+      return nullptr;
+    }
+
+    auto it = m_snapshot.find(key, hash);
+    return (it != m_snapshot.end()) ? std::addressof(it->second) : nullptr;
+  }
+
+  const T *find(const key_type &key, std::size_t hash) const {
+    auto it = m_overlay.find(key, hash);
+    if (it != m_overlay.end()) {
+      return std::addressof(it->second);
+    }
+
+    return find_in_snapshot(key, hash);
+  }
+
+  /**
+   * Return a mutable pointer to the value of `key` in the overlay, copying it
+   * first from the snapshot if needed. Return nullptr if the key is not
+   * present.
+   */
+  T *find_or_fault(const key_type &key, std::size_t hash) {
+    auto it = m_overlay.find(key, hash);
+    if (it != m_overlay.end()) {
+      return std::addressof(it.value());
+    }
+
+    const T *value = find_in_snapshot(key, hash);
+    if (value == nullptr) {
+      return nullptr;
+    }
+
+    return std::addressof(m_overlay.insert({key, *value}).first.value());
+  }
+
+ private:
+  frozen_map_type m_snapshot;
+  map_type m_overlay;
+  erased_set_type m_erased;
+  size_type m_nb_elements;
+};
+
+}  // end namespace tsl
+
+#endif
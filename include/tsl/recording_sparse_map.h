@@ -0,0 +1,526 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2017 Thibaut Goetghebuer-Planchon <tessil@gmx.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef TSL_RECORDING_SPARSE_MAP_H
+#define TSL_RECORDING_SPARSE_MAP_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <istream>
+#include <limits>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include "sparse_map.h"
+#include "sparse_stream.h"
+
+namespace tsl {
+
+namespace sh {
+
+/**
+ * Operations of a trace recorded by `tsl::recording_sparse_map`.
+ */
+enum class trace_op : std::uint8_t {
+  /**
+   * Marks the end of a complete trace, never returned by
+   * `trace_reader::read`.
+   */
+  end = 0,
+  /**
+   * Insert the key if it's not present (`insert`, `try_emplace`,
+   * `operator[]`).
+   */
+  insert = 1,
+  insert_or_assign = 2,
+  /**
+   * Look the key up (`find`, `at`, `count`, `contains`).
+   */
+  find = 3,
+  erase = 4,
+  /**
+   * Clear the map, the record has no hash nor key.
+   */
+  clear = 5
+};
+
+struct trace_record {
+  trace_op op;
+  std::uint64_t hash;
+  /**
+   * Bytes of the key, in the native representation of the platform for the
+   * fixed size keys.
+   */
+  std::string key;
+};
+
+}  // namespace sh
+
+namespace detail_sparse_trace {
+
+/**
+ * Layout of a trace:
+ * - a header with a magic number, an endianness marker, the format version,
+ *   the size of the keys (0 if they are strings of variable size) and the
+ *   size of the mapped values;
+ * - the records, each one being the operation on one byte followed, for all
+ *   operations but `clear`, by the hash of the key on 64 bits, the size of
+ *   the key as a varint if the keys have a variable size and the bytes of the
+ *   key;
+ * - a `trace_op::end` byte.
+ */
+struct trace_header {
+  char magic[8];
+  std::uint32_t endianness;
+  std::uint32_t version;
+  std::uint32_t key_size;
+  std::uint32_t value_size;
+};
+
+static_assert(sizeof(trace_header) == 24,
+              "Unexpected padding in the trace header.");
+
+static const std::uint32_t TRACE_VERSION = 1;
+static const std::uint32_t TRACE_ENDIANNESS_MARKER = 0x01020304;
+static const std::uint64_t TRACE_MAX_KEY_SIZE = std::uint64_t(1) << 30;
+
+inline const char *trace_magic() noexcept { return "TSLTRACE"; }
+
+/**
+ * Read bytes directly from a `std::streambuf`, which does its own buffering,
+ * so that the reader never consumes more than the trace.
+ *
+ * A read past the end of the stream fills the missing bytes with zeros and
+ * marks the reader as truncated instead of failing, a trace whose recording
+ * was interrupted can end anywhere.
+ */
+class streambuf_reader {
+ public:
+  explicit streambuf_reader(std::streambuf &streambuf)
+      : m_streambuf(streambuf), m_truncated(false) {}
+
+  void read_bytes(void *data, std::size_t size) {
+    char *bytes = static_cast<char *>(data);
+    while (size > 0 && !m_truncated) {
+      const std::size_t chunk_size = std::min<std::size_t>(
+          size, static_cast<std::size_t>(
+                    std::numeric_limits<std::streamsize>::max()));
+      const std::streamsize nb_read =
+          m_streambuf.sgetn(bytes, static_cast<std::streamsize>(chunk_size));
+      if (nb_read <= 0) {
+        m_truncated = true;
+        break;
+      }
+
+      bytes += nb_read;
+      size -= static_cast<std::size_t>(nb_read);
+    }
+
+    std::memset(bytes, 0, size);
+  }
+
+  bool truncated() const noexcept { return m_truncated; }
+
+ private:
+  std::streambuf &m_streambuf;
+  bool m_truncated;
+};
+
+}  // namespace detail_sparse_trace
+
+namespace sh {
+
+/**
+ * Write a trace of operations on a map with keys of type `Key`, see
+ * `tsl::recording_sparse_map`. The keys must be trivially copyable or a
+ * `std::basic_string` of trivially copyable characters.
+ *
+ * The writes are buffered by a `tsl::sh::stream_serializer`. `finish()` must
+ * be called once the recording is done to write the end marker and flush the
+ * stream, the destructor only does a best effort `finish()` which ignores the
+ * errors. A trace whose recording was interrupted, e.g. by a crash, is still
+ * readable up to its last complete record.
+ */
+template <class Key>
+class trace_writer {
+ public:
+  explicit trace_writer(std::ostream &ostream, std::size_t value_size = 0)
+      : trace_writer(*ostream.rdbuf(), value_size) {}
+
+  /**
+   * `value_size` is the size of the mapped values, only used by the replay
+   * to choose the size of its values.
+   */
+  explicit trace_writer(std::streambuf &streambuf, std::size_t value_size = 0)
+      : m_serializer(streambuf), m_finished(false) {
+    detail_sparse_trace::trace_header header;
+    std::memcpy(header.magic, detail_sparse_trace::trace_magic(),
+                sizeof(header.magic));
+    header.endianness = detail_sparse_trace::TRACE_ENDIANNESS_MARKER;
+    header.version = detail_sparse_trace::TRACE_VERSION;
+    header.key_size = fixed_key_size(is_string());
+    header.value_size = static_cast<std::uint32_t>(value_size);
+
+    m_serializer.write_bytes(&header, sizeof(header));
+  }
+
+  trace_writer(const trace_writer &) = delete;
+  trace_writer &operator=(const trace_writer &) = delete;
+
+  ~trace_writer() {
+    TSL_SH_TRY { finish(); }
+    TSL_SH_CATCH(...) {}
+  }
+
+  /**
+   * Record `op` on `key`, `hash` being the hash of the key. `op` can't be
+   * `trace_op::end` nor `trace_op::clear`.
+   */
+  void write(trace_op op, std::size_t hash, const Key &key) {
+    tsl_sh_assert(op != trace_op::end && op != trace_op::clear);
+    tsl_sh_assert(!m_finished);
+
+    const std::uint64_t hash64 = hash;
+    m_serializer.write_bytes(&op, sizeof(op));
+    m_serializer.write_bytes(&hash64, sizeof(hash64));
+    write_key(key, is_string());
+  }
+
+  void write_clear() {
+    tsl_sh_assert(!m_finished);
+
+    const trace_op op = trace_op::clear;
+    m_serializer.write_bytes(&op, sizeof(op));
+  }
+
+  /**
+   * Write the end marker and flush the stream. Nothing can be recorded
+   * afterwards.
+   */
+  void finish() {
+    if (m_finished) {
+      return;
+    }
+
+    m_finished = true;
+    const trace_op op = trace_op::end;
+    m_serializer.write_bytes(&op, sizeof(op));
+    m_serializer.flush();
+  }
+
+ private:
+  using is_string = detail_sparse_stream::is_basic_string<Key>;
+
+  static_assert(is_string::value ||
+                    detail_sparse_hash::is_raw_serializable<Key>::value,
+                "The key must be trivially copyable or a std::basic_string.");
+
+  static std::uint32_t fixed_key_size(std::false_type /*is_string*/) {
+    return sizeof(Key);
+  }
+
+  static std::uint32_t fixed_key_size(std::true_type /*is_string*/) {
+    return 0;
+  }
+
+  void write_key(const Key &key, std::false_type /*is_string*/) {
+    m_serializer.write_bytes(std::addressof(key), sizeof(Key));
+  }
+
+  void write_key(const Key &key, std::true_type /*is_string*/) {
+    using char_type = typename Key::value_type;
+    static_assert(std::is_trivially_copyable<char_type>::value,
+                  "The characters of the string must be trivially copyable.");
+
+    const std::size_t nb_bytes = key.size() * sizeof(char_type);
+    detail_sparse_hash::serialize_size(m_serializer, nb_bytes,
+                                       std::true_type());
+    m_serializer.write_bytes(key.data(), nb_bytes);
+  }
+
+ private:
+  stream_serializer m_serializer;
+  bool m_finished;
+};
+
+/**
+ * Read a trace written by `tsl::sh::trace_writer`, record by record.
+ *
+ * A trace without end marker, because its recording was interrupted, ends
+ * after its last complete record. Throw `std::runtime_error` if the stream is
+ * not a trace, was written on a platform with another endianness, or is
+ * corrupted.
+ */
+class trace_reader {
+ public:
+  explicit trace_reader(std::istream &istream)
+      : trace_reader(*istream.rdbuf()) {}
+
+  explicit trace_reader(std::streambuf &streambuf)
+      : m_reader(streambuf), m_complete(false), m_nb_records(0) {
+    m_reader.read_bytes(&m_header, sizeof(m_header));
+    if (m_reader.truncated() ||
+        std::memcmp(m_header.magic, detail_sparse_trace::trace_magic(),
+                    sizeof(m_header.magic)) != 0) {
+      TSL_SH_THROW_OR_ABORT(std::runtime_error, "The data is not a trace.");
+    }
+
+    if (m_header.endianness != detail_sparse_trace::TRACE_ENDIANNESS_MARKER ||
+        m_header.version != detail_sparse_trace::TRACE_VERSION) {
+      TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                            "The trace was created with an incompatible "
+                            "format or platform.");
+    }
+  }
+
+  /**
+   * Size in bytes of the keys, 0 if they are strings of variable size.
+   */
+  std::size_t key_size() const noexcept { return m_header.key_size; }
+
+  std::size_t value_size() const noexcept { return m_header.value_size; }
+
+  /**
+   * Read the next record into `record`. Return false once the end of the
+   * trace is reached.
+   */
+  bool read(trace_record &record) {
+    if (m_complete || m_reader.truncated()) {
+      return false;
+    }
+
+    trace_op op;
+    m_reader.read_bytes(&op, sizeof(op));
+    if (m_reader.truncated()) {
+      return false;
+    }
+
+    if (op == trace_op::end) {
+      m_complete = true;
+      return false;
+    }
+
+    if (op == trace_op::clear) {
+      record.op = op;
+      record.hash = 0;
+      record.key.clear();
+      m_nb_records++;
+      return true;
+    }
+
+    if (op != trace_op::insert && op != trace_op::insert_or_assign &&
+        op != trace_op::find && op != trace_op::erase) {
+      TSL_SH_THROW_OR_ABORT(std::runtime_error, "The trace is corrupted.");
+    }
+
+    record.op = op;
+    m_reader.read_bytes(&record.hash, sizeof(record.hash));
+
+    const std::uint64_t nb_key_bytes =
+        (m_header.key_size != 0)
+            ? m_header.key_size
+            : detail_sparse_hash::deserialize_varint(m_reader);
+    if (nb_key_bytes > detail_sparse_trace::TRACE_MAX_KEY_SIZE) {
+      TSL_SH_THROW_OR_ABORT(std::runtime_error, "The trace is corrupted.");
+    }
+
+    record.key.resize(static_cast<std::size_t>(nb_key_bytes));
+    if (nb_key_bytes > 0) {
+      m_reader.read_bytes(&record.key[0], record.key.size());
+    }
+
+    // The last record of an interrupted trace may be incomplete.
+    if (m_reader.truncated()) {
+      return false;
+    }
+
+    m_nb_records++;
+    return true;
+  }
+
+  /**
+   * True once the end marker has been read, false if the trace ended without
+   * it because its recording was interrupted.
+   */
+  bool complete() const noexcept { return m_complete; }
+
+  std::size_t nb_records() const noexcept { return m_nb_records; }
+
+ private:
+  detail_sparse_trace::streambuf_reader m_reader;
+  detail_sparse_trace::trace_header m_header;
+  bool m_complete;
+  std::size_t m_nb_records;
+};
+
+}  // namespace sh
+
+/**
+ * `tsl::sparse_map` recording the stream of operations done on it into a
+ * trace, to replay the real workload of an application with the
+ * `tsl_sparse_replay` tool of the benchmarks and tune the configuration of
+ * the map (growth policy, sparsity, probing, allocator) on it.
+ *
+ * Each insertion, lookup and erase by key is recorded with the hash of the
+ * key and the bytes of the key, see `tsl::sh::trace_writer` for the
+ * supported keys. The values are not recorded. The key is only hashed once
+ * for the recording and the lookup, except for the insertions. Iterations and
+ * the other accesses through `map()` are not recorded.
+ *
+ * `finish_trace()` should be called once the recording is done, see
+ * `tsl::sh::trace_writer::finish`. The stream must stay valid while the map
+ * is used.
+ */
+template <class Key, class T, class Hash = std::hash<Key>,
+          class KeyEqual = std::equal_to<Key>,
+          class Allocator = std::allocator<std::pair<Key, T>>,
+          class GrowthPolicy = tsl::sh::power_of_two_growth_policy<2>,
+          tsl::sh::exception_safety ExceptionSafety =
+              tsl::sh::exception_safety::basic,
+          tsl::sh::sparsity Sparsity = tsl::sh::sparsity::medium>
+class recording_sparse_map {
+ public:
+  using map_type = tsl::sparse_map<Key, T, Hash, KeyEqual, Allocator,
+                                   GrowthPolicy, ExceptionSafety, Sparsity>;
+  using key_type = typename map_type::key_type;
+  using mapped_type = typename map_type::mapped_type;
+  using value_type = typename map_type::value_type;
+  using size_type = typename map_type::size_type;
+  using iterator = typename map_type::iterator;
+  using const_iterator = typename map_type::const_iterator;
+
+  /**
+   * Record the operations done on `map` into `trace`.
+   */
+  explicit recording_sparse_map(std::ostream &trace, map_type map = map_type())
+      : recording_sparse_map(*trace.rdbuf(), std::move(map)) {}
+
+  explicit recording_sparse_map(std::streambuf &trace,
+                                map_type map = map_type())
+      : m_map(std::move(map)), m_writer(trace, sizeof(T)) {}
+
+  recording_sparse_map(const recording_sparse_map &) = delete;
+  recording_sparse_map &operator=(const recording_sparse_map &) = delete;
+
+  /**
+   * The underlying map, its accesses are not recorded.
+   */
+  const map_type &map() const noexcept { return m_map; }
+
+  void finish_trace() { m_writer.finish(); }
+
+  /*
+   * Capacity
+   */
+  bool empty() const noexcept { return m_map.empty(); }
+  size_type size() const noexcept { return m_map.size(); }
+
+  /*
+   * Modifiers
+   */
+  void clear() {
+    m_writer.write_clear();
+    m_map.clear();
+  }
+
+  std::pair<iterator, bool> insert(const value_type &value) {
+    record(tsl::sh::trace_op::insert, value.first);
+    return m_map.insert(value);
+  }
+
+  std::pair<iterator, bool> insert(value_type &&value) {
+    record(tsl::sh::trace_op::insert, value.first);
+    return m_map.insert(std::move(value));
+  }
+
+  template <class M>
+  std::pair<iterator, bool> insert_or_assign(const key_type &k, M &&obj) {
+    record(tsl::sh::trace_op::insert_or_assign, k);
+    return m_map.insert_or_assign(k, std::forward<M>(obj));
+  }
+
+  template <class... Args>
+  std::pair<iterator, bool> try_emplace(const key_type &k, Args &&...args) {
+    record(tsl::sh::trace_op::insert, k);
+    return m_map.try_emplace(k, std::forward<Args>(args)...);
+  }
+
+  T &operator[](const key_type &key) {
+    record(tsl::sh::trace_op::insert, key);
+    return m_map[key];
+  }
+
+  size_type erase(const key_type &key) {
+    const std::size_t hash = record(tsl::sh::trace_op::erase, key);
+    return m_map.erase(key, hash);
+  }
+
+  /*
+   * Lookup
+   */
+  T &at(const key_type &key) {
+    const std::size_t hash = record(tsl::sh::trace_op::find, key);
+    return m_map.at(key, hash);
+  }
+
+  size_type count(const key_type &key) {
+    const std::size_t hash = record(tsl::sh::trace_op::find, key);
+    return m_map.count(key, hash);
+  }
+
+  iterator find(const key_type &key) {
+    const std::size_t hash = record(tsl::sh::trace_op::find, key);
+    return m_map.find(key, hash);
+  }
+
+  bool contains(const key_type &key) {
+    const std::size_t hash = record(tsl::sh::trace_op::find, key);
+    return m_map.contains(key, hash);
+  }
+
+  iterator end() noexcept { return m_map.end(); }
+
+ private:
+  std::size_t record(tsl::sh::trace_op op, const key_type &key) {
+    const std::size_t hash = m_map.hash_function()(key);
+    m_writer.write(op, hash, key);
+
+    return hash;
+  }
+
+ private:
+  map_type m_map;
+  tsl::sh::trace_writer<Key> m_writer;
+};
+
+}  // namespace tsl
+
+#endif
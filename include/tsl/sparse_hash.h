@@ -25,14 +25,20 @@
 #define TSL_SPARSE_HASH_H
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
 #include <climits>
 #include <cmath>
 #include <cstddef>
 #include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
 #include <iterator>
 #include <limits>
 #include <memory>
+#include <thread>
 #include <tuple>
 #include <type_traits>
 #include <utility>
@@ -62,6 +68,229 @@ enum class probing { linear, quadratic };
 enum class exception_safety { basic, strong };
 
 enum class sparsity { high, medium, low };
+
+/**
+ * Breakdown of the memory allocated by a sparse_map/set, see
+ * `sparse_map::memory_usage`.
+ */
+struct memory_usage_info {
+  /**
+   * Bytes of the groups of buckets themselves (bitmaps, pointer to the values,
+   * ...) and, with structural sharing, of their reference counts.
+   */
+  std::size_t metadata_bytes;
+
+  /**
+   * Bytes of the values stored in the map.
+   */
+  std::size_t values_bytes;
+
+  /**
+   * Bytes allocated for values but not used: the difference between the
+   * capacity and the size of each group, times the size of a value.
+   */
+  std::size_t slack_bytes;
+
+  /**
+   * Number of buckets marked as deleted.
+   */
+  std::size_t nb_tombstones;
+
+  std::size_t total_bytes() const noexcept {
+    return metadata_bytes + values_bytes + slack_bytes;
+  }
+};
+
+/**
+ * Distribution of the occupancy and of the capacity of the groups of buckets
+ * of a sparse_map/set, see `sparse_map::group_occupancy`.
+ */
+struct group_occupancy_info {
+  struct allocation_size {
+    std::size_t nb_bytes;
+    std::size_t nb_allocations;
+  };
+
+  /**
+   * `size_histogram[n]` is the number of groups holding `n` values, for `n`
+   * from 0 to the number of buckets in a group.
+   */
+  std::vector<std::size_t> size_histogram;
+
+  /**
+   * `capacity_histogram[n]` is the number of groups with a capacity of `n`
+   * values.
+   */
+  std::vector<std::size_t> capacity_histogram;
+
+  /**
+   * Sizes in bytes of the allocations holding the values of the groups, by
+   * increasing size, with their number. The groups without capacity and the
+   * groups whose values are in the block allocated by `deserialize_in_arena`
+   * don't have their own allocation.
+   */
+  std::vector<allocation_size> allocation_sizes;
+};
+
+/**
+ * Statistics on the probing of the lookups, insertions and erasures of a
+ * sparse_map/set, see `sparse_map::stats`. Only recorded if `TSL_SH_STATS` is
+ * defined.
+ */
+struct probe_stats {
+  static const std::size_t HISTOGRAM_SIZE = 16;
+
+  struct operation_stats {
+    std::uint64_t nb_operations;
+
+    /**
+     * Total number of buckets probed after the initial bucket of the hash.
+     */
+    std::uint64_t nb_probes;
+
+    /**
+     * `histogram[i]` is the number of operations which probed `i` buckets
+     * after the initial one. The last entry counts all the operations with
+     * `HISTOGRAM_SIZE - 1` probes or more.
+     */
+    std::uint64_t histogram[HISTOGRAM_SIZE];
+
+    double average_probes() const noexcept {
+      return (nb_operations == 0) ? 0.0
+                                  : static_cast<double>(nb_probes) /
+                                        static_cast<double>(nb_operations);
+    }
+  };
+
+  operation_stats find;
+  operation_stats insert;
+  operation_stats erase;
+
+  /**
+   * Number of buckets marked as deleted crossed while probing.
+   */
+  std::uint64_t nb_tombstones_skipped;
+
+  /**
+   * Number of calls to the `KeyEqual` function while probing.
+   */
+  std::uint64_t nb_key_comparisons;
+};
+
+enum class rehash_reason {
+  /**
+   * The map grows as the maximum load factor has been reached.
+   */
+  grow,
+
+  /**
+   * The buckets marked as deleted are cleared, without changing the bucket
+   * count, as too many of them have accumulated.
+   */
+  purge_deleted,
+
+  /**
+   * The hash quality monitor switched the map to seeded mixing of the hashes,
+   * the values are redistributed without changing the bucket count.
+   */
+  reseed
+};
+
+/**
+ * Event passed to the rehash observer of a sparse_map/set, see
+ * `sparse_map::rehash_observer`.
+ */
+struct rehash_event {
+  rehash_reason reason;
+
+  /**
+   * False when the observer is called before the rehash, true after.
+   */
+  bool completed;
+
+  std::size_t old_bucket_count;
+
+  /**
+   * Bucket count after the rehash. Before the rehash, the requested bucket
+   * count, which may still be rounded up by the growth policy.
+   */
+  std::size_t new_bucket_count;
+
+  std::size_t nb_elements;
+
+  /**
+   * Number of buckets marked as deleted before the rehash.
+   */
+  std::size_t nb_deleted_buckets;
+
+  /**
+   * Duration of the rehash, zero before the rehash.
+   */
+  std::chrono::nanoseconds elapsed;
+};
+
+using rehash_observer = std::function<void(const rehash_event &)>;
+
+/**
+ * Report of the hash quality monitor of a sparse_map/set, see
+ * `sparse_map::hash_quality_monitor`.
+ */
+struct hash_quality_event {
+  /**
+   * Average number of buckets probed after the initial bucket of the hash by
+   * the sampled insertions of the window.
+   */
+  double average_probes;
+
+  std::size_t nb_samples;
+  std::size_t bucket_count;
+  std::size_t nb_elements;
+
+  /**
+   * True if the map switches to seeded mixing of the hashes and rehashes
+   * itself right after the report.
+   */
+  bool reseeded;
+};
+
+/**
+ * Configuration of the hash quality monitor of a sparse_map/set, see
+ * `sparse_map::hash_quality_monitor`. Disabled by default.
+ */
+struct hash_quality_monitor {
+  hash_quality_monitor() noexcept
+      : max_average_probes(0.0f),
+        sample_interval(16),
+        window_size(256),
+        reseed(false) {}
+
+  /**
+   * Report the windows whose average number of probes per sampled insertion
+   * exceeds this threshold. The monitor is disabled if it's not positive.
+   */
+  float max_average_probes;
+
+  /**
+   * Sample one insertion of a new key out of `sample_interval`.
+   */
+  std::size_t sample_interval;
+
+  /**
+   * Number of samples averaged before comparing them to the threshold.
+   */
+  std::size_t window_size;
+
+  /**
+   * Switch to seeded mixing of the hashes on the first bad window, instead
+   * of only reporting it.
+   */
+  bool reseed;
+
+  /**
+   * Called on each window exceeding the threshold, may be empty.
+   */
+  std::function<void(const hash_quality_event &)> observer;
+};
 }  // namespace sh
 
 namespace detail_popcount {
@@ -218,6 +447,36 @@ inline std::size_t round_up_to_power_of_two(std::size_t value) {
   return value + 1;
 }
 
+/**
+ * Mix `hash` with `seed` through the finalizer of SplitMix64 so that every bit
+ * of the result depends on every bit of the hash. Used by the maps whose hash
+ * quality monitor detected a bad hash function.
+ */
+inline std::size_t mix_hash(std::size_t hash, std::size_t seed) noexcept {
+  std::uint64_t x = std::uint64_t(hash) ^ std::uint64_t(seed);
+  x = (x ^ (x >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+  x = (x ^ (x >> 27)) * UINT64_C(0x94d049bb133111eb);
+  x = x ^ (x >> 31);
+
+  return static_cast<std::size_t>(x ^ (x >> 32));
+}
+
+/**
+ * Non-zero seed for `mix_hash`, different for each call.
+ */
+inline std::size_t generate_hash_seed() noexcept {
+  static std::atomic<std::uint64_t> counter(0);
+
+  const std::uint64_t time = static_cast<std::uint64_t>(
+      std::chrono::steady_clock::now().time_since_epoch().count());
+  const std::size_t seed = mix_hash(
+      static_cast<std::size_t>(time),
+      static_cast<std::size_t>(counter.fetch_add(1, std::memory_order_relaxed) *
+                               UINT64_C(0x9e3779b97f4a7c15)));
+
+  return (seed == 0) ? 1 : seed;
+}
+
 template <typename T, typename U>
 static T numeric_cast(U value,
                       const char *error_message = "numeric_cast() failed.") {
@@ -257,6 +516,328 @@ static T deserialize_value(Deserializer &deserializer) {
 #endif
 }
 
+/**
+ * Serialize `value` as an unsigned LEB128 varint (7 bits per byte, the high
+ * bit marking that more bytes follow) through `serializer.write_bytes`.
+ */
+template <class Serializer>
+static void serialize_size(Serializer &serializer, slz_size_type value,
+                           std::true_type /*varint*/) {
+  unsigned char bytes[(sizeof(slz_size_type) * CHAR_BIT + 6) / 7];
+  std::size_t nb_bytes = 0;
+  while (value >= 0x80) {
+    bytes[nb_bytes++] = static_cast<unsigned char>((value & 0x7F) | 0x80);
+    value >>= 7;
+  }
+  bytes[nb_bytes++] = static_cast<unsigned char>(value);
+
+  serializer.write_bytes(bytes, nb_bytes);
+}
+
+template <class Serializer>
+static void serialize_size(Serializer &serializer, slz_size_type value,
+                           std::false_type /*varint*/) {
+  serializer(value);
+}
+
+template <class Deserializer>
+static slz_size_type deserialize_varint(Deserializer &deserializer) {
+  const unsigned nb_bits = sizeof(slz_size_type) * CHAR_BIT;
+
+  slz_size_type value = 0;
+  for (unsigned shift = 0; shift < nb_bits; shift += 7) {
+    unsigned char byte;
+    deserializer.read_bytes(&byte, 1);
+
+    const slz_size_type bits = byte & 0x7F;
+    if (shift + 7 > nb_bits && (bits >> (nb_bits - shift)) != 0) {
+      break;
+    }
+
+    value |= bits << shift;
+    if ((byte & 0x80) == 0) {
+      return value;
+    }
+  }
+
+  TSL_SH_THROW_OR_ABORT(std::runtime_error, "Deserialized varint is invalid.");
+}
+
+template <class Deserializer>
+static slz_size_type deserialize_size(Deserializer &deserializer, bool varint,
+                                      std::true_type /*has_read_bytes*/) {
+  return varint ? deserialize_varint(deserializer)
+                : deserialize_value<slz_size_type>(deserializer);
+}
+
+template <class Deserializer>
+static slz_size_type deserialize_size(Deserializer &deserializer, bool varint,
+                                      std::false_type /*has_read_bytes*/) {
+  tsl_sh_assert(!varint);
+  (void)varint;
+  return deserialize_value<slz_size_type>(deserializer);
+}
+
+/**
+ * Check if the serializer provides the optional
+ * `void write_bytes(const void* data, std::size_t size)` method.
+ */
+template <typename T, typename = void>
+struct has_write_bytes : std::false_type {};
+
+template <typename T>
+struct has_write_bytes<
+    T, typename make_void<decltype(std::declval<T &>().write_bytes(
+           std::declval<const void *>(), std::size_t()))>::type>
+    : std::true_type {};
+
+/**
+ * Check if the deserializer provides the optional
+ * `void read_bytes(void* data, std::size_t size)` method.
+ */
+template <typename T, typename = void>
+struct has_read_bytes : std::false_type {};
+
+template <typename T>
+struct has_read_bytes<
+    T, typename make_void<decltype(std::declval<T &>().read_bytes(
+           std::declval<void *>(), std::size_t()))>::type>
+    : std::true_type {};
+
+/**
+ * Values whose bytes can be copied as a block on serialization and
+ * deserialization. A trivially copy constructible and trivially destructible
+ * type, like a `std::pair` of trivially copyable types, can be created by a
+ * copy of its bytes.
+ */
+template <typename T>
+struct is_raw_serializable
+    : std::integral_constant<bool,
+                             std::is_trivially_copy_constructible<T>::value &&
+                                 std::is_trivially_destructible<T>::value> {};
+
+/**
+ * Implicitly convertible to the result of `factory()`, the factory being only
+ * called on conversion. Allows to construct a value in place from a factory
+ * only when the value is actually inserted.
+ */
+template <class Factory>
+class lazy_value {
+ public:
+  using result_type = decltype(std::declval<Factory &>()());
+
+  explicit lazy_value(Factory &factory) noexcept : m_factory(factory) {}
+
+  operator result_type() const { return m_factory(); }
+
+ private:
+  Factory &m_factory;
+};
+
+/**
+ * Return the `ipart`-th of the `nb_parts` contiguous sub-ranges of similar
+ * size of the range [0, size).
+ */
+inline std::pair<std::size_t, std::size_t> split_range(std::size_t size,
+                                                       std::size_t nb_parts,
+                                                       std::size_t ipart) {
+  tsl_sh_assert(nb_parts > 0 && ipart < nb_parts);
+  const std::size_t part_size = size / nb_parts;
+  const std::size_t remainder = size % nb_parts;
+
+  const std::size_t begin = ipart * part_size + std::min(ipart, remainder);
+  return std::make_pair(begin, begin + part_size + (ipart < remainder ? 1 : 0));
+}
+
+/**
+ * Call `function(ithread)` for each `ithread` in [0, nb_threads). Each call is
+ * done in its own thread, except the first one which is done in the calling
+ * thread. If some calls throw, the exception of the call with the lowest
+ * `ithread` is rethrown once all the threads are joined.
+ */
+template <class Function>
+void run_in_parallel(std::size_t nb_threads, Function function) {
+  tsl_sh_assert(nb_threads > 0);
+
+  std::vector<std::exception_ptr> exceptions(nb_threads);
+  std::vector<std::thread> threads;
+  threads.reserve(nb_threads - 1);
+
+  auto run = [&](std::size_t ithread) {
+    TSL_SH_TRY { function(ithread); }
+    TSL_SH_CATCH(...) { exceptions[ithread] = std::current_exception(); }
+  };
+
+  TSL_SH_TRY {
+    for (std::size_t ithread = 1; ithread < nb_threads; ithread++) {
+      threads.emplace_back(run, ithread);
+    }
+  }
+  TSL_SH_CATCH(...) {
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    TSL_SH_RETRHOW;
+  }
+
+  run(0);
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  for (const auto &exception : exceptions) {
+    if (exception) {
+      std::rethrow_exception(exception);
+    }
+  }
+}
+
+#ifdef TSL_SH_STATS
+/**
+ * Counters of `tsl::sh::probe_stats`. They are updated with relaxed atomic
+ * loads and stores, concurrent lookups on the same map may thus lose some
+ * increments but don't race.
+ *
+ * The counters belong to a hash table object and not to its content. A copy
+ * or a move starts with empty counters and a swap, or a rehash, doesn't
+ * exchange them.
+ */
+class probe_stats_recorder {
+ public:
+  enum class operation { find, insert, erase };
+
+  probe_stats_recorder() noexcept { reset(); }
+
+  probe_stats_recorder(const probe_stats_recorder &) noexcept
+      : probe_stats_recorder() {}
+
+  probe_stats_recorder &operator=(const probe_stats_recorder &) noexcept {
+    return *this;
+  }
+
+  void record_probes(operation op, std::size_t nb_probes) noexcept {
+    counters &op_counters = m_counters[static_cast<std::size_t>(op)];
+    increment(op_counters.nb_operations, 1);
+    increment(op_counters.nb_probes, nb_probes);
+    increment(op_counters.histogram[std::min(
+                  nb_probes, tsl::sh::probe_stats::HISTOGRAM_SIZE - 1)],
+              1);
+  }
+
+  void record_tombstone_skipped() noexcept {
+    increment(m_nb_tombstones_skipped, 1);
+  }
+
+  void record_key_comparison() noexcept {
+    increment(m_nb_key_comparisons, 1);
+  }
+
+  tsl::sh::probe_stats stats() const noexcept {
+    tsl::sh::probe_stats stats;
+    load(m_counters[static_cast<std::size_t>(operation::find)], stats.find);
+    load(m_counters[static_cast<std::size_t>(operation::insert)],
+         stats.insert);
+    load(m_counters[static_cast<std::size_t>(operation::erase)], stats.erase);
+    stats.nb_tombstones_skipped =
+        m_nb_tombstones_skipped.load(std::memory_order_relaxed);
+    stats.nb_key_comparisons =
+        m_nb_key_comparisons.load(std::memory_order_relaxed);
+
+    return stats;
+  }
+
+  void reset() noexcept {
+    for (counters &op_counters : m_counters) {
+      op_counters.nb_operations.store(0, std::memory_order_relaxed);
+      op_counters.nb_probes.store(0, std::memory_order_relaxed);
+      for (auto &count : op_counters.histogram) {
+        count.store(0, std::memory_order_relaxed);
+      }
+    }
+    m_nb_tombstones_skipped.store(0, std::memory_order_relaxed);
+    m_nb_key_comparisons.store(0, std::memory_order_relaxed);
+  }
+
+ private:
+  struct counters {
+    std::atomic<std::uint64_t> nb_operations;
+    std::atomic<std::uint64_t> nb_probes;
+    std::atomic<std::uint64_t>
+        histogram[tsl::sh::probe_stats::HISTOGRAM_SIZE];
+  };
+
+  static void increment(std::atomic<std::uint64_t> &counter,
+                        std::uint64_t value) noexcept {
+    counter.store(counter.load(std::memory_order_relaxed) + value,
+                  std::memory_order_relaxed);
+  }
+
+  static void load(const counters &op_counters,
+                   tsl::sh::probe_stats::operation_stats &op_stats) noexcept {
+    op_stats.nb_operations =
+        op_counters.nb_operations.load(std::memory_order_relaxed);
+    op_stats.nb_probes = op_counters.nb_probes.load(std::memory_order_relaxed);
+    for (std::size_t i = 0; i < tsl::sh::probe_stats::HISTOGRAM_SIZE; i++) {
+      op_stats.histogram[i] =
+          op_counters.histogram[i].load(std::memory_order_relaxed);
+    }
+  }
+
+  counters m_counters[3];
+  std::atomic<std::uint64_t> m_nb_tombstones_skipped;
+  std::atomic<std::uint64_t> m_nb_key_comparisons;
+};
+#endif
+
+/**
+ * Block of memory from which the storage of the values of multiple
+ * sparse_arrays is carved, see `sparse_array::arena_values()`. The memory is
+ * only deallocated as a whole, on destruction of the arena, the values must
+ * have been destroyed beforehand.
+ */
+template <typename Allocator>
+class values_arena {
+ public:
+  using value_type = typename Allocator::value_type;
+
+  values_arena(const Allocator &alloc, std::size_t capacity)
+      : m_alloc(alloc), m_values(nullptr), m_capacity(capacity), m_size(0) {
+    if (m_capacity > 0) {
+      m_values = m_alloc.allocate(m_capacity);
+    }
+  }
+
+  values_arena(const values_arena &) = delete;
+  values_arena &operator=(const values_arena &) = delete;
+
+  ~values_arena() {
+    if (m_values != nullptr) {
+      m_alloc.deallocate(m_values, m_capacity);
+    }
+  }
+
+  /**
+   * Return an uninitialized storage for `nb_values` values, or nullptr if the
+   * arena doesn't have enough space left.
+   */
+  value_type *allocate(std::size_t nb_values) noexcept {
+    if (nb_values > m_capacity - m_size) {
+      return nullptr;
+    }
+
+    value_type *values = m_values + m_size;
+    m_size += nb_values;
+
+    return values;
+  }
+
+ private:
+  Allocator m_alloc;
+  value_type *m_values;
+  std::size_t m_capacity;
+  std::size_t m_size;
+};
+
 /**
  * WARNING: the sparse_array class doesn't free the ressources allocated through
  * the allocator passed in parameter in each method. You have to manually call
@@ -372,6 +953,11 @@ class sparse_array {
                bucket_count)));
   }
 
+  /**
+   * Number of buckets held by a sparse_array.
+   */
+  static std::size_t nb_buckets() noexcept { return BITMAP_NB_BITS; }
+
  public:
   sparse_array() noexcept
       : m_values(nullptr),
@@ -379,7 +965,9 @@ class sparse_array {
         m_bitmap_deleted_vals(0),
         m_nb_elements(0),
         m_capacity(0),
-        m_last_array(false) {}
+        m_last_array(false),
+        m_dirty(true),
+        m_arena_values(false) {}
 
   explicit sparse_array(bool last_bucket) noexcept
       : m_values(nullptr),
@@ -387,7 +975,9 @@ class sparse_array {
         m_bitmap_deleted_vals(0),
         m_nb_elements(0),
         m_capacity(0),
-        m_last_array(last_bucket) {}
+        m_last_array(last_bucket),
+        m_dirty(true),
+        m_arena_values(false) {}
 
   sparse_array(size_type capacity, Allocator &alloc)
       : m_values(nullptr),
@@ -395,7 +985,9 @@ class sparse_array {
         m_bitmap_deleted_vals(0),
         m_nb_elements(0),
         m_capacity(capacity),
-        m_last_array(false) {
+        m_last_array(false),
+        m_dirty(true),
+        m_arena_values(false) {
     if (m_capacity > 0) {
       m_values = alloc.allocate(m_capacity);
       tsl_sh_assert(m_values !=
@@ -409,7 +1001,9 @@ class sparse_array {
         m_bitmap_deleted_vals(other.m_bitmap_deleted_vals),
         m_nb_elements(0),
         m_capacity(other.m_capacity),
-        m_last_array(other.m_last_array) {
+        m_last_array(other.m_last_array),
+        m_dirty(other.m_dirty),
+        m_arena_values(false) {
     tsl_sh_assert(other.m_capacity >= other.m_nb_elements);
     if (m_capacity == 0) {
       return;
@@ -436,12 +1030,15 @@ class sparse_array {
         m_bitmap_deleted_vals(other.m_bitmap_deleted_vals),
         m_nb_elements(other.m_nb_elements),
         m_capacity(other.m_capacity),
-        m_last_array(other.m_last_array) {
+        m_last_array(other.m_last_array),
+        m_dirty(other.m_dirty),
+        m_arena_values(other.m_arena_values) {
     other.m_values = nullptr;
     other.m_bitmap_vals = 0;
     other.m_bitmap_deleted_vals = 0;
     other.m_nb_elements = 0;
     other.m_capacity = 0;
+    other.m_arena_values = false;
   }
 
   sparse_array(sparse_array &&other, Allocator &alloc)
@@ -450,7 +1047,9 @@ class sparse_array {
         m_bitmap_deleted_vals(other.m_bitmap_deleted_vals),
         m_nb_elements(0),
         m_capacity(other.m_capacity),
-        m_last_array(other.m_last_array) {
+        m_last_array(other.m_last_array),
+        m_dirty(other.m_dirty),
+        m_arena_values(false) {
     tsl_sh_assert(other.m_capacity >= other.m_nb_elements);
     if (m_capacity == 0) {
       return;
@@ -491,20 +1090,71 @@ class sparse_array {
 
   size_type size() const noexcept { return m_nb_elements; }
 
-  void clear(allocator_type &alloc) noexcept {
-    destroy_and_deallocate_values(alloc, m_values, m_nb_elements, m_capacity);
+  size_type capacity() const noexcept { return m_capacity; }
 
-    m_values = nullptr;
-    m_bitmap_vals = 0;
-    m_bitmap_deleted_vals = 0;
-    m_nb_elements = 0;
-    m_capacity = 0;
+  size_type nb_deleted_buckets() const noexcept {
+    return popcount(m_bitmap_deleted_vals);
   }
 
-  bool last() const noexcept { return m_last_array; }
+  void clear(allocator_type &alloc) noexcept {
+    destroy_and_deallocate_values(alloc);
+    release();
+  }
+
+  /**
+   * Return a sparse_array which points to the same values as this one without
+   * copying them. Used when the values are shared between multiple hash tables,
+   * only one of the sparse_array sharing the values must call `clear` on them,
+   * the others must call `release`.
+   */
+  sparse_array shallow_copy() const noexcept {
+    sparse_array sarray(m_last_array);
+    sarray.m_values = m_values;
+    sarray.m_bitmap_vals = m_bitmap_vals;
+    sarray.m_bitmap_deleted_vals = m_bitmap_deleted_vals;
+    sarray.m_nb_elements = m_nb_elements;
+    sarray.m_capacity = m_capacity;
+    sarray.m_dirty = m_dirty;
+    sarray.m_arena_values = m_arena_values;
+
+    return sarray;
+  }
+
+  /**
+   * Forget the values without destroying nor deallocating them.
+   */
+  void release() noexcept {
+    m_values = nullptr;
+    m_bitmap_vals = 0;
+    m_bitmap_deleted_vals = 0;
+    m_nb_elements = 0;
+    m_capacity = 0;
+    m_dirty = true;
+    m_arena_values = false;
+  }
+
+  bool last() const noexcept { return m_last_array; }
 
   void set_as_last() noexcept { m_last_array = true; }
 
+  /**
+   * True if the sparse_array may have been modified since the last call to
+   * `set_dirty(false)`. A new sparse_array is dirty, and any modification of
+   * its bitmaps through the sparse_array methods marks it as dirty. The
+   * modifications of the values through an iterator must be reported with
+   * `set_dirty(true)` by the caller.
+   */
+  bool dirty() const noexcept { return m_dirty; }
+
+  void set_dirty(bool dirty) noexcept { m_dirty = dirty; }
+
+  /**
+   * True if the storage of the values is a part of a `values_arena` and must
+   * not be deallocated. The first reallocation of the values moves them out of
+   * the arena.
+   */
+  bool arena_values() const noexcept { return m_arena_values; }
+
   bool has_value(size_type index) const noexcept {
     tsl_sh_assert(index < BITMAP_NB_BITS);
     return (m_bitmap_vals & (bitmap_type(1) << index)) != 0;
@@ -540,6 +1190,7 @@ class sparse_array {
         (m_bitmap_deleted_vals & ~(bitmap_type(1) << index));
 
     m_nb_elements++;
+    m_dirty = true;
 
     tsl_sh_assert(has_value(index));
     tsl_sh_assert(!has_deleted_value(index));
@@ -566,6 +1217,7 @@ class sparse_array {
     m_bitmap_deleted_vals = (m_bitmap_deleted_vals | (bitmap_type(1) << index));
 
     m_nb_elements--;
+    m_dirty = true;
 
     tsl_sh_assert(!has_value(index));
     tsl_sh_assert(has_deleted_value(index));
@@ -573,6 +1225,81 @@ class sparse_array {
     return m_values + offset;
   }
 
+  /**
+   * Set the values at the `nb_new_values` indexes of `indexes`, which must be
+   * in increasing order and without value, with a single allocation. The
+   * value at `indexes[i]` is constructed from `*new_values[i]`, moved if
+   * `move_values` is true, copied otherwise.
+   *
+   * If an exception is thrown, the sparse_array is left untouched.
+   */
+  void set_multiple(allocator_type &alloc, const size_type *indexes,
+                    value_type *const *new_values, size_type nb_new_values,
+                    bool move_values) {
+    if (nb_new_values == 0) {
+      return;
+    }
+
+    bitmap_type new_bitmap_vals = m_bitmap_vals;
+    for (size_type i = 0; i < nb_new_values; i++) {
+      tsl_sh_assert(!has_value(indexes[i]));
+      tsl_sh_assert(i == 0 || indexes[i - 1] < indexes[i]);
+      new_bitmap_vals |= bitmap_type(1) << indexes[i];
+    }
+
+    auto new_offset = [&](size_type index) {
+      return popcount(new_bitmap_vals &
+                      ((bitmap_type(1) << index) - bitmap_type(1)));
+    };
+
+    const size_type new_capacity =
+        static_cast<size_type>(m_nb_elements + nb_new_values);
+    value_type *values = alloc.allocate(new_capacity);
+    // Allocate should throw if there is a failure
+    tsl_sh_assert(values != nullptr);
+
+    // Bitmap of the offsets in `values` with a constructed value, to be able to
+    // roll back if a construction throws.
+    bitmap_type constructed_offsets = 0;
+    TSL_SH_TRY {
+      for (size_type i = 0; i < nb_new_values; i++) {
+        const size_type offset = new_offset(indexes[i]);
+        construct_value_from(alloc, values + offset, *new_values[i],
+                             move_values);
+        constructed_offsets |= bitmap_type(1) << offset;
+      }
+
+      size_type old_offset = 0;
+      for (size_type index = 0; index < BITMAP_NB_BITS; index++) {
+        if (has_value(index)) {
+          const size_type offset = new_offset(index);
+          construct_value(alloc, values + offset,
+                          std::move_if_noexcept(m_values[old_offset]));
+          constructed_offsets |= bitmap_type(1) << offset;
+          old_offset++;
+        }
+      }
+    }
+    TSL_SH_CATCH(...) {
+      for (size_type offset = 0; offset < new_capacity; offset++) {
+        if ((constructed_offsets & (bitmap_type(1) << offset)) != 0) {
+          destroy_value(alloc, values + offset);
+        }
+      }
+      alloc.deallocate(values, new_capacity);
+      TSL_SH_RETRHOW;
+    }
+
+    destroy_and_deallocate_values(alloc);
+
+    m_values = values;
+    m_capacity = new_capacity;
+    m_nb_elements = new_capacity;
+    m_bitmap_deleted_vals = (m_bitmap_deleted_vals & ~new_bitmap_vals);
+    m_bitmap_vals = new_bitmap_vals;
+    m_dirty = true;
+  }
+
   void swap(sparse_array &other) {
     using std::swap;
 
@@ -582,58 +1309,70 @@ class sparse_array {
     swap(m_nb_elements, other.m_nb_elements);
     swap(m_capacity, other.m_capacity);
     swap(m_last_array, other.m_last_array);
+    swap(m_dirty, other.m_dirty);
+    swap(m_arena_values, other.m_arena_values);
   }
 
   static iterator mutable_iterator(const_iterator pos) {
     return const_cast<iterator>(pos);
   }
 
-  template <class Serializer>
-  void serialize(Serializer &serializer) const {
-    const slz_size_type sparse_bucket_size = m_nb_elements;
-    serializer(sparse_bucket_size);
-
-    const slz_size_type bitmap_vals = m_bitmap_vals;
-    serializer(bitmap_vals);
+  /**
+   * True if no bucket of the sparse_array has a value or is marked as
+   * deleted. Such a sparse_array doesn't need to be serialized, it's the same
+   * as a default constructed one.
+   */
+  bool unused() const noexcept {
+    return m_bitmap_vals == 0 && m_bitmap_deleted_vals == 0;
+  }
 
-    const slz_size_type bitmap_deleted_vals = m_bitmap_deleted_vals;
-    serializer(bitmap_deleted_vals);
+  /**
+   * Serialize the bitmaps of the sparse_array followed by its values. The
+   * number of values is not serialized, it's the popcount of the bitmap of
+   * values.
+   *
+   * The bitmaps are serialized as varints if `varint` is true, and the values
+   * as one raw block of bytes through `serializer.write_bytes` if
+   * `raw_values` is true.
+   */
+  template <class Serializer, class Varint>
+  void serialize_compact(Serializer &serializer, Varint varint,
+                         std::false_type /*raw_values*/) const {
+    serialize_size(serializer, m_bitmap_vals, varint);
+    serialize_size(serializer, m_bitmap_deleted_vals, varint);
 
     for (const value_type &value : *this) {
       serializer(value);
     }
   }
 
-  template <class Deserializer>
-  static sparse_array deserialize_hash_compatible(Deserializer &deserializer,
-                                                  Allocator &alloc) {
-    const slz_size_type sparse_bucket_size =
-        deserialize_value<slz_size_type>(deserializer);
-    const slz_size_type bitmap_vals =
-        deserialize_value<slz_size_type>(deserializer);
-    const slz_size_type bitmap_deleted_vals =
-        deserialize_value<slz_size_type>(deserializer);
-
-    if (sparse_bucket_size > BITMAP_NB_BITS) {
-      TSL_SH_THROW_OR_ABORT(
-          std::runtime_error,
-          "Deserialized sparse_bucket_size is too big for the platform. "
-          "Maximum should be BITMAP_NB_BITS.");
-    }
+  template <class Serializer, class Varint>
+  void serialize_compact(Serializer &serializer, Varint varint,
+                         std::true_type /*raw_values*/) const {
+    serialize_size(serializer, m_bitmap_vals, varint);
+    serialize_size(serializer, m_bitmap_deleted_vals, varint);
 
-    sparse_array sarray;
-    if (sparse_bucket_size == 0) {
-      return sarray;
+    if (m_nb_elements > 0) {
+      serializer.write_bytes(m_values, m_nb_elements * sizeof(value_type));
     }
+  }
 
-    sarray.m_bitmap_vals = numeric_cast<bitmap_type>(
-        bitmap_vals, "Deserialized bitmap_vals is too big.");
-    sarray.m_bitmap_deleted_vals = numeric_cast<bitmap_type>(
-        bitmap_deleted_vals, "Deserialized bitmap_deleted_vals is too big.");
-
-    sarray.m_capacity = numeric_cast<size_type>(
-        sparse_bucket_size, "Deserialized sparse_bucket_size is too big.");
-    sarray.m_values = alloc.allocate(sarray.m_capacity);
+  /**
+   * Create a sparse_array with the deserialized bitmaps and deserialize its
+   * popcount(bitmap_vals) values, one by one if `raw_values` is false or as
+   * one raw block of bytes through `deserializer.read_bytes` otherwise.
+   */
+  template <class Deserializer>
+  static sparse_array deserialize_values(Deserializer &deserializer,
+                                         Allocator &alloc,
+                                         slz_size_type bitmap_vals,
+                                         slz_size_type bitmap_deleted_vals,
+                                         std::false_type /*raw_values*/,
+                                         values_arena<Allocator> *arena =
+                                             nullptr) {
+    sparse_array sarray =
+        from_deserialized_bitmaps(alloc, bitmap_vals, bitmap_deleted_vals,
+                                  arena);
 
     TSL_SH_TRY {
       for (size_type ivalue = 0; ivalue < sarray.m_capacity; ivalue++) {
@@ -650,6 +1389,68 @@ class sparse_array {
     return sarray;
   }
 
+  template <class Deserializer>
+  static sparse_array deserialize_values(Deserializer &deserializer,
+                                         Allocator &alloc,
+                                         slz_size_type bitmap_vals,
+                                         slz_size_type bitmap_deleted_vals,
+                                         std::true_type /*raw_values*/,
+                                         values_arena<Allocator> *arena =
+                                             nullptr) {
+    static_assert(is_raw_serializable<value_type>::value,
+                  "value_type must be raw serializable.");
+
+    sparse_array sarray =
+        from_deserialized_bitmaps(alloc, bitmap_vals, bitmap_deleted_vals,
+                                  arena);
+    if (sarray.m_capacity == 0) {
+      return sarray;
+    }
+
+    TSL_SH_TRY {
+      deserializer.read_bytes(static_cast<void *>(sarray.m_values),
+                              sarray.m_capacity * sizeof(value_type));
+    }
+    TSL_SH_CATCH(...) {
+      sarray.clear(alloc);
+      TSL_SH_RETRHOW;
+    }
+    sarray.m_nb_elements = sarray.m_capacity;
+
+    return sarray;
+  }
+
+  /**
+   * Deserialize a sparse_array serialized by the version 2 of the protocol
+   * with raw values: a raw block with the size and the bitmaps followed by a
+   * raw block with the values.
+   */
+  template <class Deserializer>
+  static sparse_array deserialize_raw(Deserializer &deserializer,
+                                      Allocator &alloc) {
+    slz_size_type header[3];
+    deserializer.read_bytes(header, sizeof(header));
+
+    check_deserialized_size(header[0], header[1]);
+    return deserialize_values(deserializer, alloc, header[1], header[2],
+                              std::true_type());
+  }
+
+  template <class Deserializer>
+  static sparse_array deserialize_hash_compatible(Deserializer &deserializer,
+                                                  Allocator &alloc) {
+    const slz_size_type sparse_bucket_size =
+        deserialize_value<slz_size_type>(deserializer);
+    const slz_size_type bitmap_vals =
+        deserialize_value<slz_size_type>(deserializer);
+    const slz_size_type bitmap_deleted_vals =
+        deserialize_value<slz_size_type>(deserializer);
+
+    check_deserialized_size(sparse_bucket_size, bitmap_vals);
+    return deserialize_values(deserializer, alloc, bitmap_vals,
+                              bitmap_deleted_vals, std::false_type());
+  }
+
   /**
    * Deserialize the values of the bucket and insert them all in sparse_hash
    * through sparse_hash.insert(...).
@@ -681,6 +1482,28 @@ class sparse_array {
         alloc, value, std::forward<Args>(value_args)...);
   }
 
+  template <class U = value_type,
+            typename std::enable_if<
+                std::is_copy_constructible<U>::value>::type * = nullptr>
+  static void construct_value_from(allocator_type &alloc, value_type *value,
+                                   value_type &source, bool move_source) {
+    if (move_source) {
+      construct_value(alloc, value, std::move(source));
+    } else {
+      construct_value(alloc, value, source);
+    }
+  }
+
+  template <class U = value_type,
+            typename std::enable_if<
+                !std::is_copy_constructible<U>::value>::type * = nullptr>
+  static void construct_value_from(allocator_type &alloc, value_type *value,
+                                   value_type &source, bool move_source) {
+    tsl_sh_assert(move_source);
+    (void)move_source;
+    construct_value(alloc, value, std::move(source));
+  }
+
   static void destroy_value(allocator_type &alloc, value_type *value) noexcept {
     std::allocator_traits<allocator_type>::destroy(alloc, value);
   }
@@ -695,6 +1518,81 @@ class sparse_array {
     alloc.deallocate(values, capacity_values);
   }
 
+  /**
+   * Destroy the values of the sparse_array and deallocate their storage,
+   * unless it's a part of an arena.
+   */
+  void destroy_and_deallocate_values(allocator_type &alloc) noexcept {
+    if (m_arena_values) {
+      for (size_type i = 0; i < m_nb_elements; i++) {
+        destroy_value(alloc, m_values + i);
+      }
+      m_arena_values = false;
+    } else {
+      destroy_and_deallocate_values(alloc, m_values, m_nb_elements,
+                                    m_capacity);
+    }
+  }
+
+  static void check_deserialized_size(slz_size_type sparse_bucket_size,
+                                      slz_size_type bitmap_vals) {
+    if (sparse_bucket_size > BITMAP_NB_BITS) {
+      TSL_SH_THROW_OR_ABORT(
+          std::runtime_error,
+          "Deserialized sparse_bucket_size is too big for the platform. "
+          "Maximum should be BITMAP_NB_BITS.");
+    }
+
+    if (sparse_bucket_size !=
+        popcount(numeric_cast<bitmap_type>(
+            bitmap_vals, "Deserialized bitmap_vals is too big."))) {
+      TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                            "Deserialized sparse_bucket_size doesn't match "
+                            "bitmap_vals.");
+    }
+  }
+
+  /**
+   * Create a sparse_array with the deserialized bitmaps and an allocated, but
+   * not constructed, storage for its values.
+   *
+   * The deleted buckets of a sparse_array without values are kept, they may
+   * be part of the probing sequence of values in other sparse_arrays.
+   *
+   * If `arena` is not nullptr, the storage is carved from it.
+   */
+  static sparse_array from_deserialized_bitmaps(
+      Allocator &alloc, slz_size_type bitmap_vals,
+      slz_size_type bitmap_deleted_vals, values_arena<Allocator> *arena) {
+    sparse_array sarray;
+    sarray.m_bitmap_vals = numeric_cast<bitmap_type>(
+        bitmap_vals, "Deserialized bitmap_vals is too big.");
+    sarray.m_bitmap_deleted_vals = numeric_cast<bitmap_type>(
+        bitmap_deleted_vals, "Deserialized bitmap_deleted_vals is too big.");
+    if ((sarray.m_bitmap_vals & sarray.m_bitmap_deleted_vals) != 0) {
+      TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                            "Deserialized bitmap_vals and bitmap_deleted_vals "
+                            "overlap.");
+    }
+
+    const size_type nb_values = popcount(sarray.m_bitmap_vals);
+    if (nb_values > 0 && arena != nullptr) {
+      sarray.m_values = arena->allocate(nb_values);
+      if (sarray.m_values == nullptr) {
+        TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                              "The deserialized sparse buckets have more "
+                              "values than nb_elements.");
+      }
+      sarray.m_capacity = nb_values;
+      sarray.m_arena_values = true;
+    } else if (nb_values > 0) {
+      sarray.m_values = alloc.allocate(nb_values);
+      sarray.m_capacity = nb_values;
+    }
+
+    return sarray;
+  }
+
   static size_type popcount(bitmap_type val) noexcept {
     if (sizeof(bitmap_type) <= sizeof(unsigned int)) {
       return static_cast<size_type>(
@@ -833,7 +1731,7 @@ class sparse_array {
       construct_value(alloc, new_values + i + 1, std::move(m_values[i]));
     }
 
-    destroy_and_deallocate_values(alloc, m_values, m_nb_elements, m_capacity);
+    destroy_and_deallocate_values(alloc);
 
     m_values = new_values;
     m_capacity = new_capacity;
@@ -874,7 +1772,7 @@ class sparse_array {
 
     tsl_sh_assert(nb_new_values == m_nb_elements + 1);
 
-    destroy_and_deallocate_values(alloc, m_values, m_nb_elements, m_capacity);
+    destroy_and_deallocate_values(alloc);
 
     m_values = new_values;
     m_capacity = new_capacity;
@@ -943,7 +1841,7 @@ class sparse_array {
 
     tsl_sh_assert(nb_new_values == m_nb_elements - 1);
 
-    destroy_and_deallocate_values(alloc, m_values, m_nb_elements, m_capacity);
+    destroy_and_deallocate_values(alloc);
 
     m_values = new_values;
     m_capacity = new_capacity;
@@ -958,6 +1856,8 @@ class sparse_array {
   size_type m_nb_elements;
   size_type m_capacity;
   bool m_last_array;
+  bool m_dirty;
+  bool m_arena_values;
 };
 
 /**
@@ -1036,6 +1936,21 @@ class sparse_hash : private Allocator,
   using sparse_buckets_container =
       std::vector<sparse_array, sparse_buckets_allocator>;
 
+  /**
+   * Reference count of the values of a sparse_array shared between multiple
+   * hash tables through structural sharing.
+   */
+  using sparse_bucket_refcount = std::atomic<std::size_t>;
+  using sparse_bucket_refcount_allocator = typename std::allocator_traits<
+      allocator_type>::template rebind_alloc<sparse_bucket_refcount>;
+  using sparse_bucket_refcounts_allocator = typename std::allocator_traits<
+      allocator_type>::template rebind_alloc<sparse_bucket_refcount *>;
+  using sparse_bucket_refcounts_container =
+      std::vector<sparse_bucket_refcount *, sparse_bucket_refcounts_allocator>;
+
+  using values_arena_allocator = typename std::allocator_traits<
+      allocator_type>::template rebind_alloc<values_arena<Allocator>>;
+
  public:
   /**
    * The `operator*()` and `operator->()` methods return a const reference and
@@ -1155,6 +2070,125 @@ class sparse_hash : private Allocator,
     sparse_array_iterator m_sparse_array_it;
   };
 
+  /**
+   * Owns a value extracted from a hash table with `extract` until it's
+   * inserted back in a hash table with `insert(node_handle&&)`. The hash of
+   * the key is kept alongside the value so that the insertion doesn't have to
+   * compute it again.
+   *
+   * The key can't be modified as it would invalidate the stored hash.
+   */
+  class node_handle {
+    friend class sparse_hash;
+
+   public:
+    node_handle() noexcept : m_hash(0), m_has_value(false) {}
+
+    node_handle(node_handle &&other) noexcept(
+        std::is_nothrow_move_constructible<value_type>::value)
+        : node_handle() {
+      take(other);
+    }
+
+    node_handle &operator=(node_handle &&other) noexcept(
+        std::is_nothrow_move_constructible<value_type>::value) {
+      if (&other != this) {
+        reset();
+        take(other);
+      }
+
+      return *this;
+    }
+
+    node_handle(const node_handle &) = delete;
+    node_handle &operator=(const node_handle &) = delete;
+
+    ~node_handle() { reset(); }
+
+    bool empty() const noexcept { return !m_has_value; }
+
+    explicit operator bool() const noexcept { return m_has_value; }
+
+    const typename sparse_hash::key_type &key() const {
+      tsl_sh_assert(m_has_value);
+      return KeySelect()(get());
+    }
+
+    template <class U = ValueSelect,
+              typename std::enable_if<has_mapped_type<U>::value>::type * =
+                  nullptr>
+    typename U::value_type &mapped() {
+      tsl_sh_assert(m_has_value);
+      return U()(get());
+    }
+
+    template <class U = ValueSelect,
+              typename std::enable_if<has_mapped_type<U>::value>::type * =
+                  nullptr>
+    const typename U::value_type &mapped() const {
+      tsl_sh_assert(m_has_value);
+      return U()(get());
+    }
+
+    /**
+     * Hash of the key, as computed by the hash table the value was extracted
+     * from.
+     */
+    std::size_t hash() const noexcept {
+      tsl_sh_assert(m_has_value);
+      return m_hash;
+    }
+
+   private:
+    struct construct_tag {};
+
+    template <class... Args>
+    node_handle(construct_tag, std::size_t hash, Args &&...value_args)
+        : node_handle() {
+      ::new (static_cast<void *>(m_storage))
+          value_type(std::forward<Args>(value_args)...);
+      m_hash = hash;
+      m_has_value = true;
+    }
+
+    value_type &get() noexcept {
+      return *reinterpret_cast<value_type *>(m_storage);
+    }
+
+    const value_type &get() const noexcept {
+      return *reinterpret_cast<const value_type *>(m_storage);
+    }
+
+    void take(node_handle &other) {
+      if (other.m_has_value) {
+        ::new (static_cast<void *>(m_storage))
+            value_type(std::move(other.get()));
+        m_hash = other.m_hash;
+        m_has_value = true;
+
+        other.reset();
+      }
+    }
+
+    void reset() noexcept {
+      if (m_has_value) {
+        get().~value_type();
+        m_has_value = false;
+      }
+    }
+
+   private:
+    alignas(value_type) unsigned char m_storage[sizeof(value_type)];
+    std::size_t m_hash;
+    bool m_has_value;
+  };
+
+  struct insert_return_type {
+    iterator position;
+    bool inserted;
+    node_handle node;
+  };
+
  public:
   sparse_hash(size_type bucket_count, const Hash &hash, const KeyEqual &equal,
               const Allocator &alloc, float max_load_factor)
@@ -1164,9 +2198,16 @@ class sparse_hash : private Allocator,
         GrowthPolicy(bucket_count),
         m_sparse_buckets_data(alloc),
         m_sparse_buckets(static_empty_sparse_bucket_ptr()),
+        m_sparse_buckets_refcounts(alloc),
         m_bucket_count(bucket_count),
         m_nb_elements(0),
-        m_nb_deleted_buckets(0) {
+        m_nb_deleted_buckets(0),
+        m_structural_sharing(false),
+        m_dirty_tracking(false),
+        m_hash_seed(0),
+        m_hash_quality_nb_insertions(0),
+        m_hash_quality_nb_samples(0),
+        m_hash_quality_nb_probes(0) {
     if (m_bucket_count > max_bucket_count()) {
       TSL_SH_THROW_OR_ABORT(std::length_error,
                             "The map exceeds its maximum size.");
@@ -1211,16 +2252,27 @@ class sparse_hash : private Allocator,
         m_sparse_buckets_data(
             std::allocator_traits<
                 Allocator>::select_on_container_copy_construction(other)),
+        m_sparse_buckets_refcounts(
+            std::allocator_traits<
+                Allocator>::select_on_container_copy_construction(other)),
         m_bucket_count(other.m_bucket_count),
         m_nb_elements(other.m_nb_elements),
         m_nb_deleted_buckets(other.m_nb_deleted_buckets),
         m_load_threshold_rehash(other.m_load_threshold_rehash),
         m_load_threshold_clear_deleted(other.m_load_threshold_clear_deleted),
-        m_max_load_factor(other.m_max_load_factor) {
-    copy_buckets_from(other),
-        m_sparse_buckets = m_sparse_buckets_data.empty()
-                               ? static_empty_sparse_bucket_ptr()
-                               : m_sparse_buckets_data.data();
+        m_max_load_factor(other.m_max_load_factor),
+        m_structural_sharing(other.m_structural_sharing),
+        m_dirty_tracking(other.m_dirty_tracking),
+        m_rehash_observer(other.m_rehash_observer),
+        m_hash_quality(other.m_hash_quality),
+        m_hash_seed(other.m_hash_seed),
+        m_hash_quality_nb_insertions(0),
+        m_hash_quality_nb_samples(0),
+        m_hash_quality_nb_probes(0) {
+    copy_or_share_buckets_from(other);
+    m_sparse_buckets = m_sparse_buckets_data.empty()
+                           ? static_empty_sparse_bucket_ptr()
+                           : m_sparse_buckets_data.data();
   }
 
   sparse_hash(sparse_hash &&other) noexcept(
@@ -1238,14 +2290,25 @@ class sparse_hash : private Allocator,
         m_sparse_buckets(m_sparse_buckets_data.empty()
                              ? static_empty_sparse_bucket_ptr()
                              : m_sparse_buckets_data.data()),
+        m_sparse_buckets_refcounts(std::move(other.m_sparse_buckets_refcounts)),
+        m_values_arena(std::move(other.m_values_arena)),
         m_bucket_count(other.m_bucket_count),
         m_nb_elements(other.m_nb_elements),
         m_nb_deleted_buckets(other.m_nb_deleted_buckets),
         m_load_threshold_rehash(other.m_load_threshold_rehash),
         m_load_threshold_clear_deleted(other.m_load_threshold_clear_deleted),
-        m_max_load_factor(other.m_max_load_factor) {
+        m_max_load_factor(other.m_max_load_factor),
+        m_structural_sharing(other.m_structural_sharing),
+        m_dirty_tracking(other.m_dirty_tracking),
+        m_rehash_observer(std::move(other.m_rehash_observer)),
+        m_hash_quality(std::move(other.m_hash_quality)),
+        m_hash_seed(other.m_hash_seed),
+        m_hash_quality_nb_insertions(0),
+        m_hash_quality_nb_samples(0),
+        m_hash_quality_nb_probes(0) {
     other.GrowthPolicy::clear();
     other.m_sparse_buckets_data.clear();
+    other.m_sparse_buckets_refcounts.clear();
     other.m_sparse_buckets = static_empty_sparse_bucket_ptr();
     other.m_bucket_count = 0;
     other.m_nb_elements = 0;
@@ -1281,7 +2344,15 @@ class sparse_hash : private Allocator,
         }
       }
 
-      copy_buckets_from(other);
+      m_sparse_buckets_refcounts.clear();
+      m_structural_sharing = other.m_structural_sharing;
+      m_dirty_tracking = other.m_dirty_tracking;
+      m_rehash_observer = other.m_rehash_observer;
+      m_hash_quality = other.m_hash_quality;
+      m_hash_seed = other.m_hash_seed;
+      reset_hash_quality_window();
+
+      copy_or_share_buckets_from(other);
       m_sparse_buckets = m_sparse_buckets_data.empty()
                              ? static_empty_sparse_bucket_ptr()
                              : m_sparse_buckets_data.data();
@@ -1300,18 +2371,31 @@ class sparse_hash : private Allocator,
   sparse_hash &operator=(sparse_hash &&other) {
     clear();
 
+    m_sparse_buckets_refcounts.clear();
+    m_structural_sharing = other.m_structural_sharing;
+    m_dirty_tracking = other.m_dirty_tracking;
+    m_rehash_observer = std::move(other.m_rehash_observer);
+    m_hash_quality = std::move(other.m_hash_quality);
+    m_hash_seed = other.m_hash_seed;
+    reset_hash_quality_window();
+
     if (std::allocator_traits<
             Allocator>::propagate_on_container_move_assignment::value) {
       static_cast<Allocator &>(*this) =
           std::move(static_cast<Allocator &>(other));
       m_sparse_buckets_data = std::move(other.m_sparse_buckets_data);
+      m_sparse_buckets_refcounts = std::move(other.m_sparse_buckets_refcounts);
+      m_values_arena = std::move(other.m_values_arena);
     } else if (static_cast<Allocator &>(*this) !=
                static_cast<Allocator &>(other)) {
       move_buckets_from(std::move(other));
+      other.clear();
     } else {
       static_cast<Allocator &>(*this) =
           std::move(static_cast<Allocator &>(other));
       m_sparse_buckets_data = std::move(other.m_sparse_buckets_data);
+      m_sparse_buckets_refcounts = std::move(other.m_sparse_buckets_refcounts);
+      m_values_arena = std::move(other.m_values_arena);
     }
 
     m_sparse_buckets = m_sparse_buckets_data.empty()
@@ -1331,6 +2415,7 @@ class sparse_hash : private Allocator,
 
     other.GrowthPolicy::clear();
     other.m_sparse_buckets_data.clear();
+    other.m_sparse_buckets_refcounts.clear();
     other.m_sparse_buckets = static_empty_sparse_bucket_ptr();
     other.m_bucket_count = 0;
     other.m_nb_elements = 0;
@@ -1348,7 +2433,17 @@ class sparse_hash : private Allocator,
   /*
    * Iterators
    */
-  iterator begin() noexcept {
+  /**
+   * With structural sharing, the values of the map can be modified through the
+   * returned iterator. All the sparse buckets are thus unshared beforehand,
+   * which may throw.
+   */
+  iterator begin() {
+    if (has_mapped_type<ValueSelect>::value) {
+      unshare_all_sparse_buckets();
+      mark_all_sparse_buckets_dirty();
+    }
+
     auto begin = m_sparse_buckets_data.begin();
     while (begin != m_sparse_buckets_data.end() && begin->empty()) {
       ++begin;
@@ -1398,9 +2493,11 @@ class sparse_hash : private Allocator,
    * Modifiers
    */
   void clear() noexcept {
-    for (auto &bucket : m_sparse_buckets_data) {
-      bucket.clear(*this);
+    for (std::size_t ibucket = 0; ibucket < m_sparse_buckets_data.size();
+         ibucket++) {
+      release_sparse_bucket(ibucket);
     }
+    m_values_arena.reset();
 
     m_nb_elements = 0;
     m_nb_deleted_buckets = 0;
@@ -1408,7 +2505,9 @@ class sparse_hash : private Allocator,
 
   template <typename P>
   std::pair<iterator, bool> insert(P &&value) {
-    return insert_impl(KeySelect()(value), std::forward<P>(value));
+    // If P is not value_type (e.g. std::pair<const Key, T>), KeySelect returns
+    // the key of a temporary value_type which must outlive the insertion.
+    return insert_with_key(KeySelect()(value), std::forward<P>(value));
   }
 
   template <typename P>
@@ -1475,11 +2574,27 @@ class sparse_hash : private Allocator,
 
   template <class K, class... Args>
   std::pair<iterator, bool> try_emplace(K &&key, Args &&...args) {
-    return insert_impl(key, std::piecewise_construct,
+    return insert_impl(key, hash_key(key), std::piecewise_construct,
                        std::forward_as_tuple(std::forward<K>(key)),
                        std::forward_as_tuple(std::forward<Args>(args)...));
   }
 
+  template <class K, class Factory>
+  std::pair<iterator, bool> try_emplace_lazy(K &&key, Factory &&factory) {
+    return try_emplace(std::forward<K>(key), lazy_value<Factory>(factory));
+  }
+
+  template <class K, class OnInsert, class OnUpdate>
+  std::pair<iterator, bool> upsert(K &&key, OnInsert &&on_insert,
+                                   OnUpdate &&on_update) {
+    auto it = try_emplace_lazy(std::forward<K>(key), on_insert);
+    if (!it.second) {
+      on_update(it.first.value());
+    }
+
+    return it;
+  }
+
   template <class K, class... Args>
   iterator try_emplace_hint(const_iterator hint, K &&key, Args &&...args) {
     if (hint != cend() && compare_keys(KeySelect()(*hint), key)) {
@@ -1495,6 +2610,8 @@ class sparse_hash : private Allocator,
    */
   iterator erase(iterator pos) {
     tsl_sh_assert(pos != end() && m_nb_elements > 0);
+    pos = unshare_sparse_bucket(pos);
+
     auto it_sparse_array_next =
         pos.m_sparse_buckets_it->erase(*this, pos.m_sparse_array_it);
     m_nb_elements--;
@@ -1546,28 +2663,92 @@ class sparse_hash : private Allocator,
     return erase_impl(key, hash);
   }
 
-  void swap(sparse_hash &other) {
-    using std::swap;
+  template <class K>
+  node_handle extract(const K &key) {
+    return extract(key, hash_key(key));
+  }
 
-    if (std::allocator_traits<Allocator>::propagate_on_container_swap::value) {
-      swap(static_cast<Allocator &>(*this), static_cast<Allocator &>(other));
-    } else {
-      tsl_sh_assert(static_cast<Allocator &>(*this) ==
-                    static_cast<Allocator &>(other));
+  template <class K>
+  node_handle extract(const K &key, std::size_t hash) {
+    const auto it = find_impl(key, hash);
+    if (it == end()) {
+      return node_handle();
     }
 
-    swap(static_cast<Hash &>(*this), static_cast<Hash &>(other));
-    swap(static_cast<KeyEqual &>(*this), static_cast<KeyEqual &>(other));
-    swap(static_cast<GrowthPolicy &>(*this),
-         static_cast<GrowthPolicy &>(other));
+    return extract_impl(it, hash);
+  }
+
+  node_handle extract(const_iterator pos) {
+    tsl_sh_assert(pos != cend());
+    return extract_impl(mutable_iterator(pos), hash_key(KeySelect()(*pos)));
+  }
+
+  insert_return_type insert(node_handle &&node) {
+    if (node.empty()) {
+      return insert_return_type{end(), false, node_handle()};
+    }
+
+    auto it = insert_impl(KeySelect()(node.get()), node.m_hash,
+                          std::move(node.get()));
+    if (!it.second) {
+      return insert_return_type{it.first, false, std::move(node)};
+    }
+
+    node.reset();
+    return insert_return_type{it.first, true, node_handle()};
+  }
+
+  void swap(sparse_hash &other) {
+    using std::swap;
+
+    if (std::allocator_traits<Allocator>::propagate_on_container_swap::value) {
+      swap(static_cast<Allocator &>(*this), static_cast<Allocator &>(other));
+    } else {
+      tsl_sh_assert(static_cast<Allocator &>(*this) ==
+                    static_cast<Allocator &>(other));
+    }
+
+    swap(static_cast<Hash &>(*this), static_cast<Hash &>(other));
+    swap(static_cast<KeyEqual &>(*this), static_cast<KeyEqual &>(other));
+    swap(static_cast<GrowthPolicy &>(*this),
+         static_cast<GrowthPolicy &>(other));
     swap(m_sparse_buckets_data, other.m_sparse_buckets_data);
     swap(m_sparse_buckets, other.m_sparse_buckets);
+    swap(m_sparse_buckets_refcounts, other.m_sparse_buckets_refcounts);
+    swap(m_values_arena, other.m_values_arena);
     swap(m_bucket_count, other.m_bucket_count);
     swap(m_nb_elements, other.m_nb_elements);
     swap(m_nb_deleted_buckets, other.m_nb_deleted_buckets);
     swap(m_load_threshold_rehash, other.m_load_threshold_rehash);
     swap(m_load_threshold_clear_deleted, other.m_load_threshold_clear_deleted);
     swap(m_max_load_factor, other.m_max_load_factor);
+    swap(m_structural_sharing, other.m_structural_sharing);
+    swap(m_rehash_observer, other.m_rehash_observer);
+    swap(m_dirty_tracking, other.m_dirty_tracking);
+    swap(m_hash_quality, other.m_hash_quality);
+    swap(m_hash_seed, other.m_hash_seed);
+    swap(m_hash_quality_nb_insertions, other.m_hash_quality_nb_insertions);
+    swap(m_hash_quality_nb_samples, other.m_hash_quality_nb_samples);
+    swap(m_hash_quality_nb_probes, other.m_hash_quality_nb_probes);
+  }
+
+  void merge(sparse_hash &&other) {
+    if (&other == this) {
+      return;
+    }
+
+    merge_impl(other, true);
+    other.clear();
+  }
+
+  void merge(const sparse_hash &other) {
+    static_assert(std::is_copy_constructible<value_type>::value,
+                  "value_type must be copy constructible to merge a copy.");
+    if (&other == this) {
+      return;
+    }
+
+    merge_impl(const_cast<sparse_hash &>(other), false);
   }
 
   /*
@@ -1584,8 +2765,12 @@ class sparse_hash : private Allocator,
       class K, class U = ValueSelect,
       typename std::enable_if<has_mapped_type<U>::value>::type * = nullptr>
   typename U::value_type &at(const K &key, std::size_t hash) {
-    return const_cast<typename U::value_type &>(
-        static_cast<const sparse_hash *>(this)->at(key, hash));
+    auto it = find(key, hash);
+    if (it != end()) {
+      return it.value();
+    } else {
+      TSL_SH_THROW_OR_ABORT(std::out_of_range, "Couldn't find key.");
+    }
   }
 
   template <
@@ -1726,6 +2911,300 @@ class sparse_hash : private Allocator,
     rehash(size_type(std::ceil(float(count) / max_load_factor())));
   }
 
+  /**
+   * Same as reserve(count) but notifies the rehash observer as a growth.
+   */
+  void reserve_automatically(size_type count) {
+    tsl_sh_assert(count >= size());
+    automatic_rehash(size_type(std::ceil(float(count) / max_load_factor())),
+                     tsl::sh::rehash_reason::grow);
+  }
+
+  void parallel_rehash(size_type count, std::size_t nb_threads) {
+    count = std::max(count,
+                     size_type(std::ceil(float(size()) / max_load_factor())));
+    parallel_rehash_impl(count, nb_threads);
+  }
+
+  /**
+   * Insert the values of the random access range [first, last) with
+   * `nb_threads` threads. The sparse buckets are split in `nb_threads`
+   * contiguous partitions and each thread inserts the values that hash in its
+   * partition, as long as their probing doesn't leave the partition. The
+   * values that would leave it are inserted afterwards by the calling thread.
+   *
+   * As for insert(first, last), if multiple values in the range have the same
+   * key, only the first one is inserted.
+   */
+  template <class Function>
+  void for_each_parallel(const Function &function,
+                         std::size_t nb_threads) const {
+    const std::size_t nb_sparse_buckets = m_sparse_buckets_data.size();
+    nb_threads = std::max(std::size_t(1),
+                          std::min(nb_threads, nb_sparse_buckets));
+
+    run_in_parallel(nb_threads, [&](std::size_t ithread) {
+      const auto range = split_range(nb_sparse_buckets, nb_threads, ithread);
+      for (std::size_t ibucket = range.first; ibucket < range.second;
+           ibucket++) {
+        for (const auto &value : m_sparse_buckets_data[ibucket]) {
+          function(value);
+        }
+      }
+    });
+  }
+
+  template <class RandomIt>
+  void parallel_insert(RandomIt first, RandomIt last, std::size_t nb_threads) {
+    static_assert(
+        std::is_base_of<
+            std::random_access_iterator_tag,
+            typename std::iterator_traits<RandomIt>::iterator_category>::value,
+        "parallel_insert requires random access iterators.");
+
+    const std::size_t nb_elements_insert =
+        static_cast<std::size_t>(std::distance(first, last));
+    if (nb_elements_insert == 0) {
+      return;
+    }
+
+    if (m_load_threshold_rehash - size() < nb_elements_insert) {
+      reserve_automatically(size() + size_type(nb_elements_insert));
+    }
+    if (m_nb_deleted_buckets > 0 &&
+        size() + m_nb_deleted_buckets + nb_elements_insert >=
+            m_load_threshold_clear_deleted) {
+      clear_deleted_buckets();
+    }
+
+    const std::size_t nb_sparse_buckets = m_sparse_buckets_data.size();
+    nb_threads = std::min(nb_threads, nb_sparse_buckets);
+    if (nb_threads <= 1) {
+      insert(first, last);
+      return;
+    }
+
+    const std::size_t partition_size =
+        (nb_sparse_buckets + nb_threads - 1) / nb_threads;
+    auto partition_for_hash = [&](std::size_t hash) {
+      return sparse_array::sparse_ibucket(bucket_for_hash(hash)) /
+             partition_size;
+    };
+
+    // Hash the values and count the number of values going to each partition
+    // from the input range of each thread.
+    std::vector<std::size_t> hashes(nb_elements_insert);
+    std::vector<std::size_t> counts(nb_threads * nb_threads, 0);
+    run_in_parallel(nb_threads, [&](std::size_t ithread) {
+      const auto input_range =
+          split_range(nb_elements_insert, nb_threads, ithread);
+      for (std::size_t i = input_range.first; i < input_range.second; i++) {
+        hashes[i] = hash_key(KeySelect()(first[i]));
+        counts[ithread * nb_threads + partition_for_hash(hashes[i])]++;
+      }
+    });
+
+    std::vector<std::size_t> partitions_offsets(nb_threads + 1, 0);
+    std::vector<std::size_t> write_offsets(nb_threads * nb_threads, 0);
+    std::size_t offset = 0;
+    for (std::size_t ipartition = 0; ipartition < nb_threads; ipartition++) {
+      partitions_offsets[ipartition] = offset;
+      for (std::size_t ithread = 0; ithread < nb_threads; ithread++) {
+        write_offsets[ithread * nb_threads + ipartition] = offset;
+        offset += counts[ithread * nb_threads + ipartition];
+      }
+    }
+    partitions_offsets[nb_threads] = offset;
+
+    // Scatter the indexes of the values by partition. Inside a partition, the
+    // indexes stay in the order of the input range.
+    std::vector<std::size_t> indexes(nb_elements_insert);
+    run_in_parallel(nb_threads, [&](std::size_t ithread) {
+      const auto input_range =
+          split_range(nb_elements_insert, nb_threads, ithread);
+      for (std::size_t i = input_range.first; i < input_range.second; i++) {
+        indexes[write_offsets[ithread * nb_threads +
+                              partition_for_hash(hashes[i])]++] = i;
+      }
+    });
+
+    // Insert the values of each partition. The counters are updated even if
+    // a thread throws so that the hash table stays consistent.
+    std::vector<std::vector<std::size_t>> spilled(nb_threads);
+    std::vector<std::size_t> nb_inserted(nb_threads, 0);
+    std::vector<std::size_t> nb_inserted_in_deleted(nb_threads, 0);
+    auto update_counters = [&]() {
+      for (std::size_t ipartition = 0; ipartition < nb_threads; ipartition++) {
+        m_nb_elements +=
+            nb_inserted[ipartition] + nb_inserted_in_deleted[ipartition];
+        m_nb_deleted_buckets -= nb_inserted_in_deleted[ipartition];
+      }
+    };
+
+    TSL_SH_TRY {
+      run_in_parallel(nb_threads, [&](std::size_t ipartition) {
+        const std::size_t sparse_ibucket_begin = ipartition * partition_size;
+        const std::size_t sparse_ibucket_end = std::min(
+            sparse_ibucket_begin + partition_size, nb_sparse_buckets);
+
+        for (std::size_t iindex = partitions_offsets[ipartition];
+             iindex < partitions_offsets[ipartition + 1]; iindex++) {
+          const std::size_t i = indexes[iindex];
+          switch (insert_in_range(KeySelect()(first[i]), hashes[i],
+                                  sparse_ibucket_begin, sparse_ibucket_end,
+                                  first[i])) {
+            case partition_insert_result::inserted:
+              nb_inserted[ipartition]++;
+              break;
+            case partition_insert_result::inserted_in_deleted:
+              nb_inserted_in_deleted[ipartition]++;
+              break;
+            case partition_insert_result::found:
+              break;
+            case partition_insert_result::spilled:
+              spilled[ipartition].push_back(i);
+              break;
+          }
+        }
+      });
+    }
+    TSL_SH_CATCH(...) {
+      update_counters();
+      TSL_SH_RETRHOW;
+    }
+    update_counters();
+
+    for (const auto &spilled_indexes : spilled) {
+      for (const std::size_t i : spilled_indexes) {
+        insert_impl(KeySelect()(first[i]), hashes[i], first[i]);
+      }
+    }
+  }
+
+  tsl::sh::memory_usage_info memory_usage() const noexcept {
+    tsl::sh::memory_usage_info usage;
+    usage.metadata_bytes =
+        m_sparse_buckets_data.capacity() * sizeof(sparse_array) +
+        m_sparse_buckets_refcounts.capacity() *
+            sizeof(sparse_bucket_refcount *);
+    usage.values_bytes = m_nb_elements * sizeof(value_type);
+    usage.slack_bytes = 0;
+    usage.nb_tombstones = m_nb_deleted_buckets;
+
+    for (const sparse_array &bucket : m_sparse_buckets_data) {
+      usage.slack_bytes +=
+          static_cast<std::size_t>(bucket.capacity() - bucket.size()) *
+          sizeof(value_type);
+    }
+
+    for (const sparse_bucket_refcount *refcount : m_sparse_buckets_refcounts) {
+      if (refcount != nullptr) {
+        usage.metadata_bytes += sizeof(sparse_bucket_refcount);
+      }
+    }
+
+    return usage;
+  }
+
+#ifdef TSL_SH_STATS
+  tsl::sh::probe_stats stats() const noexcept { return m_stats.stats(); }
+
+  void reset_stats() noexcept { m_stats.reset(); }
+#endif
+
+  tsl::sh::group_occupancy_info group_occupancy() const {
+    tsl::sh::group_occupancy_info info;
+    info.size_histogram.resize(sparse_array::nb_buckets() + 1, 0);
+
+    std::vector<std::size_t> nb_allocations_by_capacity;
+    for (const sparse_array &bucket : m_sparse_buckets_data) {
+      info.size_histogram[bucket.size()]++;
+
+      const std::size_t capacity = bucket.capacity();
+      if (capacity >= info.capacity_histogram.size()) {
+        info.capacity_histogram.resize(capacity + 1, 0);
+        nb_allocations_by_capacity.resize(capacity + 1, 0);
+      }
+      info.capacity_histogram[capacity]++;
+
+      if (capacity > 0 && !bucket.arena_values()) {
+        nb_allocations_by_capacity[capacity]++;
+      }
+    }
+
+    for (std::size_t capacity = 1; capacity < nb_allocations_by_capacity.size();
+         capacity++) {
+      if (nb_allocations_by_capacity[capacity] > 0) {
+        info.allocation_sizes.push_back(
+            {capacity * sizeof(value_type),
+             nb_allocations_by_capacity[capacity]});
+      }
+    }
+
+    return info;
+  }
+
+  void rehash_observer(tsl::sh::rehash_observer observer) {
+    m_rehash_observer = std::move(observer);
+  }
+
+  const tsl::sh::rehash_observer &rehash_observer() const noexcept {
+    return m_rehash_observer;
+  }
+
+  void hash_quality_monitor(tsl::sh::hash_quality_monitor monitor) {
+    monitor.sample_interval = std::max<std::size_t>(monitor.sample_interval, 1);
+    monitor.window_size = std::max<std::size_t>(monitor.window_size, 1);
+
+    m_hash_quality = std::move(monitor);
+    reset_hash_quality_window();
+  }
+
+  const tsl::sh::hash_quality_monitor &hash_quality_monitor() const noexcept {
+    return m_hash_quality;
+  }
+
+  std::size_t hash_seed() const noexcept { return m_hash_seed; }
+
+  /*
+   * Structural sharing
+   */
+  bool structural_sharing() const noexcept { return m_structural_sharing; }
+
+  void structural_sharing(bool enable) {
+    if (enable == m_structural_sharing) {
+      return;
+    }
+
+    if (enable) {
+      m_structural_sharing = true;
+      TSL_SH_TRY { create_sparse_buckets_refcounts(); }
+      TSL_SH_CATCH(...) {
+        destroy_sparse_buckets_refcounts();
+        m_structural_sharing = false;
+        TSL_SH_RETRHOW;
+      }
+    } else {
+      unshare_all_sparse_buckets();
+      destroy_sparse_buckets_refcounts();
+      m_structural_sharing = false;
+    }
+  }
+
+  /*
+   * Dirty tracking
+   */
+  bool dirty_tracking() const noexcept { return m_dirty_tracking; }
+
+  void dirty_tracking(bool enable) noexcept {
+    if (enable && !m_dirty_tracking) {
+      m_dirty_tracking = true;
+      mark_all_sparse_buckets_dirty();
+    }
+
+    m_dirty_tracking = enable;
+  }
+
   /*
    * Observers
    */
@@ -1741,8 +3220,9 @@ class sparse_hash : private Allocator,
         m_sparse_buckets_data.begin() +
         std::distance(m_sparse_buckets_data.cbegin(), pos.m_sparse_buckets_it);
 
-    return iterator(it_sparse_buckets,
-                    sparse_array::mutable_iterator(pos.m_sparse_array_it));
+    return unshare_sparse_bucket(
+        iterator(it_sparse_buckets,
+                 sparse_array::mutable_iterator(pos.m_sparse_array_it)));
   }
 
   template <class Serializer>
@@ -1751,11 +3231,61 @@ class sparse_hash : private Allocator,
   }
 
   template <class Deserializer>
-  void deserialize(Deserializer &deserializer, bool hash_compatible) {
-    deserialize_impl(deserializer, hash_compatible);
+  void deserialize(Deserializer &deserializer, bool hash_compatible,
+                   std::size_t nb_threads = 1) {
+    deserialize_impl(deserializer, hash_compatible, nb_threads, false);
+  }
+
+  /**
+   * Hash compatible deserialization which allocates the storage of all the
+   * values in one block, see `tsl::sparse_map::deserialize_in_arena`.
+   */
+  template <class Deserializer>
+  void deserialize_in_arena(Deserializer &deserializer) {
+    deserialize_impl(deserializer, true, 1, true);
+  }
+
+  template <class Serializer>
+  void serialize_delta(Serializer &serializer) {
+    serialize_delta_impl(serializer);
+  }
+
+  template <class Deserializer>
+  void apply_delta(Deserializer &deserializer) {
+    apply_delta_impl(deserializer);
+  }
+
+  template <class Serializer>
+  std::future<void> snapshot_async(Serializer &serializer) const {
+    if (!m_structural_sharing) {
+      TSL_SH_THROW_OR_ABORT(std::logic_error,
+                            "snapshot_async requires the structural sharing "
+                            "to be enabled.");
+    }
+
+    return std::async(std::launch::async,
+                      snapshot_task<Serializer>(*this, serializer));
   }
 
  private:
+  /**
+   * Serialize a copy of a map with structural sharing enabled. The copy is
+   * done on construction, in the thread calling snapshot_async, and only
+   * shares the groups of buckets with the source map.
+   */
+  template <class Serializer>
+  class snapshot_task {
+   public:
+    snapshot_task(const sparse_hash &source, Serializer &serializer)
+        : m_snapshot(source), m_serializer(std::addressof(serializer)) {}
+
+    void operator()() { m_snapshot.serialize(*m_serializer); }
+
+   private:
+    sparse_hash m_snapshot;
+    Serializer *m_serializer;
+  };
+
   template <class K>
   std::size_t hash_key(const K &key) const {
     return Hash::operator()(key);
@@ -1766,8 +3296,35 @@ class sparse_hash : private Allocator,
     return KeyEqual::operator()(key1, key2);
   }
 
+  /*
+   * Probe statistics, no-ops if TSL_SH_STATS is not defined.
+   */
+#ifdef TSL_SH_STATS
+  using stats_operation = probe_stats_recorder::operation;
+
+  void record_probes(stats_operation op, std::size_t probe) const noexcept {
+    m_stats.record_probes(op, probe);
+  }
+
+  void record_tombstone_skipped() const noexcept {
+    m_stats.record_tombstone_skipped();
+  }
+
+  void record_key_comparison() const noexcept {
+    m_stats.record_key_comparison();
+  }
+#else
+  enum class stats_operation { find, insert, erase };
+
+  void record_probes(stats_operation /*op*/,
+                     std::size_t /*probe*/) const noexcept {}
+  void record_tombstone_skipped() const noexcept {}
+  void record_key_comparison() const noexcept {}
+#endif
+
   size_type bucket_for_hash(std::size_t hash) const {
-    const std::size_t bucket = GrowthPolicy::bucket_for_hash(hash);
+    const std::size_t bucket = GrowthPolicy::bucket_for_hash(
+        (m_hash_seed == 0) ? hash : mix_hash(hash, m_hash_seed));
     tsl_sh_assert(sparse_array::sparse_ibucket(bucket) <
                       m_sparse_buckets_data.size() ||
                   (bucket == 0 && m_sparse_buckets_data.empty()));
@@ -1803,6 +3360,56 @@ class sparse_hash : private Allocator,
     }
   }
 
+  void copy_or_share_buckets_from(const sparse_hash &other) {
+    if (m_structural_sharing && static_cast<const Allocator &>(*this) ==
+                                    static_cast<const Allocator &>(other)) {
+      share_buckets_from(other);
+      m_values_arena = other.m_values_arena;
+      return;
+    }
+
+    copy_buckets_from(other);
+    if (m_structural_sharing) {
+      TSL_SH_TRY { create_sparse_buckets_refcounts(); }
+      TSL_SH_CATCH(...) {
+        clear();
+        TSL_SH_RETRHOW;
+      }
+    }
+  }
+
+  /**
+   * Share the values of the sparse buckets of `other` instead of copying them.
+   * Only the sparse_array objects themselves are copied.
+   */
+  void share_buckets_from(const sparse_hash &other) {
+    tsl_sh_assert(other.m_structural_sharing);
+    tsl_sh_assert(other.m_sparse_buckets_refcounts.size() ==
+                  other.m_sparse_buckets_data.size());
+
+    m_sparse_buckets_data.reserve(other.m_sparse_buckets_data.size());
+    m_sparse_buckets_refcounts.reserve(other.m_sparse_buckets_data.size());
+
+    for (std::size_t ibucket = 0; ibucket < other.m_sparse_buckets_data.size();
+         ibucket++) {
+      sparse_bucket_refcount *refcount =
+          other.m_sparse_buckets_refcounts[ibucket];
+      tsl_sh_assert(refcount != nullptr ||
+                    other.m_sparse_buckets_data[ibucket].capacity() == 0);
+
+      if (refcount != nullptr) {
+        refcount->fetch_add(1, std::memory_order_relaxed);
+      }
+
+      m_sparse_buckets_data.push_back(
+          other.m_sparse_buckets_data[ibucket].shallow_copy());
+      m_sparse_buckets_refcounts.push_back(refcount);
+    }
+
+    tsl_sh_assert(m_sparse_buckets_data.empty() ||
+                  m_sparse_buckets_data.back().last());
+  }
+
   // TODO encapsulate m_sparse_buckets_data to avoid the managing the allocator
   void copy_buckets_from(const sparse_hash &other) {
     m_sparse_buckets_data.reserve(other.m_sparse_buckets_data.size());
@@ -1826,9 +3433,19 @@ class sparse_hash : private Allocator,
     m_sparse_buckets_data.reserve(other.m_sparse_buckets_data.size());
 
     TSL_SH_TRY {
-      for (auto &&bucket : other.m_sparse_buckets_data) {
-        m_sparse_buckets_data.emplace_back(std::move(bucket),
-                                           static_cast<Allocator &>(*this));
+      for (std::size_t ibucket = 0;
+           ibucket < other.m_sparse_buckets_data.size(); ibucket++) {
+        if (other.is_sparse_bucket_shared(ibucket)) {
+          emplace_back_copy(other.m_sparse_buckets_data[ibucket]);
+        } else {
+          m_sparse_buckets_data.emplace_back(
+              std::move(other.m_sparse_buckets_data[ibucket]),
+              static_cast<Allocator &>(*this));
+        }
+      }
+
+      if (m_structural_sharing) {
+        create_sparse_buckets_refcounts();
       }
     }
     TSL_SH_CATCH(...) {
@@ -1840,69 +3457,288 @@ class sparse_hash : private Allocator,
                   m_sparse_buckets_data.back().last());
   }
 
-  template <class K, class... Args>
-  std::pair<iterator, bool> insert_impl(const K &key,
-                                        Args &&...value_type_args) {
-    /**
-     * We must insert the value in the first empty or deleted bucket we find. If
-     * we first find a deleted bucket, we still have to continue the search
-     * until we find an empty bucket or until we have searched all the buckets
-     * to be sure that the value is not in the hash table. We thus remember the
-     * position, if any, of the first deleted bucket we have encountered so we
-     * can insert it there if needed.
-     */
-    bool found_first_deleted_bucket = false;
-    std::size_t sparse_ibucket_first_deleted = 0;
-    typename sparse_array::size_type index_in_sparse_bucket_first_deleted = 0;
+  template <class U = value_type,
+            typename std::enable_if<
+                std::is_copy_constructible<U>::value>::type * = nullptr>
+  void emplace_back_copy(const sparse_array &bucket) {
+    m_sparse_buckets_data.emplace_back(bucket, static_cast<Allocator &>(*this));
+  }
 
-    const std::size_t hash = hash_key(key);
-    std::size_t ibucket = bucket_for_hash(hash);
+  template <class U = value_type,
+            typename std::enable_if<
+                !std::is_copy_constructible<U>::value>::type * = nullptr>
+  void emplace_back_copy(const sparse_array & /*bucket*/) {
+    // A hash table with a non-copyable value_type can't be copied and thus
+    // can't share its sparse buckets.
+    tsl_sh_assert(false);
+  }
 
-    std::size_t probe = 0;
-    while (true) {
-      std::size_t sparse_ibucket = sparse_array::sparse_ibucket(ibucket);
-      auto index_in_sparse_bucket =
-          sparse_array::index_in_sparse_bucket(ibucket);
+  /*
+   * Structural sharing
+   *
+   * When structural sharing is enabled, copying the hash table doesn't copy the
+   * values stored in the sparse buckets, they are shared between the two hash
+   * tables. Each sparse bucket with an allocated capacity then has a reference
+   * count in m_sparse_buckets_refcounts. Before any modification of the values
+   * of a sparse bucket, or before returning anything that allows the user to
+   * modify them (iterator, reference to a value, ...), the sparse bucket is
+   * cloned if its reference count is greater than 1.
+   */
+  sparse_bucket_refcount *create_sparse_bucket_refcount() {
+    sparse_bucket_refcount_allocator alloc(
+        static_cast<const Allocator &>(*this));
+    sparse_bucket_refcount *refcount =
+        std::allocator_traits<sparse_bucket_refcount_allocator>::allocate(alloc,
+                                                                          1);
+    ::new (static_cast<void *>(refcount)) sparse_bucket_refcount(1);
+
+    return refcount;
+  }
 
-      if (m_sparse_buckets[sparse_ibucket].has_value(index_in_sparse_bucket)) {
-        auto value_it =
-            m_sparse_buckets[sparse_ibucket].value(index_in_sparse_bucket);
-        if (compare_keys(key, KeySelect()(*value_it))) {
-          return std::make_pair(
-              iterator(m_sparse_buckets_data.begin() + sparse_ibucket,
-                       value_it),
-              false);
-        }
-      } else if (m_sparse_buckets[sparse_ibucket].has_deleted_value(
-                     index_in_sparse_bucket) &&
-                 probe < m_bucket_count) {
-        if (!found_first_deleted_bucket) {
-          found_first_deleted_bucket = true;
-          sparse_ibucket_first_deleted = sparse_ibucket;
-          index_in_sparse_bucket_first_deleted = index_in_sparse_bucket;
-        }
-      } else {
-        /**
-         * At this point we are sure that the value does not exist
-         * in the hash table.
-         * First check if we satisfy load and delete thresholds, and if not,
-         * rehash the hash table (and therefore start over). Otherwise, just
-         * insert the value into the appropriate bucket.
-         */
-        if (size() >= m_load_threshold_rehash) {
-          rehash_impl(GrowthPolicy::next_bucket_count());
-          return insert_impl(key, std::forward<Args>(value_type_args)...);
-        } else if (size() + m_nb_deleted_buckets >=
-                   m_load_threshold_clear_deleted) {
-          clear_deleted_buckets();
-          return insert_impl(key, std::forward<Args>(value_type_args)...);
-        }
+  void destroy_sparse_bucket_refcount(
+      sparse_bucket_refcount *refcount) noexcept {
+    sparse_bucket_refcount_allocator alloc(
+        static_cast<const Allocator &>(*this));
+    refcount->~sparse_bucket_refcount();
+    std::allocator_traits<sparse_bucket_refcount_allocator>::deallocate(
+        alloc, refcount, 1);
+  }
 
-        if (found_first_deleted_bucket) {
-          auto it = insert_in_bucket(sparse_ibucket_first_deleted,
-                                     index_in_sparse_bucket_first_deleted,
-                                     std::forward<Args>(value_type_args)...);
-          m_nb_deleted_buckets--;
+  /**
+   * Create a reference count for each sparse bucket with an allocated capacity
+   * which doesn't have one yet.
+   */
+  void create_sparse_buckets_refcounts() {
+    tsl_sh_assert(m_structural_sharing);
+    m_sparse_buckets_refcounts.resize(m_sparse_buckets_data.size(), nullptr);
+
+    for (std::size_t ibucket = 0; ibucket < m_sparse_buckets_data.size();
+         ibucket++) {
+      if (m_sparse_buckets_refcounts[ibucket] == nullptr &&
+          m_sparse_buckets_data[ibucket].capacity() > 0) {
+        m_sparse_buckets_refcounts[ibucket] = create_sparse_bucket_refcount();
+      }
+    }
+  }
+
+  /**
+   * Destroy the reference counts, all the sparse buckets must be unshared.
+   */
+  void destroy_sparse_buckets_refcounts() noexcept {
+    for (auto &refcount : m_sparse_buckets_refcounts) {
+      if (refcount != nullptr) {
+        tsl_sh_assert(refcount->load(std::memory_order_acquire) == 1);
+        destroy_sparse_bucket_refcount(refcount);
+        refcount = nullptr;
+      }
+    }
+
+    m_sparse_buckets_refcounts.clear();
+  }
+
+  bool is_sparse_bucket_shared(std::size_t ibucket) const noexcept {
+    if (ibucket >= m_sparse_buckets_refcounts.size()) {
+      return false;
+    }
+
+    const sparse_bucket_refcount *refcount =
+        m_sparse_buckets_refcounts[ibucket];
+    return refcount != nullptr &&
+           refcount->load(std::memory_order_acquire) > 1;
+  }
+
+  void unshare_sparse_bucket(std::size_t ibucket) {
+    if (m_structural_sharing && is_sparse_bucket_shared(ibucket)) {
+      clone_sparse_bucket(ibucket);
+    }
+  }
+
+  /**
+   * Unshare the sparse bucket pointed by `pos` and return an iterator to the
+   * same value in the unshared sparse bucket.
+   */
+  iterator unshare_sparse_bucket(iterator pos) {
+    if (pos.m_sparse_buckets_it == m_sparse_buckets_data.end()) {
+      return pos;
+    }
+
+    if (m_dirty_tracking) {
+      pos.m_sparse_buckets_it->set_dirty(true);
+    }
+
+    if (!m_structural_sharing) {
+      return pos;
+    }
+
+    const std::size_t ibucket = static_cast<std::size_t>(std::distance(
+        m_sparse_buckets_data.begin(), pos.m_sparse_buckets_it));
+    if (!is_sparse_bucket_shared(ibucket)) {
+      return pos;
+    }
+
+    const auto offset =
+        std::distance(pos.m_sparse_buckets_it->begin(), pos.m_sparse_array_it);
+    clone_sparse_bucket(ibucket);
+
+    return iterator(pos.m_sparse_buckets_it,
+                    pos.m_sparse_buckets_it->begin() + offset);
+  }
+
+  /**
+   * Mark all the sparse buckets as dirty if the dirty tracking is enabled.
+   */
+  void mark_all_sparse_buckets_dirty() noexcept {
+    if (!m_dirty_tracking) {
+      return;
+    }
+
+    for (auto &bucket : m_sparse_buckets_data) {
+      bucket.set_dirty(true);
+    }
+  }
+
+  void unshare_all_sparse_buckets() {
+    if (!m_structural_sharing) {
+      return;
+    }
+
+    for (std::size_t ibucket = 0; ibucket < m_sparse_buckets_data.size();
+         ibucket++) {
+      unshare_sparse_bucket(ibucket);
+    }
+  }
+
+  template <class U = value_type,
+            typename std::enable_if<
+                std::is_copy_constructible<U>::value>::type * = nullptr>
+  void clone_sparse_bucket(std::size_t ibucket) {
+    sparse_bucket_refcount *refcount = create_sparse_bucket_refcount();
+
+    TSL_SH_TRY {
+      sparse_array clone(m_sparse_buckets_data[ibucket],
+                         static_cast<Allocator &>(*this));
+
+      release_sparse_bucket(ibucket);
+      m_sparse_buckets_data[ibucket].swap(clone);
+      m_sparse_buckets_refcounts[ibucket] = refcount;
+    }
+    TSL_SH_CATCH(...) {
+      destroy_sparse_bucket_refcount(refcount);
+      TSL_SH_RETRHOW;
+    }
+  }
+
+  template <class U = value_type,
+            typename std::enable_if<
+                !std::is_copy_constructible<U>::value>::type * = nullptr>
+  void clone_sparse_bucket(std::size_t /*ibucket*/) {
+    // A hash table with a non-copyable value_type can't be copied and thus
+    // can't share its sparse buckets.
+    tsl_sh_assert(false);
+  }
+
+  /**
+   * Drop the reference of this hash table to the values of the sparse bucket.
+   * The values are destroyed if no other hash table shares them. The sparse
+   * bucket is empty afterwards.
+   */
+  void release_sparse_bucket(std::size_t ibucket) noexcept {
+    sparse_array &bucket = m_sparse_buckets_data[ibucket];
+    if (ibucket >= m_sparse_buckets_refcounts.size() ||
+        m_sparse_buckets_refcounts[ibucket] == nullptr) {
+      bucket.clear(*this);
+      return;
+    }
+
+    sparse_bucket_refcount *&refcount = m_sparse_buckets_refcounts[ibucket];
+    if (refcount->fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      bucket.clear(*this);
+      destroy_sparse_bucket_refcount(refcount);
+    } else {
+      bucket.release();
+    }
+
+    refcount = nullptr;
+  }
+
+  template <class K, typename P>
+  std::pair<iterator, bool> insert_with_key(const K &key, P &&value) {
+    return insert_impl(key, hash_key(key), std::forward<P>(value));
+  }
+
+  template <class K, class... Args>
+  std::pair<iterator, bool> insert_impl(const K &key, std::size_t hash,
+                                        Args &&...value_type_args) {
+    /**
+     * We must insert the value in the first empty or deleted bucket we find. If
+     * we first find a deleted bucket, we still have to continue the search
+     * until we find an empty bucket or until we have searched all the buckets
+     * to be sure that the value is not in the hash table. We thus remember the
+     * position, if any, of the first deleted bucket we have encountered so we
+     * can insert it there if needed.
+     */
+    bool found_first_deleted_bucket = false;
+    std::size_t sparse_ibucket_first_deleted = 0;
+    typename sparse_array::size_type index_in_sparse_bucket_first_deleted = 0;
+
+    std::size_t ibucket = bucket_for_hash(hash);
+
+    std::size_t probe = 0;
+    while (true) {
+      std::size_t sparse_ibucket = sparse_array::sparse_ibucket(ibucket);
+      auto index_in_sparse_bucket =
+          sparse_array::index_in_sparse_bucket(ibucket);
+
+      if (m_sparse_buckets[sparse_ibucket].has_value(index_in_sparse_bucket)) {
+        auto value_it =
+            m_sparse_buckets[sparse_ibucket].value(index_in_sparse_bucket);
+        record_key_comparison();
+        if (compare_keys(key, KeySelect()(*value_it))) {
+          record_probes(stats_operation::insert, probe);
+          return std::make_pair(
+              unshare_sparse_bucket(iterator(
+                  m_sparse_buckets_data.begin() + sparse_ibucket, value_it)),
+              false);
+        }
+      } else if (m_sparse_buckets[sparse_ibucket].has_deleted_value(
+                     index_in_sparse_bucket) &&
+                 probe < m_bucket_count) {
+        record_tombstone_skipped();
+        if (!found_first_deleted_bucket) {
+          found_first_deleted_bucket = true;
+          sparse_ibucket_first_deleted = sparse_ibucket;
+          index_in_sparse_bucket_first_deleted = index_in_sparse_bucket;
+        }
+      } else {
+        /**
+         * At this point we are sure that the value does not exist
+         * in the hash table.
+         * First check if we satisfy load and delete thresholds, and if not,
+         * rehash the hash table (and therefore start over). Otherwise, just
+         * insert the value into the appropriate bucket.
+         */
+        if (size() >= m_load_threshold_rehash) {
+          automatic_rehash(GrowthPolicy::next_bucket_count(),
+                           tsl::sh::rehash_reason::grow);
+          return insert_impl(key, hash,
+                             std::forward<Args>(value_type_args)...);
+        } else if (size() + m_nb_deleted_buckets >=
+                   m_load_threshold_clear_deleted) {
+          clear_deleted_buckets();
+          return insert_impl(key, hash,
+                             std::forward<Args>(value_type_args)...);
+        } else if (m_hash_quality.max_average_probes > 0.0f &&
+                   sample_insert_probes(probe)) {
+          return insert_impl(key, hash,
+                             std::forward<Args>(value_type_args)...);
+        }
+
+        record_probes(stats_operation::insert, probe);
+        if (found_first_deleted_bucket) {
+          auto it = insert_in_bucket(sparse_ibucket_first_deleted,
+                                     index_in_sparse_bucket_first_deleted,
+                                     std::forward<Args>(value_type_args)...);
+          m_nb_deleted_buckets--;
 
           return it;
         }
@@ -1921,8 +3757,8 @@ class sparse_hash : private Allocator,
       std::size_t sparse_ibucket,
       typename sparse_array::size_type index_in_sparse_bucket,
       Args &&...value_type_args) {
-    auto value_it = m_sparse_buckets[sparse_ibucket].set(
-        *this, index_in_sparse_bucket, std::forward<Args>(value_type_args)...);
+    auto value_it = set_in_bucket(sparse_ibucket, index_in_sparse_bucket,
+                                  std::forward<Args>(value_type_args)...);
     m_nb_elements++;
 
     return std::make_pair(
@@ -1930,6 +3766,100 @@ class sparse_hash : private Allocator,
         true);
   }
 
+  /**
+   * Same as insert_in_bucket but doesn't update m_nb_elements. Only modifies
+   * the sparse bucket `sparse_ibucket`, it can thus be called concurrently on
+   * different sparse buckets.
+   */
+  template <class... Args>
+  typename sparse_array::iterator set_in_bucket(
+      std::size_t sparse_ibucket,
+      typename sparse_array::size_type index_in_sparse_bucket,
+      Args &&...value_type_args) {
+    if (m_structural_sharing) {
+      unshare_sparse_bucket(sparse_ibucket);
+      if (m_sparse_buckets_refcounts[sparse_ibucket] == nullptr) {
+        m_sparse_buckets_refcounts[sparse_ibucket] =
+            create_sparse_bucket_refcount();
+      }
+    }
+
+    return m_sparse_buckets[sparse_ibucket].set(
+        *this, index_in_sparse_bucket, std::forward<Args>(value_type_args)...);
+  }
+
+  enum class partition_insert_result {
+    inserted,
+    inserted_in_deleted,
+    found,
+    spilled
+  };
+
+  /**
+   * Insert the value constructed from `value_type_args` with the same
+   * algorithm as insert_impl, but only if the probing can conclude without
+   * leaving the sparse buckets in [sparse_ibucket_begin, sparse_ibucket_end).
+   * Return `spilled` without inserting anything otherwise.
+   *
+   * Doesn't check the load thresholds nor update m_nb_elements and
+   * m_nb_deleted_buckets, it can thus be called concurrently on disjoint
+   * ranges of sparse buckets.
+   */
+  template <class K, class... Args>
+  partition_insert_result insert_in_range(const K &key, std::size_t hash,
+                                          std::size_t sparse_ibucket_begin,
+                                          std::size_t sparse_ibucket_end,
+                                          Args &&...value_type_args) {
+    bool found_first_deleted_bucket = false;
+    std::size_t sparse_ibucket_first_deleted = 0;
+    typename sparse_array::size_type index_in_sparse_bucket_first_deleted = 0;
+
+    std::size_t ibucket = bucket_for_hash(hash);
+
+    std::size_t probe = 0;
+    while (probe < m_bucket_count) {
+      const std::size_t sparse_ibucket = sparse_array::sparse_ibucket(ibucket);
+      if (sparse_ibucket < sparse_ibucket_begin ||
+          sparse_ibucket >= sparse_ibucket_end) {
+        break;
+      }
+
+      const auto index_in_sparse_bucket =
+          sparse_array::index_in_sparse_bucket(ibucket);
+
+      if (m_sparse_buckets[sparse_ibucket].has_value(index_in_sparse_bucket)) {
+        auto value_it =
+            m_sparse_buckets[sparse_ibucket].value(index_in_sparse_bucket);
+        if (compare_keys(key, KeySelect()(*value_it))) {
+          return partition_insert_result::found;
+        }
+      } else if (m_sparse_buckets[sparse_ibucket].has_deleted_value(
+                     index_in_sparse_bucket)) {
+        if (!found_first_deleted_bucket) {
+          found_first_deleted_bucket = true;
+          sparse_ibucket_first_deleted = sparse_ibucket;
+          index_in_sparse_bucket_first_deleted = index_in_sparse_bucket;
+        }
+      } else {
+        if (found_first_deleted_bucket) {
+          set_in_bucket(sparse_ibucket_first_deleted,
+                        index_in_sparse_bucket_first_deleted,
+                        std::forward<Args>(value_type_args)...);
+          return partition_insert_result::inserted_in_deleted;
+        }
+
+        set_in_bucket(sparse_ibucket, index_in_sparse_bucket,
+                      std::forward<Args>(value_type_args)...);
+        return partition_insert_result::inserted;
+      }
+
+      probe++;
+      ibucket = next_bucket(ibucket, probe);
+    }
+
+    return partition_insert_result::spilled;
+  }
+
   template <class K>
   size_type erase_impl(const K &key, std::size_t hash) {
     std::size_t ibucket = bucket_for_hash(hash);
@@ -1943,7 +3873,15 @@ class sparse_hash : private Allocator,
       if (m_sparse_buckets[sparse_ibucket].has_value(index_in_sparse_bucket)) {
         auto value_it =
             m_sparse_buckets[sparse_ibucket].value(index_in_sparse_bucket);
+        record_key_comparison();
         if (compare_keys(key, KeySelect()(*value_it))) {
+          record_probes(stats_operation::erase, probe);
+          if (m_structural_sharing && is_sparse_bucket_shared(sparse_ibucket)) {
+            clone_sparse_bucket(sparse_ibucket);
+            value_it =
+                m_sparse_buckets[sparse_ibucket].value(index_in_sparse_bucket);
+          }
+
           m_sparse_buckets[sparse_ibucket].erase(*this, value_it,
                                                  index_in_sparse_bucket);
           m_nb_elements--;
@@ -1954,7 +3892,10 @@ class sparse_hash : private Allocator,
       } else if (!m_sparse_buckets[sparse_ibucket].has_deleted_value(
                      index_in_sparse_bucket) ||
                  probe >= m_bucket_count) {
+        record_probes(stats_operation::erase, probe);
         return 0;
+      } else {
+        record_tombstone_skipped();
       }
 
       probe++;
@@ -1981,14 +3922,19 @@ class sparse_hash : private Allocator,
       if (m_sparse_buckets[sparse_ibucket].has_value(index_in_sparse_bucket)) {
         auto value_it =
             m_sparse_buckets[sparse_ibucket].value(index_in_sparse_bucket);
+        record_key_comparison();
         if (compare_keys(key, KeySelect()(*value_it))) {
+          record_probes(stats_operation::find, probe);
           return const_iterator(m_sparse_buckets_data.cbegin() + sparse_ibucket,
                                 value_it);
         }
       } else if (!m_sparse_buckets[sparse_ibucket].has_deleted_value(
                      index_in_sparse_bucket) ||
                  probe >= m_bucket_count) {
+        record_probes(stats_operation::find, probe);
         return cend();
+      } else {
+        record_tombstone_skipped();
       }
 
       probe++;
@@ -1999,10 +3945,100 @@ class sparse_hash : private Allocator,
   void clear_deleted_buckets() {
     // TODO could be optimized, we could do it in-place instead of allocating a
     // new bucket array.
-    rehash_impl(m_bucket_count);
+    automatic_rehash(m_bucket_count, tsl::sh::rehash_reason::purge_deleted);
     tsl_sh_assert(m_nb_deleted_buckets == 0);
   }
 
+  /**
+   * Rehash to `count` buckets for `reason`, calling the rehash observer, if
+   * any, before and after. If the rehash throws, the observer is only called
+   * before.
+   */
+  void automatic_rehash(size_type count, tsl::sh::rehash_reason reason) {
+    if (!m_rehash_observer) {
+      rehash_impl(count);
+      return;
+    }
+
+    tsl::sh::rehash_event event;
+    event.reason = reason;
+    event.completed = false;
+    event.old_bucket_count = m_bucket_count;
+    event.new_bucket_count = count;
+    event.nb_elements = m_nb_elements;
+    event.nb_deleted_buckets = m_nb_deleted_buckets;
+    event.elapsed = std::chrono::nanoseconds(0);
+    m_rehash_observer(event);
+
+    const auto start = std::chrono::steady_clock::now();
+    rehash_impl(count);
+    event.elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start);
+
+    event.completed = true;
+    event.new_bucket_count = m_bucket_count;
+    m_rehash_observer(event);
+  }
+
+  /**
+   * Sample the number of probes of an insertion for the hash quality monitor.
+   * Return true if the hash table has been reseeded and rehashed, the
+   * insertion must then start over.
+   */
+  bool sample_insert_probes(std::size_t probe) {
+    if (++m_hash_quality_nb_insertions < m_hash_quality.sample_interval) {
+      return false;
+    }
+
+    m_hash_quality_nb_insertions = 0;
+    m_hash_quality_nb_samples++;
+    m_hash_quality_nb_probes += probe;
+    if (m_hash_quality_nb_samples < m_hash_quality.window_size) {
+      return false;
+    }
+
+    tsl::sh::hash_quality_event event;
+    event.average_probes = double(m_hash_quality_nb_probes) /
+                           double(m_hash_quality_nb_samples);
+    event.nb_samples = m_hash_quality_nb_samples;
+    event.bucket_count = m_bucket_count;
+    event.nb_elements = m_nb_elements;
+    reset_hash_quality_window();
+
+    if (!(event.average_probes > m_hash_quality.max_average_probes)) {
+      return false;
+    }
+
+    // Once seeded, long probings come from full hash collisions that no
+    // reseeding can fix, only report them.
+    event.reseeded = m_hash_quality.reseed && m_hash_seed == 0;
+    if (m_hash_quality.observer) {
+      m_hash_quality.observer(event);
+    }
+
+    if (!event.reseeded) {
+      return false;
+    }
+
+    const std::size_t old_hash_seed = m_hash_seed;
+    m_hash_seed = generate_hash_seed();
+    TSL_SH_TRY {
+      automatic_rehash(m_bucket_count, tsl::sh::rehash_reason::reseed);
+    }
+    TSL_SH_CATCH(...) {
+      m_hash_seed = old_hash_seed;
+      TSL_SH_RETRHOW;
+    }
+
+    return true;
+  }
+
+  void reset_hash_quality_window() noexcept {
+    m_hash_quality_nb_insertions = 0;
+    m_hash_quality_nb_samples = 0;
+    m_hash_quality_nb_probes = 0;
+  }
+
   template <tsl::sh::exception_safety U = ExceptionSafety,
             typename std::enable_if<U == tsl::sh::exception_safety::basic>::type
                 * = nullptr>
@@ -2010,39 +4046,434 @@ class sparse_hash : private Allocator,
     sparse_hash new_table(count, static_cast<Hash &>(*this),
                           static_cast<KeyEqual &>(*this),
                           static_cast<Allocator &>(*this), m_max_load_factor);
+    new_table.m_hash_seed = m_hash_seed;
 
-    for (auto &bucket : m_sparse_buckets_data) {
-      for (auto &val : bucket) {
-        new_table.insert_on_rehash(std::move(val));
+    for (std::size_t ibucket = 0; ibucket < m_sparse_buckets_data.size();
+         ibucket++) {
+      if (is_sparse_bucket_shared(ibucket)) {
+        // The values are still used by another hash table, copy them.
+        new_table.insert_on_rehash_copy(m_sparse_buckets_data[ibucket]);
+      } else {
+        for (auto &val : m_sparse_buckets_data[ibucket]) {
+          new_table.insert_on_rehash(std::move(val));
+        }
       }
 
       // TODO try to reuse some of the memory
-      bucket.clear(*this);
+      release_sparse_bucket(ibucket);
+    }
+
+    new_table.structural_sharing(m_structural_sharing);
+    new_table.m_dirty_tracking = m_dirty_tracking;
+    new_table.m_rehash_observer = std::move(m_rehash_observer);
+    new_table.m_hash_quality = std::move(m_hash_quality);
+    new_table.swap(*this);
+  }
+
+  /**
+   * TODO: For now we copy each element into the new map. We could move
+   * them if they are nothrow_move_constructible without triggering
+   * any exception if we reserve enough space in the sparse arrays beforehand.
+   */
+  template <tsl::sh::exception_safety U = ExceptionSafety,
+            typename std::enable_if<
+                U == tsl::sh::exception_safety::strong>::type * = nullptr>
+  void rehash_impl(size_type count) {
+    sparse_hash new_table(count, static_cast<Hash &>(*this),
+                          static_cast<KeyEqual &>(*this),
+                          static_cast<Allocator &>(*this), m_max_load_factor);
+    new_table.m_hash_seed = m_hash_seed;
+
+    for (const auto &bucket : m_sparse_buckets_data) {
+      for (const auto &val : bucket) {
+        new_table.insert_on_rehash(val);
+      }
+    }
+
+    new_table.structural_sharing(m_structural_sharing);
+    new_table.m_dirty_tracking = m_dirty_tracking;
+    new_table.m_rehash_observer = std::move(m_rehash_observer);
+    new_table.m_hash_quality = std::move(m_hash_quality);
+    new_table.swap(*this);
+  }
+
+  template <class U = value_type,
+            typename std::enable_if<
+                std::is_copy_constructible<U>::value>::type * = nullptr>
+  void insert_on_rehash_copy(const sparse_array &bucket) {
+    for (const auto &val : bucket) {
+      insert_on_rehash(val);
+    }
+  }
+
+  template <class U = value_type,
+            typename std::enable_if<
+                !std::is_copy_constructible<U>::value>::type * = nullptr>
+  void insert_on_rehash_copy(const sparse_array & /*bucket*/) {
+    // A hash table with a non-copyable value_type can't be copied and thus
+    // can't share its sparse buckets.
+    tsl_sh_assert(false);
+  }
+
+  struct rehash_entry {
+    value_type *value;
+    std::size_t hash;
+  };
+
+  /**
+   * Parallel version of rehash_impl. The destination sparse buckets are split
+   * in `nb_threads` contiguous partitions, each thread inserts the values
+   * which have their initial bucket in its partition, as long as the probing
+   * doesn't leave the partition. The few values that would leave it are
+   * inserted afterwards by the calling thread.
+   *
+   * With the basic exception safety, the values are moved into the new table
+   * unless some sparse buckets are shared, they are copied otherwise.
+   */
+  void parallel_rehash_impl(size_type count, std::size_t nb_threads) {
+    sparse_hash new_table(count, static_cast<Hash &>(*this),
+                          static_cast<KeyEqual &>(*this),
+                          static_cast<Allocator &>(*this), m_max_load_factor);
+    new_table.m_hash_seed = m_hash_seed;
+
+    const std::size_t nb_dst_sparse_buckets =
+        new_table.m_sparse_buckets_data.size();
+    nb_threads = std::min(nb_threads, nb_dst_sparse_buckets);
+    if (nb_threads <= 1 || empty()) {
+      rehash_impl(count);
+      return;
+    }
+
+    const bool move_values =
+        ExceptionSafety == tsl::sh::exception_safety::basic &&
+        !has_shared_sparse_buckets();
+
+    const std::size_t nb_src_sparse_buckets = m_sparse_buckets_data.size();
+    const std::size_t partition_size =
+        (nb_dst_sparse_buckets + nb_threads - 1) / nb_threads;
+    auto partition_for_hash = [&](std::size_t hash) {
+      return sparse_array::sparse_ibucket(new_table.bucket_for_hash(hash)) /
+             partition_size;
+    };
+
+    // Count the number of values going to each partition from the source
+    // sparse buckets of each thread.
+    std::vector<std::size_t> counts(nb_threads * nb_threads, 0);
+    run_in_parallel(nb_threads, [&](std::size_t ithread) {
+      const auto src_range =
+          split_range(nb_src_sparse_buckets, nb_threads, ithread);
+      for (std::size_t ibucket = src_range.first; ibucket < src_range.second;
+           ibucket++) {
+        for (const auto &value : m_sparse_buckets_data[ibucket]) {
+          counts[ithread * nb_threads +
+                 partition_for_hash(hash_key(KeySelect()(value)))]++;
+        }
+      }
+    });
+
+    std::vector<std::size_t> partitions_offsets(nb_threads + 1, 0);
+    std::vector<std::size_t> write_offsets(nb_threads * nb_threads, 0);
+    std::size_t offset = 0;
+    for (std::size_t ipartition = 0; ipartition < nb_threads; ipartition++) {
+      partitions_offsets[ipartition] = offset;
+      for (std::size_t ithread = 0; ithread < nb_threads; ithread++) {
+        write_offsets[ithread * nb_threads + ipartition] = offset;
+        offset += counts[ithread * nb_threads + ipartition];
+      }
     }
+    partitions_offsets[nb_threads] = offset;
+    tsl_sh_assert(offset == size());
+
+    // Scatter the values by partition.
+    std::vector<rehash_entry> entries(size());
+    run_in_parallel(nb_threads, [&](std::size_t ithread) {
+      const auto src_range =
+          split_range(nb_src_sparse_buckets, nb_threads, ithread);
+      for (std::size_t ibucket = src_range.first; ibucket < src_range.second;
+           ibucket++) {
+        for (auto &value : m_sparse_buckets_data[ibucket]) {
+          const std::size_t hash = hash_key(KeySelect()(value));
+          entries[write_offsets[ithread * nb_threads +
+                                partition_for_hash(hash)]++] = {&value, hash};
+        }
+      }
+    });
+
+    // Insert the values of each partition.
+    std::vector<std::vector<rehash_entry>> spilled(nb_threads);
+    std::vector<std::size_t> nb_inserted(nb_threads, 0);
+    run_in_parallel(nb_threads, [&](std::size_t ipartition) {
+      const std::size_t sparse_ibucket_begin = ipartition * partition_size;
+      const std::size_t sparse_ibucket_end = std::min(
+          sparse_ibucket_begin + partition_size, nb_dst_sparse_buckets);
+
+      for (std::size_t ientry = partitions_offsets[ipartition];
+           ientry < partitions_offsets[ipartition + 1]; ientry++) {
+        if (new_table.insert_on_rehash_in_range(
+                entries[ientry], move_values, sparse_ibucket_begin,
+                sparse_ibucket_end)) {
+          nb_inserted[ipartition]++;
+        } else {
+          spilled[ipartition].push_back(entries[ientry]);
+        }
+      }
+    });
+
+    for (std::size_t ipartition = 0; ipartition < nb_threads; ipartition++) {
+      new_table.m_nb_elements += nb_inserted[ipartition];
+      for (const auto &entry : spilled[ipartition]) {
+        new_table.insert_on_rehash_entry(entry, move_values);
+      }
+    }
+    tsl_sh_assert(new_table.size() == size());
+
+    run_in_parallel(nb_threads, [&](std::size_t ithread) {
+      const auto src_range =
+          split_range(nb_src_sparse_buckets, nb_threads, ithread);
+      for (std::size_t ibucket = src_range.first; ibucket < src_range.second;
+           ibucket++) {
+        release_sparse_bucket(ibucket);
+      }
+    });
+    m_nb_elements = 0;
+    m_nb_deleted_buckets = 0;
+
+    new_table.structural_sharing(m_structural_sharing);
+    new_table.m_dirty_tracking = m_dirty_tracking;
+    new_table.m_rehash_observer = std::move(m_rehash_observer);
+    new_table.m_hash_quality = std::move(m_hash_quality);
+    new_table.swap(*this);
+  }
+
+  node_handle extract_impl(iterator pos, std::size_t hash) {
+    pos = unshare_sparse_bucket(pos);
+    node_handle node(typename node_handle::construct_tag(), hash,
+                     std::move(*pos.m_sparse_array_it));
+    erase(pos);
+
+    return node;
+  }
+
+  /**
+   * Insert the values of `other`, moving them if `move_values` is true and
+   * the sparse bucket holding them is not shared, copying them otherwise.
+   * `other` is not modified if `move_values` is false.
+   *
+   * If both hash tables have the same bucket count (after reserving enough
+   * space for the values of `other`), a value of `other` which is in its
+   * initial bucket can be put in the same bucket of this hash table if this
+   * bucket is empty and has never been used: the value can't be in the hash
+   * table as its probing would have stopped there. These values are spliced
+   * group by group with one allocation per group. The others go through the
+   * normal insertion afterwards.
+   */
+  void merge_impl(sparse_hash &other, bool move_values) {
+    if (other.empty()) {
+      return;
+    }
+
+    if (m_load_threshold_rehash - size() < other.size()) {
+      reserve_automatically(size() + other.size());
+    }
+    if (m_nb_deleted_buckets > 0 &&
+        size() + m_nb_deleted_buckets + other.size() >=
+            m_load_threshold_clear_deleted) {
+      clear_deleted_buckets();
+    }
+
+    std::vector<rehash_entry> remaining_entries;
+    if (bucket_count() == other.bucket_count()) {
+      std::vector<typename sparse_array::size_type> indexes;
+      std::vector<value_type *> values;
+
+      for (std::size_t sparse_ibucket = 0;
+           sparse_ibucket < other.m_sparse_buckets_data.size();
+           sparse_ibucket++) {
+        sparse_array &other_bucket = other.m_sparse_buckets_data[sparse_ibucket];
+        if (other_bucket.empty()) {
+          continue;
+        }
+
+        indexes.clear();
+        values.clear();
+        for (std::size_t index = 0; index < sparse_array::nb_buckets();
+             index++) {
+          const auto index_in_sparse_bucket =
+              static_cast<typename sparse_array::size_type>(index);
+          if (!other_bucket.has_value(index_in_sparse_bucket)) {
+            continue;
+          }
+
+          value_type &value = *other_bucket.value(index_in_sparse_bucket);
+          const std::size_t hash = hash_key(KeySelect()(value));
+          const std::size_t ibucket = bucket_for_hash(hash);
+          if (sparse_array::sparse_ibucket(ibucket) == sparse_ibucket &&
+              sparse_array::index_in_sparse_bucket(ibucket) ==
+                  index_in_sparse_bucket &&
+              !m_sparse_buckets[sparse_ibucket].has_value(
+                  index_in_sparse_bucket) &&
+              !m_sparse_buckets[sparse_ibucket].has_deleted_value(
+                  index_in_sparse_bucket)) {
+            indexes.push_back(index_in_sparse_bucket);
+            values.push_back(&value);
+          } else {
+            remaining_entries.push_back({&value, hash});
+          }
+        }
+
+        if (!indexes.empty()) {
+          if (m_structural_sharing) {
+            unshare_sparse_bucket(sparse_ibucket);
+            if (m_sparse_buckets_refcounts[sparse_ibucket] == nullptr) {
+              m_sparse_buckets_refcounts[sparse_ibucket] =
+                  create_sparse_bucket_refcount();
+            }
+          }
+
+          m_sparse_buckets[sparse_ibucket].set_multiple(
+              *this, indexes.data(), values.data(),
+              static_cast<typename sparse_array::size_type>(indexes.size()),
+              move_values && !other.is_sparse_bucket_shared(sparse_ibucket));
+          m_nb_elements += indexes.size();
+        }
+      }
+    } else {
+      remaining_entries.reserve(other.size());
+      for (std::size_t sparse_ibucket = 0;
+           sparse_ibucket < other.m_sparse_buckets_data.size();
+           sparse_ibucket++) {
+        for (auto &value : other.m_sparse_buckets_data[sparse_ibucket]) {
+          remaining_entries.push_back({&value, hash_key(KeySelect()(value))});
+        }
+      }
+    }
+
+    const bool move_remaining_values =
+        move_values && !other.has_shared_sparse_buckets();
+    for (const auto &entry : remaining_entries) {
+      insert_from_rehash_entry(entry, move_remaining_values);
+    }
+  }
+
+  template <class U = value_type,
+            typename std::enable_if<
+                std::is_copy_constructible<U>::value>::type * = nullptr>
+  void insert_from_rehash_entry(const rehash_entry &entry, bool move_value) {
+    if (move_value) {
+      insert_impl(KeySelect()(*entry.value), entry.hash,
+                  std::move(*entry.value));
+    } else {
+      insert_impl(KeySelect()(*entry.value), entry.hash, *entry.value);
+    }
+  }
+
+  template <class U = value_type,
+            typename std::enable_if<
+                !std::is_copy_constructible<U>::value>::type * = nullptr>
+  void insert_from_rehash_entry(const rehash_entry &entry, bool move_value) {
+    tsl_sh_assert(move_value);
+    (void)move_value;
+    insert_impl(KeySelect()(*entry.value), entry.hash, std::move(*entry.value));
+  }
+
+  bool has_shared_sparse_buckets() const noexcept {
+    if (!m_structural_sharing) {
+      return false;
+    }
+
+    for (std::size_t ibucket = 0; ibucket < m_sparse_buckets_data.size();
+         ibucket++) {
+      if (is_sparse_bucket_shared(ibucket)) {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  /**
+   * Insert the value of `entry` in the first free bucket of its probing
+   * sequence, as long as this bucket is in a sparse bucket in
+   * [sparse_ibucket_begin, sparse_ibucket_end). Return false without inserting
+   * the value otherwise. Doesn't update m_nb_elements.
+   */
+  bool insert_on_rehash_in_range(const rehash_entry &entry, bool move_value,
+                                 std::size_t sparse_ibucket_begin,
+                                 std::size_t sparse_ibucket_end) {
+    std::size_t ibucket = bucket_for_hash(entry.hash);
+
+    std::size_t probe = 0;
+    while (true) {
+      const std::size_t sparse_ibucket = sparse_array::sparse_ibucket(ibucket);
+      if (sparse_ibucket < sparse_ibucket_begin ||
+          sparse_ibucket >= sparse_ibucket_end) {
+        return false;
+      }
+
+      const auto index_in_sparse_bucket =
+          sparse_array::index_in_sparse_bucket(ibucket);
+      if (!m_sparse_buckets[sparse_ibucket].has_value(index_in_sparse_bucket)) {
+        set_from_rehash_entry(sparse_ibucket, index_in_sparse_bucket, entry,
+                              move_value);
+        return true;
+      }
+
+      probe++;
+      ibucket = next_bucket(ibucket, probe);
+    }
+  }
+
+  void insert_on_rehash_entry(const rehash_entry &entry, bool move_value) {
+    std::size_t ibucket = bucket_for_hash(entry.hash);
+
+    std::size_t probe = 0;
+    while (true) {
+      const std::size_t sparse_ibucket = sparse_array::sparse_ibucket(ibucket);
+      const auto index_in_sparse_bucket =
+          sparse_array::index_in_sparse_bucket(ibucket);
+
+      if (!m_sparse_buckets[sparse_ibucket].has_value(index_in_sparse_bucket)) {
+        set_from_rehash_entry(sparse_ibucket, index_in_sparse_bucket, entry,
+                              move_value);
+        m_nb_elements++;
+
+        return;
+      }
 
-    new_table.swap(*this);
+      probe++;
+      ibucket = next_bucket(ibucket, probe);
+    }
   }
 
-  /**
-   * TODO: For now we copy each element into the new map. We could move
-   * them if they are nothrow_move_constructible without triggering
-   * any exception if we reserve enough space in the sparse arrays beforehand.
-   */
-  template <tsl::sh::exception_safety U = ExceptionSafety,
+  template <class U = value_type,
             typename std::enable_if<
-                U == tsl::sh::exception_safety::strong>::type * = nullptr>
-  void rehash_impl(size_type count) {
-    sparse_hash new_table(count, static_cast<Hash &>(*this),
-                          static_cast<KeyEqual &>(*this),
-                          static_cast<Allocator &>(*this), m_max_load_factor);
-
-    for (const auto &bucket : m_sparse_buckets_data) {
-      for (const auto &val : bucket) {
-        new_table.insert_on_rehash(val);
-      }
+                std::is_copy_constructible<U>::value>::type * = nullptr>
+  void set_from_rehash_entry(
+      std::size_t sparse_ibucket,
+      typename sparse_array::size_type index_in_sparse_bucket,
+      const rehash_entry &entry, bool move_value) {
+    if (move_value) {
+      m_sparse_buckets[sparse_ibucket].set(*this, index_in_sparse_bucket,
+                                           std::move(*entry.value));
+    } else {
+      m_sparse_buckets[sparse_ibucket].set(*this, index_in_sparse_bucket,
+                                           *entry.value);
     }
+  }
 
-    new_table.swap(*this);
+  template <class U = value_type,
+            typename std::enable_if<
+                !std::is_copy_constructible<U>::value>::type * = nullptr>
+  void set_from_rehash_entry(
+      std::size_t sparse_ibucket,
+      typename sparse_array::size_type index_in_sparse_bucket,
+      const rehash_entry &entry, bool move_value) {
+    // Values are only copied with the strong exception guarantee or when
+    // buckets are shared, which both require a copyable value_type.
+    tsl_sh_assert(move_value);
+    (void)move_value;
+    m_sparse_buckets[sparse_ibucket].set(*this, index_in_sparse_bucket,
+                                         std::move(*entry.value));
   }
 
   template <typename K>
@@ -2076,9 +4507,53 @@ class sparse_hash : private Allocator,
 
   template <class Serializer>
   void serialize_impl(Serializer &serializer) const {
+    using varint = has_write_bytes<Serializer>;
+    using raw_values =
+        std::integral_constant<bool, has_write_bytes<Serializer>::value &&
+                                         is_raw_serializable<value_type>::value>;
+
+    serialize_header(serializer, 0, raw_values());
+    serialize_sparse_buckets(serializer, varint(), raw_values(), false);
+  }
+
+  template <class Serializer>
+  void serialize_delta_impl(Serializer &serializer) {
+    if (!m_dirty_tracking) {
+      TSL_SH_THROW_OR_ABORT(std::logic_error,
+                            "serialize_delta requires the dirty tracking to "
+                            "be enabled.");
+    }
+
+    using varint = has_write_bytes<Serializer>;
+    using raw_values =
+        std::integral_constant<bool, has_write_bytes<Serializer>::value &&
+                                         is_raw_serializable<value_type>::value>;
+
+    serialize_header(serializer, SERIALIZATION_FLAG_DELTA, raw_values());
+    serialize_sparse_buckets(serializer, varint(), raw_values(), true);
+
+    for (auto &bucket : m_sparse_buckets_data) {
+      bucket.set_dirty(false);
+    }
+  }
+
+  template <class Serializer, class RawValues>
+  void serialize_header(Serializer &serializer, slz_size_type extra_flags,
+                        RawValues /*raw_values*/) const {
     const slz_size_type version = SERIALIZATION_PROTOCOL_VERSION;
     serializer(version);
 
+    const slz_size_type flags =
+        SERIALIZATION_FLAG_COMPACT_SPARSE_BUCKETS | extra_flags |
+        (has_write_bytes<Serializer>::value ? SERIALIZATION_FLAG_VARINT : 0) |
+        (RawValues::value ? SERIALIZATION_FLAG_RAW_VALUES : 0) |
+        ((m_hash_seed != 0) ? SERIALIZATION_FLAG_HASH_SEED : 0);
+    serializer(flags);
+    if (RawValues::value) {
+      const slz_size_type value_size = sizeof(value_type);
+      serializer(value_size);
+    }
+
     const slz_size_type bucket_count = m_bucket_count;
     serializer(bucket_count);
 
@@ -2094,44 +4569,372 @@ class sparse_hash : private Allocator,
     const float max_load_factor = m_max_load_factor;
     serializer(max_load_factor);
 
+    if (m_hash_seed != 0) {
+      const slz_size_type hash_seed = m_hash_seed;
+      serializer(hash_seed);
+    }
+  }
+
+  /**
+   * Serialize the sparse buckets in the compact format: each serialized
+   * sparse bucket is preceded by the number of skipped sparse buckets before
+   * it, and the skipped sparse buckets at the end are serialized as a last
+   * count.
+   *
+   * The unused sparse buckets are skipped, or the non dirty ones if `delta` is
+   * true.
+   */
+  template <class Serializer, class Varint, class RawValues>
+  void serialize_sparse_buckets(Serializer &serializer, Varint varint,
+                                RawValues raw_values, bool delta) const {
+    slz_size_type nb_skipped_sparse_buckets = 0;
     for (const auto &bucket : m_sparse_buckets_data) {
-      bucket.serialize(serializer);
+      if (delta ? !bucket.dirty() : bucket.unused()) {
+        nb_skipped_sparse_buckets++;
+        continue;
+      }
+
+      serialize_size(serializer, nb_skipped_sparse_buckets, varint);
+      nb_skipped_sparse_buckets = 0;
+
+      bucket.serialize_compact(serializer, varint, raw_values);
+    }
+
+    if (nb_skipped_sparse_buckets > 0) {
+      serialize_size(serializer, nb_skipped_sparse_buckets, varint);
     }
   }
 
   template <class Deserializer>
-  void deserialize_impl(Deserializer &deserializer, bool hash_compatible) {
-    tsl_sh_assert(
-        m_bucket_count == 0 &&
-        m_sparse_buckets_data.empty());  // Current hash table must be empty
+  sparse_array deserialize_sparse_bucket(Deserializer &deserializer,
+                                         bool raw_values) {
+    using raw_capable =
+        std::integral_constant<bool, has_read_bytes<Deserializer>::value &&
+                                         is_raw_serializable<value_type>::value>;
+    return deserialize_sparse_bucket(deserializer, raw_values, raw_capable());
+  }
+
+  template <class Deserializer>
+  sparse_array deserialize_sparse_bucket(Deserializer &deserializer,
+                                         bool raw_values,
+                                         std::true_type /*raw_capable*/) {
+    if (raw_values) {
+      return sparse_array::deserialize_raw(deserializer,
+                                           static_cast<Allocator &>(*this));
+    }
+
+    return sparse_array::deserialize_hash_compatible(
+        deserializer, static_cast<Allocator &>(*this));
+  }
+
+  template <class Deserializer>
+  sparse_array deserialize_sparse_bucket(Deserializer &deserializer,
+                                         bool raw_values,
+                                         std::false_type /*raw_capable*/) {
+    tsl_sh_assert(!raw_values);
+    (void)raw_values;
+    return sparse_array::deserialize_hash_compatible(
+        deserializer, static_cast<Allocator &>(*this));
+  }
+
+  /**
+   * Insert the values deserialized by the non hash compatible deserialization
+   * in the hash table. With more than one thread, the values are buffered and
+   * inserted by chunks with parallel_insert, the deserializer itself is only
+   * called by the calling thread.
+   */
+  class deserialized_values_inserter {
+   public:
+    deserialized_values_inserter(sparse_hash &ht, std::size_t nb_threads,
+                                 std::size_t nb_values)
+        : m_ht(ht), m_nb_threads(nb_threads), m_chunk_size(0) {
+      if (m_nb_threads > 1) {
+        m_chunk_size = std::min(
+            nb_values, m_nb_threads * PARALLEL_DESERIALIZATION_CHUNK_SIZE);
+        m_values.reserve(m_chunk_size);
+      }
+    }
+
+    void insert(value_type &&value) {
+      if (m_chunk_size == 0) {
+        m_ht.insert(std::move(value));
+        return;
+      }
+
+      m_values.push_back(std::move(value));
+      if (m_values.size() >= m_chunk_size) {
+        flush();
+      }
+    }
+
+    void flush() {
+      m_ht.parallel_insert(std::make_move_iterator(m_values.begin()),
+                           std::make_move_iterator(m_values.end()),
+                           m_nb_threads);
+      m_values.clear();
+    }
+
+   private:
+    sparse_hash &m_ht;
+    std::size_t m_nb_threads;
+    std::size_t m_chunk_size;
+    std::vector<value_type> m_values;
+  };
+
+  template <class Deserializer>
+  void deserialize_sparse_bucket_values(
+      Deserializer &deserializer, bool raw_values,
+      deserialized_values_inserter &inserter) {
+    if (raw_values) {
+      insert_deserialized_values(deserialize_sparse_bucket(deserializer, true),
+                                 inserter);
+    } else {
+      sparse_array::deserialize_values_into_sparse_hash(deserializer, inserter);
+    }
+  }
+
+  /**
+   * Insert the values of a deserialized sparse bucket and free it.
+   */
+  void insert_deserialized_values(sparse_array sarray,
+                                  deserialized_values_inserter &inserter) {
+    TSL_SH_TRY {
+      for (auto &value : sarray) {
+        inserter.insert(std::move(value));
+      }
+    }
+    TSL_SH_CATCH(...) {
+      sarray.clear(static_cast<Allocator &>(*this));
+      TSL_SH_RETRHOW;
+    }
+    sarray.clear(static_cast<Allocator &>(*this));
+  }
+
+  template <class Deserializer>
+  sparse_array deserialize_compact_sparse_bucket(
+      Deserializer &deserializer, bool varint, bool raw_values,
+      values_arena<Allocator> *arena = nullptr) {
+    const slz_size_type bitmap_vals =
+        deserialize_size(deserializer, varint, has_read_bytes<Deserializer>());
+    const slz_size_type bitmap_deleted_vals =
+        deserialize_size(deserializer, varint, has_read_bytes<Deserializer>());
+
+    using raw_capable =
+        std::integral_constant<bool, has_read_bytes<Deserializer>::value &&
+                                         is_raw_serializable<value_type>::value>;
+    return deserialize_compact_sparse_bucket(deserializer, bitmap_vals,
+                                             bitmap_deleted_vals, raw_values,
+                                             arena, raw_capable());
+  }
+
+  template <class Deserializer>
+  sparse_array deserialize_compact_sparse_bucket(
+      Deserializer &deserializer, slz_size_type bitmap_vals,
+      slz_size_type bitmap_deleted_vals, bool raw_values,
+      values_arena<Allocator> *arena, std::true_type /*raw_capable*/) {
+    if (raw_values) {
+      return sparse_array::deserialize_values(
+          deserializer, static_cast<Allocator &>(*this), bitmap_vals,
+          bitmap_deleted_vals, std::true_type(), arena);
+    }
+
+    return sparse_array::deserialize_values(
+        deserializer, static_cast<Allocator &>(*this), bitmap_vals,
+        bitmap_deleted_vals, std::false_type(), arena);
+  }
+
+  template <class Deserializer>
+  sparse_array deserialize_compact_sparse_bucket(
+      Deserializer &deserializer, slz_size_type bitmap_vals,
+      slz_size_type bitmap_deleted_vals, bool raw_values,
+      values_arena<Allocator> *arena, std::false_type /*raw_capable*/) {
+    tsl_sh_assert(!raw_values);
+    (void)raw_values;
+    return sparse_array::deserialize_values(
+        deserializer, static_cast<Allocator &>(*this), bitmap_vals,
+        bitmap_deleted_vals, std::false_type(), arena);
+  }
+
+  /**
+   * Deserialize the sparse buckets serialized by serialize_sparse_buckets.
+   * If `inserter` is nullptr, the deserialization is hash compatible and the
+   * sparse buckets are appended to m_sparse_buckets_data, with their values
+   * carved from m_values_arena if there is one, otherwise their values are
+   * inserted through `inserter`.
+   */
+  template <class Deserializer>
+  void deserialize_compact_sparse_buckets(
+      Deserializer &deserializer, slz_size_type nb_sparse_buckets, bool varint,
+      bool raw_values, deserialized_values_inserter *inserter) {
+    const bool hash_compatible = (inserter == nullptr);
+
+    slz_size_type ibucket = 0;
+    while (ibucket < nb_sparse_buckets) {
+      const slz_size_type nb_unused_sparse_buckets = deserialize_size(
+          deserializer, varint, has_read_bytes<Deserializer>());
+      if (nb_unused_sparse_buckets > nb_sparse_buckets - ibucket) {
+        TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                              "Deserialized number of unused sparse buckets "
+                              "is invalid.");
+      }
+
+      ibucket += nb_unused_sparse_buckets;
+      if (hash_compatible) {
+        m_sparse_buckets_data.resize(
+            m_sparse_buckets_data.size() +
+            static_cast<size_type>(nb_unused_sparse_buckets));
+      }
+
+      if (ibucket == nb_sparse_buckets) {
+        break;
+      }
+
+      sparse_array sarray = deserialize_compact_sparse_bucket(
+          deserializer, varint, raw_values,
+          hash_compatible ? m_values_arena.get() : nullptr);
+      if (hash_compatible) {
+        m_sparse_buckets_data.push_back(std::move(sarray));
+      } else {
+        insert_deserialized_values(std::move(sarray), *inserter);
+      }
+
+      ibucket++;
+    }
+  }
 
+  struct serialization_header {
+    slz_size_type flags;
+    bool compact;
+    bool varint;
+    bool raw_values;
+
+    slz_size_type bucket_count;
+    slz_size_type nb_sparse_buckets;
+    slz_size_type nb_elements;
+    slz_size_type nb_deleted_buckets;
+    float max_load_factor;
+    slz_size_type hash_seed;
+  };
+
+  /**
+   * Deserialize and check the header written by serialize_header.
+   */
+  template <class Deserializer>
+  serialization_header deserialize_header(Deserializer &deserializer) {
     const slz_size_type version =
         deserialize_value<slz_size_type>(deserializer);
-    // For now we only have one version of the serialization protocol.
-    // If it doesn't match there is a problem with the file.
-    if (version != SERIALIZATION_PROTOCOL_VERSION) {
+    if (version != 1 && version != SERIALIZATION_PROTOCOL_VERSION) {
       TSL_SH_THROW_OR_ABORT(std::runtime_error,
                             "Can't deserialize the sparse_map/set. The "
                             "protocol version header is invalid.");
     }
 
-    const slz_size_type bucket_count_ds =
-        deserialize_value<slz_size_type>(deserializer);
-    const slz_size_type nb_sparse_buckets =
-        deserialize_value<slz_size_type>(deserializer);
-    const slz_size_type nb_elements =
-        deserialize_value<slz_size_type>(deserializer);
-    const slz_size_type nb_deleted_buckets =
-        deserialize_value<slz_size_type>(deserializer);
-    const float max_load_factor = deserialize_value<float>(deserializer);
+    // The version 1 of the protocol has no flags.
+    const slz_size_type flags =
+        (version == 1) ? 0 : deserialize_value<slz_size_type>(deserializer);
+    if ((flags & ~(SERIALIZATION_FLAG_RAW_VALUES |
+                   SERIALIZATION_FLAG_COMPACT_SPARSE_BUCKETS |
+                   SERIALIZATION_FLAG_VARINT | SERIALIZATION_FLAG_DELTA |
+                   SERIALIZATION_FLAG_HASH_SEED)) != 0) {
+      TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                            "Can't deserialize the sparse_map/set. Unknown "
+                            "flags in the header.");
+    }
+
+    serialization_header header;
+    header.flags = flags;
+    header.compact = (flags & SERIALIZATION_FLAG_COMPACT_SPARSE_BUCKETS) != 0;
+    header.varint = (flags & SERIALIZATION_FLAG_VARINT) != 0;
+    header.raw_values = (flags & SERIALIZATION_FLAG_RAW_VALUES) != 0;
+
+    const bool compact = header.compact;
+    const bool varint = header.varint;
+    if ((varint && !compact) ||
+        (varint && !has_read_bytes<Deserializer>::value)) {
+      TSL_SH_THROW_OR_ABORT(
+          std::runtime_error,
+          "Can't deserialize the sparse_map/set. The sparse buckets were "
+          "serialized with varints, the deserializer must provide a "
+          "read_bytes method.");
+    }
+
+    if (header.raw_values) {
+      if (!has_read_bytes<Deserializer>::value ||
+          !is_raw_serializable<value_type>::value) {
+        TSL_SH_THROW_OR_ABORT(
+            std::runtime_error,
+            "Can't deserialize the sparse_map/set. The values were serialized "
+            "as raw bytes, the deserializer must provide a read_bytes method.");
+      }
+
+      const slz_size_type value_size =
+          deserialize_value<slz_size_type>(deserializer);
+      if (value_size != sizeof(value_type)) {
+        TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                              "Can't deserialize the sparse_map/set. The size "
+                              "of the serialized values doesn't match.");
+      }
+    }
+
+    header.bucket_count = deserialize_value<slz_size_type>(deserializer);
+    header.nb_sparse_buckets = deserialize_value<slz_size_type>(deserializer);
+    header.nb_elements = deserialize_value<slz_size_type>(deserializer);
+    header.nb_deleted_buckets = deserialize_value<slz_size_type>(deserializer);
+    header.max_load_factor = deserialize_value<float>(deserializer);
+    header.hash_seed = ((flags & SERIALIZATION_FLAG_HASH_SEED) != 0)
+                           ? deserialize_value<slz_size_type>(deserializer)
+                           : 0;
+
+    if ((flags & SERIALIZATION_FLAG_DELTA) != 0 && !compact) {
+      TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                            "Can't deserialize the sparse_map/set. A delta "
+                            "must use the compact sparse buckets.");
+    }
+
+    return header;
+  }
+
+  template <class Deserializer>
+  void deserialize_impl(Deserializer &deserializer, bool hash_compatible,
+                        std::size_t nb_threads, bool in_arena) {
+    tsl_sh_assert(
+        m_bucket_count == 0 &&
+        m_sparse_buckets_data.empty());  // Current hash table must be empty
+
+    const serialization_header header = deserialize_header(deserializer);
+    if ((header.flags & SERIALIZATION_FLAG_DELTA) != 0) {
+      TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                            "Can't deserialize the sparse_map/set. The stream "
+                            "is a delta, use apply_delta instead.");
+    }
+
+    const bool compact = header.compact;
+    const bool varint = header.varint;
+    const bool raw_values = header.raw_values;
+    const slz_size_type bucket_count_ds = header.bucket_count;
+    const slz_size_type nb_sparse_buckets = header.nb_sparse_buckets;
+    const slz_size_type nb_elements = header.nb_elements;
+    const slz_size_type nb_deleted_buckets = header.nb_deleted_buckets;
+    const float max_load_factor = header.max_load_factor;
 
     if (!hash_compatible) {
       this->max_load_factor(max_load_factor);
-      reserve(numeric_cast<size_type>(nb_elements,
-                                      "Deserialized nb_elements is too big."));
-      for (slz_size_type ibucket = 0; ibucket < nb_sparse_buckets; ibucket++) {
-        sparse_array::deserialize_values_into_sparse_hash(deserializer, *this);
+      const size_type nb_elements_insert = numeric_cast<size_type>(
+          nb_elements, "Deserialized nb_elements is too big.");
+      reserve(nb_elements_insert);
+
+      deserialized_values_inserter inserter(*this, nb_threads,
+                                            nb_elements_insert);
+      if (compact) {
+        deserialize_compact_sparse_buckets(deserializer, nb_sparse_buckets,
+                                           varint, raw_values, &inserter);
+      } else {
+        for (slz_size_type ibucket = 0; ibucket < nb_sparse_buckets;
+             ibucket++) {
+          deserialize_sparse_bucket_values(deserializer, raw_values, inserter);
+        }
       }
+      inserter.flush();
     } else {
       m_bucket_count = numeric_cast<size_type>(
           bucket_count_ds, "Deserialized bucket_count is too big.");
@@ -2155,13 +4958,33 @@ class sparse_hash : private Allocator,
           nb_elements, "Deserialized nb_elements is too big.");
       m_nb_deleted_buckets = numeric_cast<size_type>(
           nb_deleted_buckets, "Deserialized nb_deleted_buckets is too big.");
+      m_hash_seed = numeric_cast<std::size_t>(
+          header.hash_seed, "Deserialized hash_seed is too big.");
 
       m_sparse_buckets_data.reserve(numeric_cast<size_type>(
           nb_sparse_buckets, "Deserialized nb_sparse_buckets is too big."));
-      for (slz_size_type ibucket = 0; ibucket < nb_sparse_buckets; ibucket++) {
-        m_sparse_buckets_data.emplace_back(
-            sparse_array::deserialize_hash_compatible(
-                deserializer, static_cast<Allocator &>(*this)));
+      // Only the compact format gives the bitmaps of a sparse bucket before
+      // its values, the other formats keep one allocation per sparse bucket.
+      if (compact && in_arena && m_nb_elements > 0) {
+        if (m_nb_elements > m_bucket_count) {
+          TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                                "Deserialized nb_elements is invalid.");
+        }
+
+        m_values_arena = std::allocate_shared<values_arena<Allocator>>(
+            values_arena_allocator(static_cast<Allocator &>(*this)),
+            static_cast<Allocator &>(*this), m_nb_elements);
+      }
+
+      if (compact) {
+        deserialize_compact_sparse_buckets(deserializer, nb_sparse_buckets,
+                                           varint, raw_values, nullptr);
+      } else {
+        for (slz_size_type ibucket = 0; ibucket < nb_sparse_buckets;
+             ibucket++) {
+          m_sparse_buckets_data.emplace_back(
+              deserialize_sparse_bucket(deserializer, raw_values));
+        }
       }
 
       if (!m_sparse_buckets_data.empty()) {
@@ -2180,14 +5003,168 @@ class sparse_hash : private Allocator,
     }
   }
 
+  template <class Deserializer>
+  void apply_delta_impl(Deserializer &deserializer) {
+    const serialization_header header = deserialize_header(deserializer);
+    if ((header.flags & SERIALIZATION_FLAG_DELTA) == 0) {
+      TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                            "Can't apply the delta. The stream is not a "
+                            "delta.");
+    }
+
+    if (header.bucket_count == m_bucket_count &&
+        header.hash_seed == m_hash_seed) {
+      if (header.nb_sparse_buckets != m_sparse_buckets_data.size()) {
+        TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                              "Deserialized nb_sparse_buckets is invalid.");
+      }
+
+      apply_delta_sparse_buckets(deserializer, header, false);
+      return;
+    }
+
+    // The source hash table was rehashed, all its sparse buckets are dirty.
+    // Rebuild the hash table with the new bucket count and hash seed.
+    const size_type bucket_count = numeric_cast<size_type>(
+        header.bucket_count, "Deserialized bucket_count is too big.");
+    sparse_hash new_table(bucket_count, static_cast<Hash &>(*this),
+                          static_cast<KeyEqual &>(*this),
+                          static_cast<Allocator &>(*this),
+                          header.max_load_factor);
+    new_table.m_hash_seed = numeric_cast<std::size_t>(
+        header.hash_seed, "Deserialized hash_seed is too big.");
+    if (new_table.m_bucket_count != bucket_count) {
+      TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                            "The GrowthPolicy is not the same even though "
+                            "the delta requires hash compatibility.");
+    }
+    if (header.nb_sparse_buckets != new_table.m_sparse_buckets_data.size()) {
+      TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                            "Deserialized nb_sparse_buckets is invalid.");
+    }
+
+    new_table.apply_delta_sparse_buckets(deserializer, header, true);
+
+    new_table.structural_sharing(m_structural_sharing);
+    new_table.m_dirty_tracking = m_dirty_tracking;
+    new_table.m_rehash_observer = std::move(m_rehash_observer);
+    new_table.m_hash_quality = std::move(m_hash_quality);
+    new_table.swap(*this);
+  }
+
+  /**
+   * Replace the sparse buckets present in the delta. If `complete` is true,
+   * the delta must contain all the sparse buckets.
+   *
+   * The element counts are updated after each sparse bucket so that the hash
+   * table stays consistent if an exception is thrown. They are checked against
+   * the ones of the header at the end.
+   */
+  template <class Deserializer>
+  void apply_delta_sparse_buckets(Deserializer &deserializer,
+                                  const serialization_header &header,
+                                  bool complete) {
+    const std::size_t nb_sparse_buckets = m_sparse_buckets_data.size();
+
+    std::size_t ibucket = 0;
+    while (ibucket < nb_sparse_buckets) {
+      const slz_size_type nb_skipped_sparse_buckets = deserialize_size(
+          deserializer, header.varint, has_read_bytes<Deserializer>());
+      if (nb_skipped_sparse_buckets > nb_sparse_buckets - ibucket ||
+          (complete && nb_skipped_sparse_buckets != 0)) {
+        TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                              "Deserialized number of skipped sparse buckets "
+                              "is invalid.");
+      }
+
+      ibucket += static_cast<std::size_t>(nb_skipped_sparse_buckets);
+      if (ibucket == nb_sparse_buckets) {
+        break;
+      }
+
+      sparse_array sarray = deserialize_compact_sparse_bucket(
+          deserializer, header.varint, header.raw_values);
+      replace_sparse_bucket(ibucket, sarray);
+      tsl_sh_assert(sarray.capacity() == 0);
+
+      ibucket++;
+    }
+
+    this->max_load_factor(header.max_load_factor);
+    if (m_nb_elements != header.nb_elements ||
+        m_nb_deleted_buckets != header.nb_deleted_buckets) {
+      TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                            "The hash table doesn't match the delta. Check "
+                            "that the deltas are applied in order.");
+    }
+  }
+
+  /**
+   * Replace the sparse bucket `ibucket` by `sarray`, which is left empty.
+   */
+  void replace_sparse_bucket(std::size_t ibucket, sparse_array &sarray) {
+    sparse_bucket_refcount *refcount = nullptr;
+    if (m_structural_sharing && sarray.capacity() > 0) {
+      TSL_SH_TRY { refcount = create_sparse_bucket_refcount(); }
+      TSL_SH_CATCH(...) {
+        sarray.clear(static_cast<Allocator &>(*this));
+        TSL_SH_RETRHOW;
+      }
+    }
+
+    sparse_array &bucket = m_sparse_buckets_data[ibucket];
+    m_nb_elements -= bucket.size();
+    m_nb_deleted_buckets -= bucket.nb_deleted_buckets();
+    release_sparse_bucket(ibucket);
+
+    if (bucket.last()) {
+      sarray.set_as_last();
+    }
+    bucket.swap(sarray);
+    if (m_structural_sharing) {
+      m_sparse_buckets_refcounts[ibucket] = refcount;
+    }
+
+    m_nb_elements += bucket.size();
+    m_nb_deleted_buckets += bucket.nb_deleted_buckets();
+  }
+
  public:
   static const size_type DEFAULT_INIT_BUCKET_COUNT = 0;
   static constexpr float DEFAULT_MAX_LOAD_FACTOR = 0.5f;
 
   /**
    * Protocol version currenlty used for serialization.
+   *
+   * Version 2 adds a flags field after the version. If the
+   * SERIALIZATION_FLAG_RAW_VALUES flag is set, the size of value_type follows
+   * the flags and the values of each sparse bucket are serialized as one raw
+   * block of bytes. Version 1 streams can still be deserialized.
+   *
+   * With SERIALIZATION_FLAG_COMPACT_SPARSE_BUCKETS, the runs of unused sparse
+   * buckets are serialized as a single count and the size of a sparse bucket
+   * is deduced from its bitmap. With SERIALIZATION_FLAG_VARINT, these counts
+   * and the bitmaps are serialized as varints through `write_bytes`.
+   *
+   * A delta, flagged with SERIALIZATION_FLAG_DELTA, has the same format but
+   * skips the non dirty sparse buckets instead of the unused ones.
+   *
+   * With SERIALIZATION_FLAG_HASH_SEED, the seed mixed with the hashes to place
+   * the values follows the max_load_factor.
+   */
+  static const slz_size_type SERIALIZATION_PROTOCOL_VERSION = 2;
+
+  static const slz_size_type SERIALIZATION_FLAG_RAW_VALUES = 1;
+  static const slz_size_type SERIALIZATION_FLAG_COMPACT_SPARSE_BUCKETS = 2;
+  static const slz_size_type SERIALIZATION_FLAG_VARINT = 4;
+  static const slz_size_type SERIALIZATION_FLAG_DELTA = 8;
+  static const slz_size_type SERIALIZATION_FLAG_HASH_SEED = 16;
+
+  /**
+   * Number of values, per thread, buffered by a non hash compatible parallel
+   * deserialization before inserting them with parallel_insert.
    */
-  static const slz_size_type SERIALIZATION_PROTOCOL_VERSION = 1;
+  static const std::size_t PARALLEL_DESERIALIZATION_CHUNK_SIZE = 32768;
 
   /**
    * Return an always valid pointer to an static empty bucket_entry with
@@ -2212,6 +5189,20 @@ class sparse_hash : private Allocator,
    */
   sparse_array *m_sparse_buckets;
 
+  /**
+   * Reference count of the values of each sparse bucket when structural
+   * sharing is enabled, empty otherwise. A sparse bucket without an allocated
+   * capacity may have a nullptr reference count.
+   */
+  sparse_bucket_refcounts_container m_sparse_buckets_refcounts;
+
+  /**
+   * Storage of the values of the sparse buckets deserialized with
+   * `values_arena` set to true, nullptr otherwise. Shared with the copies
+   * sharing these sparse buckets, see `sparse_array::arena_values()`.
+   */
+  std::shared_ptr<values_arena<Allocator>> m_values_arena;
+
   size_type m_bucket_count;
   size_type m_nb_elements;
   size_type m_nb_deleted_buckets;
@@ -2228,6 +5219,40 @@ class sparse_hash : private Allocator,
    */
   size_type m_load_threshold_clear_deleted;
   float m_max_load_factor;
+
+  bool m_structural_sharing;
+
+  /**
+   * If true, the sparse buckets whose values may have been modified through
+   * an iterator are marked as dirty. See serialize_delta.
+   */
+  bool m_dirty_tracking;
+
+  /**
+   * Called before and after each rehash triggered by an insertion, may be
+   * empty.
+   */
+  tsl::sh::rehash_observer m_rehash_observer;
+
+  tsl::sh::hash_quality_monitor m_hash_quality;
+
+  /**
+   * Seed mixed with the hashes by `bucket_for_hash`, 0 if the hashes are used
+   * as they are. The position of the values depends on it, it's thus copied,
+   * moved and serialized with them.
+   */
+  std::size_t m_hash_seed;
+
+  /**
+   * Current window of the hash quality monitor.
+   */
+  std::size_t m_hash_quality_nb_insertions;
+  std::size_t m_hash_quality_nb_samples;
+  std::size_t m_hash_quality_nb_probes;
+
+#ifdef TSL_SH_STATS
+  mutable probe_stats_recorder m_stats;
+#endif
 };
 
 }  // namespace detail_sparse_hash
@@ -26,6 +26,7 @@
 
 #include <cstddef>
 #include <functional>
+#include <future>
 #include <initializer_list>
 #include <memory>
 #include <type_traits>
@@ -78,6 +79,8 @@ namespace tsl {
  *  - insert, emplace, emplace_hint, operator[]: if there is an effective
  * insert, invalidate the iterators.
  *  - erase: always invalidate the iterators.
+ *  - copy of the map when structural sharing is enabled: invalidate the
+ * iterators of the source map for modifying values through `value()`.
  */
 template <class Key, class T, class Hash = std::hash<Key>,
           class KeyEqual = std::equal_to<Key>,
@@ -138,6 +141,8 @@ class sparse_map {
   using const_pointer = typename ht::const_pointer;
   using iterator = typename ht::iterator;
   using const_iterator = typename ht::const_iterator;
+  using node_type = typename ht::node_handle;
+  using insert_return_type = typename ht::insert_return_type;
 
  public:
   /*
@@ -209,7 +214,7 @@ class sparse_map {
   /*
    * Iterators
    */
-  iterator begin() noexcept { return m_ht.begin(); }
+  iterator begin() { return m_ht.begin(); }
   const_iterator begin() const noexcept { return m_ht.begin(); }
   const_iterator cbegin() const noexcept { return m_ht.cbegin(); }
 
@@ -266,6 +271,29 @@ class sparse_map {
     m_ht.insert(ilist.begin(), ilist.end());
   }
 
+  /**
+   * Same as `insert(first, last)` but the values are inserted by `nb_threads`
+   * threads (the calling thread included). `RandomIt` must be a random access
+   * iterator. If `nb_threads` is lower than 2, it's equivalent to
+   * `insert(first, last)`.
+   *
+   * The map first reserves enough space for all the values. The keys are
+   * then hashed in parallel and partitioned by group of buckets, each thread
+   * inserts the values of a contiguous range of groups without any locking.
+   * The values whose probing would leave the range of their thread are
+   * inserted afterwards by the calling thread. It temporarily needs about two
+   * words of memory per value in the range.
+   *
+   * The hash function, the key equal function and the allocator must be
+   * callable concurrently from multiple threads. If an exception is thrown by
+   * one of the threads, it's rethrown in the calling thread once all the
+   * threads are done. The values already inserted stay in the map.
+   */
+  template <class RandomIt>
+  void parallel_insert(RandomIt first, RandomIt last, std::size_t nb_threads) {
+    m_ht.parallel_insert(first, last, nb_threads);
+  }
+
   template <class M>
   std::pair<iterator, bool> insert_or_assign(const key_type &k, M &&obj) {
     return m_ht.insert_or_assign(k, std::forward<M>(obj));
@@ -331,6 +359,59 @@ class sparse_map {
                                  std::forward<Args>(args)...);
   }
 
+  /**
+   * Same as `try_emplace(k)` but the mapped value is constructed from the
+   * result of `factory()`, which is only called if the key is not already
+   * present. The key is hashed and the buckets are probed only once.
+   *
+   * The `factory` parameter must be a function object supporting the call
+   * `T operator()();` (or returning any type `T` can be constructed from).
+   */
+  template <class Factory>
+  std::pair<iterator, bool> try_emplace_lazy(const key_type &k,
+                                             Factory &&factory) {
+    return m_ht.try_emplace_lazy(k, std::forward<Factory>(factory));
+  }
+
+  /**
+   * @copydoc try_emplace_lazy(const key_type& k, Factory&& factory)
+   */
+  template <class Factory>
+  std::pair<iterator, bool> try_emplace_lazy(key_type &&k, Factory &&factory) {
+    return m_ht.try_emplace_lazy(std::move(k), std::forward<Factory>(factory));
+  }
+
+  /**
+   * If the key is not present, insert it with a mapped value constructed from
+   * the result of `on_insert()`. Otherwise call `on_update(value)` with a
+   * mutable reference to the mapped value of the key. The key is hashed and
+   * the buckets are probed only once, the first deleted bucket found during
+   * the probing being reused for the insertion as with `insert`.
+   *
+   * Return a pair with an iterator to the value of the key and a bool which is
+   * true if the key was inserted.
+   *
+   * Useful for counters and aggregates:
+   * `map.upsert(key, [] { return 1; }, [](int& count) { count++; });`
+   */
+  template <class OnInsert, class OnUpdate>
+  std::pair<iterator, bool> upsert(const key_type &k, OnInsert &&on_insert,
+                                   OnUpdate &&on_update) {
+    return m_ht.upsert(k, std::forward<OnInsert>(on_insert),
+                       std::forward<OnUpdate>(on_update));
+  }
+
+  /**
+   * @copydoc upsert(const key_type& k, OnInsert&& on_insert, OnUpdate&&
+   * on_update)
+   */
+  template <class OnInsert, class OnUpdate>
+  std::pair<iterator, bool> upsert(key_type &&k, OnInsert &&on_insert,
+                                   OnUpdate &&on_update) {
+    return m_ht.upsert(std::move(k), std::forward<OnInsert>(on_insert),
+                       std::forward<OnUpdate>(on_update));
+  }
+
   iterator erase(iterator pos) { return m_ht.erase(pos); }
   iterator erase(const_iterator pos) { return m_ht.erase(pos); }
   iterator erase(const_iterator first, const_iterator last) {
@@ -375,8 +456,112 @@ class sparse_map {
     return m_ht.erase(key, precalculated_hash);
   }
 
+  /**
+   * Remove the value with the key equivalent to `key` from the map and
+   * return it in a node. Return an empty node if there is no such value.
+   *
+   * The node stores the hash of the key. Inserting it in a map with
+   * `insert(node_type&&)` thus doesn't need to hash the key again, the hash
+   * functions of both maps must return the same hashes. The node gives
+   * access to the value through `key()` and `mapped()`.
+   *
+   * As with `erase`, the bucket of the value is marked as deleted.
+   */
+  node_type extract(const key_type &key) { return m_ht.extract(key); }
+
+  /**
+   * @copydoc extract(const key_type& key)
+   *
+   * Use the hash value `precalculated_hash` instead of hashing the key. The
+   * hash value should be the same as `hash_function()(key)`, otherwise the
+   * behaviour is undefined. Useful to speed-up the lookup if you already have
+   * the hash.
+   */
+  node_type extract(const key_type &key, std::size_t precalculated_hash) {
+    return m_ht.extract(key, precalculated_hash);
+  }
+
+  /**
+   * Remove the value pointed by `pos` from the map and return it in a node.
+   */
+  node_type extract(const_iterator pos) { return m_ht.extract(pos); }
+
+  /**
+   * Insert the value of `node`, if the map doesn't already contain a value
+   * with an equivalent key, without hashing the key again.
+   *
+   * Return an `insert_return_type` where `position` points to the inserted
+   * value or to the value that prevented the insertion, `inserted` tells if
+   * the insertion took place and `node` is empty if the value was inserted or
+   * holds the value of the `node` parameter otherwise. If `node` is empty,
+   * nothing is done and `position` is `end()`.
+   */
+  insert_return_type insert(node_type &&node) {
+    return m_ht.insert(std::move(node));
+  }
+
+  /**
+   * Same as `insert(node_type&& node)` but only return the position. The
+   * value of `node` is left in `node` if it could not be inserted. The hint
+   * is ignored.
+   */
+  iterator insert(const_iterator /*hint*/, node_type &&node) {
+    auto result = m_ht.insert(std::move(node));
+    if (!result.inserted) {
+      node = std::move(result.node);
+    }
+
+    return result.position;
+  }
+
   void swap(sparse_map &other) { other.m_ht.swap(m_ht); }
 
+  /**
+   * Insert all the values of `other` in the map, the values with a key
+   * already present in the map are not inserted (as with `insert`). The
+   * values are moved from `other`, which is empty after the call.
+   *
+   * If both maps have the same bucket count (after reserving enough space
+   * in this map for the values of `other`), which is the case for maps
+   * created with the same `reserve` or `rehash` and filled without growing
+   * above it, the values of `other` which are in their initial bucket and
+   * whose bucket is free in this map are moved directly in the same bucket,
+   * group of buckets by group of buckets with one allocation per group. Only
+   * the other values go through the normal insertion. The keys are still
+   * hashed once to check their initial bucket.
+   *
+   * If an exception is thrown, both maps stay valid but some values of
+   * `other` may be in a moved-from state.
+   */
+  void merge(sparse_map &&other) { m_ht.merge(std::move(other.m_ht)); }
+
+  /**
+   * Same as `merge(sparse_map&& other)` but the values are copied from `other`,
+   * which is left untouched.
+   */
+  void merge(const sparse_map &other) { m_ht.merge(other.m_ht); }
+
+  /**
+   * Call `function(value)` for each value of the map, using `nb_threads`
+   * threads (the calling thread included). The groups of buckets are split in
+   * `nb_threads` contiguous ranges of similar size and each thread iterates
+   * over its range. If `nb_threads` is lower than 2, all the values are
+   * iterated in the calling thread.
+   *
+   * The `function` parameter must be a function object supporting the call
+   * `void operator()(const value_type& value) const;`. It's called
+   * concurrently from multiple threads and must thus be thread-safe. The map
+   * must not be modified during the call.
+   *
+   * If an exception is thrown by one of the threads, it's rethrown in the
+   * calling thread once all the threads are done.
+   */
+  template <class Function>
+  void for_each_parallel(const Function &function,
+                         std::size_t nb_threads) const {
+    m_ht.for_each_parallel(function, nb_threads);
+  }
+
   /*
    * Lookup
    */
@@ -692,6 +877,167 @@ class sparse_map {
   void rehash(size_type count) { m_ht.rehash(count); }
   void reserve(size_type count) { m_ht.reserve(count); }
 
+  /**
+   * Same as `rehash(count)` but the values are redistributed in the new
+   * buckets by `nb_threads` threads (the calling thread included). If
+   * `nb_threads` is lower than 2 or the map is empty, it's equivalent to
+   * `rehash(count)`.
+   *
+   * The new buckets are split in `nb_threads` ranges, each thread inserts the
+   * values that hash in its range. The values whose probing would leave the
+   * range are inserted afterwards by the calling thread. It temporarily needs
+   * about two words of memory per element.
+   *
+   * The hash function and the allocator must be callable concurrently from
+   * multiple threads. If an exception is thrown by one of the threads, it's
+   * rethrown in the calling thread once all the threads are done, with the
+   * same exception guarantee as `rehash`.
+   */
+  void parallel_rehash(size_type count, std::size_t nb_threads) {
+    m_ht.parallel_rehash(count, nb_threads);
+  }
+
+  /**
+   * Return the breakdown of the memory allocated by the map: the groups of
+   * buckets, the values, the unused capacity of the groups and the number of
+   * buckets marked as deleted. Runs in O(bucket_count / 64).
+   *
+   * The memory allocated by the values themselves (e.g. the buffer of a
+   * `std::string`) is not included. With structural sharing, the values
+   * shared with other maps are counted in each of them.
+   */
+  tsl::sh::memory_usage_info memory_usage() const noexcept {
+    return m_ht.memory_usage();
+  }
+
+  /**
+   * Return the histograms of the number of values and of the capacity of the
+   * groups of buckets of the map, and the distribution of the sizes of the
+   * allocations of the values of the groups. Runs in O(bucket_count / 64).
+   *
+   * A group grows its capacity by a step depending on the `Sparsity` when it's
+   * full. The report shows the slack left by these steps and the allocation
+   * sizes an allocator would see, to pick a `Sparsity` or to configure the
+   * size classes of an allocator.
+   */
+  tsl::sh::group_occupancy_info group_occupancy() const {
+    return m_ht.group_occupancy();
+  }
+
+#ifdef TSL_SH_STATS
+  /**
+   * Return the statistics on the probing done by the lookups, insertions and
+   * erasures since the construction of the map or the last call to
+   * `reset_stats`: histogram of the number of probes per operation, number of
+   * buckets marked as deleted crossed and number of key comparisons.
+   *
+   * Only available if `TSL_SH_STATS` is defined before the inclusion of the
+   * header, in all the translation units. A long average probing with few
+   * deleted buckets hints at a bad hash function, while a high number of
+   * deleted buckets crossed calls for a `rehash`.
+   *
+   * The statistics belong to the map object, a copy or a move starts with
+   * empty ones and a `swap` doesn't exchange them. Concurrent lookups may miss some counts.
+   */
+  tsl::sh::probe_stats stats() const noexcept { return m_ht.stats(); }
+
+  void reset_stats() noexcept { m_ht.reset_stats(); }
+#endif
+
+  /**
+   * Set the function called before and after each rehash triggered by an
+   * insertion (`insert`, `emplace`, `operator[]`, `parallel_insert`, `merge`,
+   * ...), when the map grows or when it clears the buckets marked as deleted.
+   * An explicit call to `rehash` or `reserve` doesn't call it. The observer
+   * receives a `tsl::sh::rehash_event` with the bucket counts, the number of
+   * elements and of deleted buckets and, after the rehash, its duration.
+   *
+   * Useful to attribute latency spikes to the growth of a map and to find the
+   * maps worth a `reserve`. The observer must not modify the map. An empty
+   * function removes the observer. The observer is copied with the map.
+   */
+  void rehash_observer(tsl::sh::rehash_observer observer) {
+    m_ht.rehash_observer(std::move(observer));
+  }
+
+  const tsl::sh::rehash_observer &rehash_observer() const noexcept {
+    return m_ht.rehash_observer();
+  }
+
+  /**
+   * Set the monitor of the quality of the hash function (disabled by
+   * default). The monitor samples the number of buckets probed by the
+   * insertions of new keys and, when the average of a window of samples
+   * exceeds `monitor.max_average_probes`, calls `monitor.observer` with a
+   * `tsl::sh::hash_quality_event`. A bad hash function, e.g. one which only
+   * varies in its high bits with the `power_of_two_growth_policy`, otherwise
+   * silently degrades the map to long probings.
+   *
+   * If `monitor.reseed` is true, the first bad window also switches the map
+   * to mixing the hashes with a random seed before mapping them to a bucket,
+   * and rehashes it (reported to the rehash observer as
+   * `tsl::sh::rehash_reason::reseed`). The `Hash` function itself and the
+   * precalculated hashes given to the lookups don't change. Reseeding can't
+   * help keys whose hashes are equal, the later bad windows are only
+   * reported.
+   *
+   * The monitor is copied with the map. When disabled, it costs one
+   * comparison per insertion of a new key.
+   */
+  void hash_quality_monitor(tsl::sh::hash_quality_monitor monitor) {
+    m_ht.hash_quality_monitor(std::move(monitor));
+  }
+
+  const tsl::sh::hash_quality_monitor &hash_quality_monitor() const noexcept {
+    return m_ht.hash_quality_monitor();
+  }
+
+  /**
+   * Seed mixed with the hashes since the hash quality monitor reseeded the
+   * map, 0 if the hashes are used as they are. The seed is kept by the
+   * copies and by the hash compatible serialization of the map.
+   */
+  std::size_t hash_seed() const noexcept { return m_ht.hash_seed(); }
+
+  /**
+   * Enable or disable the structural sharing of the map (disabled by default).
+   *
+   * When enabled, copying the map doesn't copy the stored key-values. The
+   * buckets of the map are stored in groups of 64 buckets (32 on 32 bits
+   * platforms) and the key-values of each group are shared, through an atomic
+   * reference count, between the map and its copies. A copy thus only costs
+   * O(bucket_count / 64). A group is cloned the first time one of the maps
+   * sharing it modifies it or returns something that allows to modify it
+   * (`find`, `at`, `operator[]`, `insert` of an existing key, non-const
+   * `begin`, ...), the other groups stay shared.
+   *
+   * The copies of a map with structural sharing enabled also have it enabled.
+   * The values are only shared if the allocators compare equal, they are
+   * copied otherwise.
+   *
+   * Disabling the structural sharing clones the groups that are still shared.
+   */
+  void structural_sharing(bool enable) { m_ht.structural_sharing(enable); }
+  bool structural_sharing() const noexcept { return m_ht.structural_sharing(); }
+
+  /**
+   * Enable or disable the tracking of the modified groups of buckets (disabled
+   * by default), needed by `serialize_delta`.
+   *
+   * The buckets of the map are stored in groups of 64 buckets (32 on 32 bits
+   * platforms). When enabled, each group modified by an insertion or an
+   * erasure is marked as dirty. As the mapped values can be modified through an
+   * iterator, the groups pointed by the iterators returned by `find`, `at`,
+   * `operator[]`, `insert` of an existing key, ... are also marked as dirty,
+   * and all the groups on a call to the non-const `begin`. Iterate over a
+   * const reference to the map to avoid it. Enabling the tracking marks all the
+   * groups as dirty.
+   *
+   * The copies of a map with dirty tracking enabled also have it enabled.
+   */
+  void dirty_tracking(bool enable) noexcept { m_ht.dirty_tracking(enable); }
+  bool dirty_tracking() const noexcept { return m_ht.dirty_tracking(); }
+
   /*
    * Observers
    */
@@ -717,6 +1063,17 @@ class sparse_map {
    *  - `template<typename U> void operator()(const U& value);` where the types
    * `std::uint64_t`, `float` and `std::pair<Key, T>` must be supported for U.
    *
+   * The groups of buckets without any value or deleted bucket are not
+   * serialized individually, each run of them is serialized as a count.
+   *
+   * If the serializer also provides a `void write_bytes(const void* data,
+   * std::size_t size);` method, these counts and the bitmaps of the groups are
+   * written as varints through it. If, in addition, `value_type` is trivially
+   * copyable, the values of each group of buckets are written as one raw block
+   * of bytes instead of one call per value. Such a stream can only be read back
+   * with a deserializer providing `read_bytes`, on a platform with the same
+   * `sizeof(value_type)`.
+   *
    * The implementation leaves binary compatibility (endianness, IEEE 754 for
    * floats, ...) of the types it serializes in the hands of the `Serializer`
    * function object if compatibility is required.
@@ -734,6 +1091,8 @@ class sparse_map {
    * following calls:
    *  - `template<typename U> U operator()();` where the types `std::uint64_t`,
    * `float` and `std::pair<Key, T>` must be supported for U.
+   *  - `void read_bytes(void* data, std::size_t size);`, optional, only
+   * needed to read a stream written by a serializer with `write_bytes`.
    *
    * If the deserialized hash map type is hash compatible with the serialized
    * map, the deserialization process can be sped up by setting
@@ -759,6 +1118,115 @@ class sparse_map {
     return map;
   }
 
+  /**
+   * Same as `deserialize(deserializer, hash_compatible)` but, if
+   * `hash_compatible` is false, the deserialized values are inserted by
+   * `nb_threads` threads (the calling thread included).
+   *
+   * The `deserializer` is only called by the calling thread. The values are
+   * read by chunks of `nb_threads * 32768` values, each chunk being then
+   * inserted with `parallel_insert`. The hash function, the key equal
+   * function and the allocator must thus be callable concurrently from
+   * multiple threads.
+   *
+   * A hash compatible deserialization doesn't need to hash the values,
+   * `nb_threads` is ignored if `hash_compatible` is true.
+   */
+  template <class Deserializer>
+  static sparse_map deserialize(Deserializer &deserializer,
+                                bool hash_compatible, std::size_t nb_threads) {
+    sparse_map map(0);
+    map.m_ht.deserialize(deserializer, hash_compatible, nb_threads);
+
+    return map;
+  }
+
+  /**
+   * Same as `deserialize(deserializer, true)` but the values of all the groups
+   * of buckets are stored in one block of `size()` values allocated at once,
+   * instead of one allocation per group. The restore is then a near
+   * sequential fill of this block and freeing the map does a single
+   * deallocation. Suited to a read-mostly map restored once and then served.
+   *
+   * The block is only used for a stream serialized in the compact format,
+   * the default, otherwise the behaviour is the same as
+   * `deserialize(deserializer, true)`. The values of a group move out of the
+   * block on the first insertion or erasure in the group. The block itself is
+   * freed on `clear`, on a rehash or on destruction of the map, once no copy
+   * sharing its groups through structural sharing remains.
+   */
+  template <class Deserializer>
+  static sparse_map deserialize_in_arena(Deserializer &deserializer) {
+    sparse_map map(0);
+    map.m_ht.deserialize_in_arena(deserializer);
+
+    return map;
+  }
+
+  /**
+   * Serialize the groups of buckets marked as dirty since the previous call
+   * to `serialize_delta`, or since the dirty tracking was enabled, and mark
+   * them as clean. The dirty tracking must be enabled, std::logic_error is
+   * thrown otherwise. The `serializer` has the same requirements as in
+   * `serialize`.
+   *
+   * Along the groups, the delta contains the bucket count, the number of
+   * elements and the maximum load factor of the map. A rehash marks all the
+   * groups as dirty, the delta following a rehash thus contains the whole
+   * map, as does the first delta after enabling the dirty tracking.
+   *
+   * If an exception is thrown, the groups stay dirty.
+   */
+  template <class Serializer>
+  void serialize_delta(Serializer &serializer) {
+    m_ht.serialize_delta(serializer);
+  }
+
+  /**
+   * Apply a delta produced by `serialize_delta` on this map, replacing each
+   * group of buckets present in the delta. The `deserializer` has the same
+   * requirements as in `deserialize`.
+   *
+   * The map must be hash compatible (see `deserialize`) with the map that
+   * produced the delta, and must be in the same state as this map was when
+   * its previous delta was serialized. As the first delta contains the whole
+   * map, applying all the deltas in order on an empty map gives back the
+   * source map.
+   *
+   * The behaviour is undefined if these criteria are not met, but a mismatch
+   * of the bucket count or of the number of elements after the delta throws
+   * a std::runtime_error. If an exception is thrown, the map stays in a
+   * valid state with a part of the delta applied.
+   */
+  template <class Deserializer>
+  void apply_delta(Deserializer &deserializer) {
+    m_ht.apply_delta(deserializer);
+  }
+
+  /**
+   * Serialize the map through `serializer` in a background thread while this
+   * map stays usable, and return a future that becomes ready once the
+   * serialization is done (rethrowing its exception if any). The
+   * `serializer` has the same requirements as in `serialize`. It must stay
+   * valid until the future is ready and must not be used meanwhile.
+   *
+   * The structural sharing must be enabled, std::logic_error is thrown
+   * otherwise. The map is copied in the calling thread at the time of the
+   * call, which only costs O(bucket_count / 64) thanks to the structural
+   * sharing, and the copy is serialized in the background thread. The
+   * modifications done on the map meanwhile are not part of the snapshot:
+   * as with any structurally shared copy, the first modification of a group
+   * still shared with the snapshot clones the group. The hash function and
+   * the allocator must be usable from the background thread.
+   *
+   * As with any future returned by `std::async`, the destructor of the
+   * returned future waits for the end of the serialization.
+   */
+  template <class Serializer>
+  std::future<void> snapshot_async(Serializer &serializer) const {
+    return m_ht.snapshot_async(serializer);
+  }
+
   friend bool operator==(const sparse_map &lhs, const sparse_map &rhs) {
     if (lhs.size() != rhs.size()) {
       return false;
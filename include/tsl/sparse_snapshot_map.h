@@ -0,0 +1,165 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2017 Thibaut Goetghebuer-Planchon <tessil@gmx.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef TSL_SPARSE_SNAPSHOT_MAP_H
+#define TSL_SPARSE_SNAPSHOT_MAP_H
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include "sparse_map.h"
+
+namespace tsl {
+
+/**
+ * Read-mostly wrapper around `tsl::sparse_map` for tables that are read far
+ * more often than they are written (configuration tables, routing tables,
+ * ...).
+ *
+ * The wrapper always holds an immutable version of the map. Readers acquire
+ * this version through `snapshot()` and can then do as many lookups as they
+ * want on it without any synchronization: the returned map is never modified
+ * and stays alive as long as a reader holds it. Writers build the next version
+ * of the map from a copy of the current one in `update` and publish it
+ * atomically once the modifications are done. Writers are serialized between
+ * them but never block the readers.
+ *
+ * The stored maps have structural sharing enabled (see
+ * `tsl::sparse_map::structural_sharing`). The copy done by a writer thus only
+ * copies the array of groups of buckets, and only the groups modified by the
+ * writer are cloned. The other groups stay shared between the versions.
+ *
+ * The lifetime of each version is managed by the reference count of the
+ * `std::shared_ptr` returned by `snapshot()`, an old version is freed as soon
+ * as the last reader holding it releases its snapshot. Acquiring a snapshot
+ * costs an atomic operation, it's thus advised to keep the snapshot for a
+ * batch of lookups instead of calling `snapshot()` before each lookup.
+ *
+ * The template parameters have the same meaning as in `tsl::sparse_map`.
+ */
+template <class Key, class T, class Hash = std::hash<Key>,
+          class KeyEqual = std::equal_to<Key>,
+          class Allocator = std::allocator<std::pair<Key, T>>,
+          class GrowthPolicy = tsl::sh::power_of_two_growth_policy<2>,
+          tsl::sh::exception_safety ExceptionSafety =
+              tsl::sh::exception_safety::basic,
+          tsl::sh::sparsity Sparsity = tsl::sh::sparsity::medium>
+class sparse_snapshot_map {
+ public:
+  using map_type = tsl::sparse_map<Key, T, Hash, KeyEqual, Allocator,
+                                   GrowthPolicy, ExceptionSafety, Sparsity>;
+  using snapshot_type = std::shared_ptr<const map_type>;
+  using key_type = typename map_type::key_type;
+  using mapped_type = typename map_type::mapped_type;
+  using value_type = typename map_type::value_type;
+  using size_type = typename map_type::size_type;
+
+ public:
+  sparse_snapshot_map() : sparse_snapshot_map(map_type()) {}
+
+  explicit sparse_snapshot_map(map_type map)
+      : m_current(make_snapshot(std::move(map))) {}
+
+  sparse_snapshot_map(const sparse_snapshot_map &) = delete;
+  sparse_snapshot_map &operator=(const sparse_snapshot_map &) = delete;
+
+  /**
+   * Return the current version of the map. The returned map is immutable and
+   * will not be affected by subsequent calls to `update` or `assign`.
+   */
+  snapshot_type snapshot() const { return load(); }
+
+  /**
+   * Copy the current version of the map, call `modifier(map)` with a mutable
+   * reference to the copy and publish the result as the new current version.
+   *
+   * The `modifier` parameter must be a function object that supports the call
+   * `void operator()(map_type& map);`. If it throws, nothing is published.
+   *
+   * Readers that acquired a snapshot before the publication keep on seeing the
+   * old version.
+   */
+  template <class Modifier>
+  void update(Modifier &&modifier) {
+    std::lock_guard<std::mutex> lock(m_writers_mutex);
+
+    std::shared_ptr<map_type> next = std::make_shared<map_type>(*load());
+    modifier(*next);
+
+    store(std::move(next));
+  }
+
+  /**
+   * Replace the current version of the map by `map`.
+   */
+  void assign(map_type map) {
+    snapshot_type snapshot = make_snapshot(std::move(map));
+
+    std::lock_guard<std::mutex> lock(m_writers_mutex);
+    store(std::move(snapshot));
+  }
+
+  /**
+   * Number of elements in the current version of the map.
+   */
+  size_type size() const { return load()->size(); }
+
+ private:
+  static snapshot_type make_snapshot(map_type map) {
+    map.structural_sharing(true);
+    return std::make_shared<const map_type>(std::move(map));
+  }
+
+#if defined(__cpp_lib_atomic_shared_ptr)
+  snapshot_type load() const {
+    return m_current.load(std::memory_order_acquire);
+  }
+
+  void store(snapshot_type snapshot) {
+    m_current.store(std::move(snapshot), std::memory_order_release);
+  }
+
+  std::atomic<snapshot_type> m_current;
+#else
+  snapshot_type load() const {
+    return std::atomic_load_explicit(&m_current, std::memory_order_acquire);
+  }
+
+  void store(snapshot_type snapshot) {
+    std::atomic_store_explicit(&m_current, std::move(snapshot),
+                               std::memory_order_release);
+  }
+
+  snapshot_type m_current;
+#endif
+
+  std::mutex m_writers_mutex;
+};
+
+}  // end namespace tsl
+
+#endif
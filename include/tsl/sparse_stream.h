@@ -0,0 +1,1030 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2017 Thibaut Goetghebuer-Planchon <tessil@gmx.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef TSL_SPARSE_STREAM_H
+#define TSL_SPARSE_STREAM_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ios>
+#include <istream>
+#include <limits>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "sparse_hash.h"
+
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>  // For __crc32cd and __crc32cb
+#endif
+
+namespace tsl {
+
+namespace detail_crc32c {
+/**
+ * Define the crc32c method (Castagnoli polynomial, as used by iSCSI, ext4,
+ * ...) and pick-up the best implementation depending on the compiler and the
+ * CPU.
+ */
+
+inline const std::uint32_t *crc32c_table() {
+  struct table {
+    table() {
+      for (std::uint32_t i = 0; i < 256; i++) {
+        std::uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+          crc = (crc & 1) ? (crc >> 1) ^ 0x82F63B78u : crc >> 1;
+        }
+        values[i] = crc;
+      }
+    }
+
+    std::uint32_t values[256];
+  };
+
+  static const table crc_table;
+  return crc_table.values;
+}
+
+inline std::uint32_t fallback_crc32c(std::uint32_t crc, const void *data,
+                                     std::size_t size) {
+  const std::uint32_t *table = crc32c_table();
+  const unsigned char *bytes = static_cast<const unsigned char *>(data);
+
+  crc = ~crc;
+  for (std::size_t i = 0; i < size; i++) {
+    crc = table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+  }
+
+  return ~crc;
+}
+
+#if (defined(__clang__) || defined(__GNUC__)) && defined(__x86_64__)
+/**
+ * Check for SSE4.2 support at runtime so that the library doesn't need to be
+ * compiled with -msse4.2.
+ */
+inline bool has_crc32c_support() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse4.2") != 0;
+}
+
+__attribute__((target("sse4.2"))) inline std::uint32_t hardware_crc32c(
+    std::uint32_t crc, const void *data, std::size_t size) {
+  const unsigned char *bytes = static_cast<const unsigned char *>(data);
+
+  unsigned long long crc64 = ~crc;
+  for (; size >= sizeof(std::uint64_t); size -= sizeof(std::uint64_t)) {
+    unsigned long long word;
+    std::memcpy(&word, bytes, sizeof(word));
+    crc64 = __builtin_ia32_crc32di(crc64, word);
+    bytes += sizeof(std::uint64_t);
+  }
+
+  unsigned int crc32 = static_cast<unsigned int>(crc64);
+  for (; size > 0; size--) {
+    crc32 = __builtin_ia32_crc32qi(crc32, *bytes);
+    bytes++;
+  }
+
+  return ~static_cast<std::uint32_t>(crc32);
+}
+
+inline std::uint32_t crc32c(std::uint32_t crc, const void *data,
+                            std::size_t size) {
+  static const bool has_crc32c = has_crc32c_support();
+  return has_crc32c ? hardware_crc32c(crc, data, size)
+                    : fallback_crc32c(crc, data, size);
+}
+
+#elif defined(__ARM_FEATURE_CRC32)
+inline std::uint32_t crc32c(std::uint32_t crc, const void *data,
+                            std::size_t size) {
+  const unsigned char *bytes = static_cast<const unsigned char *>(data);
+
+  crc = ~crc;
+  for (; size >= sizeof(std::uint64_t); size -= sizeof(std::uint64_t)) {
+    std::uint64_t word;
+    std::memcpy(&word, bytes, sizeof(word));
+    crc = __crc32cd(crc, word);
+    bytes += sizeof(std::uint64_t);
+  }
+
+  for (; size > 0; size--) {
+    crc = __crc32cb(crc, *bytes);
+    bytes++;
+  }
+
+  return ~crc;
+}
+
+#elif defined(_MSC_VER) && defined(_M_X64)
+/**
+ * We need to check for SSE4.2 support at runtime on Windows with __cpuid
+ * See https://msdn.microsoft.com/en-us/library/hskdteyh.aspx
+ */
+inline bool has_crc32c_support() {
+  int cpu_infos[4];
+  __cpuid(cpu_infos, 1);
+  return (cpu_infos[2] & (1 << 20)) != 0;
+}
+
+inline std::uint32_t hardware_crc32c(std::uint32_t crc, const void *data,
+                                     std::size_t size) {
+  const unsigned char *bytes = static_cast<const unsigned char *>(data);
+
+  unsigned __int64 crc64 = ~crc;
+  for (; size >= sizeof(std::uint64_t); size -= sizeof(std::uint64_t)) {
+    unsigned __int64 word;
+    std::memcpy(&word, bytes, sizeof(word));
+    crc64 = _mm_crc32_u64(crc64, word);
+    bytes += sizeof(std::uint64_t);
+  }
+
+  unsigned int crc32 = static_cast<unsigned int>(crc64);
+  for (; size > 0; size--) {
+    crc32 = _mm_crc32_u8(crc32, *bytes);
+    bytes++;
+  }
+
+  return ~static_cast<std::uint32_t>(crc32);
+}
+
+inline std::uint32_t crc32c(std::uint32_t crc, const void *data,
+                            std::size_t size) {
+  static const bool has_crc32c = has_crc32c_support();
+  return has_crc32c ? hardware_crc32c(crc, data, size)
+                    : fallback_crc32c(crc, data, size);
+}
+
+#else
+inline std::uint32_t crc32c(std::uint32_t crc, const void *data,
+                            std::size_t size) {
+  return fallback_crc32c(crc, data, size);
+}
+
+#endif
+}  // namespace detail_crc32c
+
+namespace detail_sparse_stream {
+
+template <class U>
+struct is_pair : std::false_type {};
+
+template <class U, class V>
+struct is_pair<std::pair<U, V>> : std::true_type {};
+
+template <class U>
+struct is_basic_string : std::false_type {};
+
+template <class CharT, class Traits, class Alloc>
+struct is_basic_string<std::basic_string<CharT, Traits, Alloc>>
+    : std::true_type {};
+
+/**
+ * Serialize the supported values through the
+ * `void write_bytes(const void* data, std::size_t size)` method of `Derived`.
+ */
+template <class Derived>
+class value_serializer {
+ public:
+  template <class U>
+  void operator()(const U &value) {
+    serialize_impl(value);
+  }
+
+ private:
+  template <class U, typename std::enable_if<
+                         detail_sparse_hash::is_raw_serializable<U>::value>::
+                         type * = nullptr>
+  void serialize_impl(const U &value) {
+    derived().write_bytes(std::addressof(value), sizeof(U));
+  }
+
+  template <class U, class V,
+            typename std::enable_if<!detail_sparse_hash::is_raw_serializable<
+                std::pair<U, V>>::value>::type * = nullptr>
+  void serialize_impl(const std::pair<U, V> &value) {
+    serialize_impl(value.first);
+    serialize_impl(value.second);
+  }
+
+  template <class CharT, class Traits, class Alloc>
+  void serialize_impl(const std::basic_string<CharT, Traits, Alloc> &value) {
+    static_assert(std::is_trivially_copyable<CharT>::value,
+                  "The characters of the string must be trivially copyable.");
+
+    serialize_impl(static_cast<std::uint64_t>(value.size()));
+    derived().write_bytes(value.data(), value.size() * sizeof(CharT));
+  }
+
+  Derived &derived() { return static_cast<Derived &>(*this); }
+};
+
+/**
+ * Deserialize the supported values through the
+ * `void read_bytes(void* data, std::size_t size)` method of `Derived`.
+ */
+template <class Derived>
+class value_deserializer {
+ public:
+  template <class U>
+  U operator()() {
+    return deserialize_impl<U>();
+  }
+
+ private:
+  template <class U, typename std::enable_if<
+                         detail_sparse_hash::is_raw_serializable<U>::value>::
+                         type * = nullptr>
+  U deserialize_impl() {
+    U value;
+    derived().read_bytes(std::addressof(value), sizeof(U));
+
+    return value;
+  }
+
+  template <class U, typename std::enable_if<
+                         !detail_sparse_hash::is_raw_serializable<U>::value &&
+                         is_pair<U>::value>::type * = nullptr>
+  U deserialize_impl() {
+    auto first = deserialize_impl<typename U::first_type>();
+    return U(std::move(first), deserialize_impl<typename U::second_type>());
+  }
+
+  template <class U, typename std::enable_if<
+                         is_basic_string<U>::value>::type * = nullptr>
+  U deserialize_impl() {
+    using char_type = typename U::value_type;
+    static_assert(std::is_trivially_copyable<char_type>::value,
+                  "The characters of the string must be trivially copyable.");
+
+    const std::uint64_t size = deserialize_impl<std::uint64_t>();
+    if (size > std::numeric_limits<std::size_t>::max() / sizeof(char_type)) {
+      TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                            "Deserialized string size is too big.");
+    }
+
+    U value(static_cast<std::size_t>(size), char_type());
+    if (size > 0) {
+      derived().read_bytes(&value[0], value.size() * sizeof(char_type));
+    }
+
+    return value;
+  }
+
+  Derived &derived() { return static_cast<Derived &>(*this); }
+};
+
+inline void write_to_streambuf(std::streambuf &streambuf, const char *data,
+                               std::size_t size) {
+  while (size > 0) {
+    const std::size_t chunk_size = std::min<std::size_t>(
+        size,
+        static_cast<std::size_t>(std::numeric_limits<std::streamsize>::max()));
+    const std::streamsize written =
+        streambuf.sputn(data, static_cast<std::streamsize>(chunk_size));
+    if (written <= 0) {
+      TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                            "Couldn't write to the serialization stream.");
+    }
+
+    data += written;
+    size -= static_cast<std::size_t>(written);
+  }
+}
+
+inline void read_from_streambuf(std::streambuf &streambuf, char *data,
+                                std::size_t size) {
+  while (size > 0) {
+    const std::size_t chunk_size = std::min<std::size_t>(
+        size,
+        static_cast<std::size_t>(std::numeric_limits<std::streamsize>::max()));
+    const std::streamsize nb_read =
+        streambuf.sgetn(data, static_cast<std::streamsize>(chunk_size));
+    if (nb_read <= 0) {
+      TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                            "Unexpected end of the deserialization stream.");
+    }
+
+    data += nb_read;
+    size -= static_cast<std::size_t>(nb_read);
+  }
+}
+
+/**
+ * Layout of the checksummed format, see
+ * `tsl::sh::checksummed_stream_serializer`.
+ */
+struct checksummed_header {
+  char magic[8];
+  std::uint32_t endianness;
+  std::uint32_t version;
+  std::uint64_t block_size;
+};
+
+struct checksummed_block_header {
+  std::uint32_t size;
+  std::uint32_t crc;
+};
+
+struct checksummed_footer {
+  std::uint64_t index_offset;
+  std::uint64_t nb_blocks;
+  std::uint32_t index_crc;
+  std::uint32_t endianness;
+  char magic[8];
+};
+
+static_assert(sizeof(checksummed_header) == 24 &&
+                  sizeof(checksummed_block_header) == 8 &&
+                  sizeof(checksummed_footer) == 32,
+              "Unexpected padding in the checksummed format structures.");
+
+static const std::uint32_t CHECKSUMMED_VERSION = 1;
+static const std::uint32_t CHECKSUMMED_ENDIANNESS_MARKER = 0x01020304;
+static const std::uint64_t CHECKSUMMED_MAX_BLOCK_SIZE = std::uint64_t(1) << 30;
+
+inline const char *checksummed_header_magic() noexcept { return "TSLCKSUM"; }
+inline const char *checksummed_footer_magic() noexcept { return "TSLCKIDX"; }
+
+/**
+ * Check the header and return the block size.
+ */
+inline std::size_t check_checksummed_header(const checksummed_header &header) {
+  if (std::memcmp(header.magic, checksummed_header_magic(),
+                  sizeof(header.magic)) != 0) {
+    TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                          "The data is not a checksummed stream.");
+  }
+
+  if (header.endianness != CHECKSUMMED_ENDIANNESS_MARKER ||
+      header.version != CHECKSUMMED_VERSION) {
+    TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                          "The checksummed stream was created with an "
+                          "incompatible format or platform.");
+  }
+
+  if (header.block_size == 0 ||
+      header.block_size > CHECKSUMMED_MAX_BLOCK_SIZE) {
+    TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                          "The checksummed stream is corrupted.");
+  }
+
+  return static_cast<std::size_t>(header.block_size);
+}
+}  // namespace detail_sparse_stream
+
+namespace sh {
+
+/**
+ * Buffered serializer over a `std::ostream` (or directly a `std::streambuf`)
+ * to use with the `serialize` methods of `tsl::sparse_map` and
+ * `tsl::sparse_set`.
+ *
+ * The small writes done by the serialization are accumulated in a buffer of
+ * `buffer_size` bytes and handed to the stream buffer in large blocks. Writes
+ * larger than the buffer, like the raw blocks of values, go directly to the
+ * stream buffer. The serializer provides `write_bytes`, the trivially
+ * copyable values are thus serialized as raw blocks and the sizes as varints.
+ *
+ * Supported values are the trivially copyable types, `std::pair` of supported
+ * types and `std::basic_string` of trivially copyable characters (written as
+ * a 64-bits size followed by the characters). Like the rest of the
+ * serialization, the bytes are written in the native representation of the
+ * platform.
+ *
+ * `flush()` must be called once the serialization is done, the destructor
+ * only does a best effort flush which ignores the errors. Throw
+ * `std::runtime_error` if the stream refuses some bytes.
+ */
+class stream_serializer
+    : public detail_sparse_stream::value_serializer<stream_serializer> {
+ public:
+  static const std::size_t DEFAULT_BUFFER_SIZE = 1024 * 1024;
+
+  explicit stream_serializer(std::ostream &ostream,
+                             std::size_t buffer_size = DEFAULT_BUFFER_SIZE)
+      : stream_serializer(*ostream.rdbuf(), buffer_size) {}
+
+  explicit stream_serializer(std::streambuf &streambuf,
+                             std::size_t buffer_size = DEFAULT_BUFFER_SIZE)
+      : m_streambuf(streambuf),
+        m_buffer(new char[std::max<std::size_t>(buffer_size, 1)]),
+        m_buffer_size(std::max<std::size_t>(buffer_size, 1)),
+        m_buffer_pos(0) {}
+
+  stream_serializer(const stream_serializer &) = delete;
+  stream_serializer &operator=(const stream_serializer &) = delete;
+
+  ~stream_serializer() {
+    TSL_SH_TRY { flush(); }
+    TSL_SH_CATCH(...) {}
+  }
+
+  void write_bytes(const void *data, std::size_t size) {
+    const char *bytes = static_cast<const char *>(data);
+
+    if (size <= m_buffer_size - m_buffer_pos) {
+      std::memcpy(m_buffer.get() + m_buffer_pos, bytes, size);
+      m_buffer_pos += size;
+      return;
+    }
+
+    flush_buffer();
+    if (size >= m_buffer_size) {
+      detail_sparse_stream::write_to_streambuf(m_streambuf, bytes, size);
+    } else {
+      std::memcpy(m_buffer.get(), bytes, size);
+      m_buffer_pos = size;
+    }
+  }
+
+  /**
+   * Write the buffered bytes to the stream buffer and flush it.
+   */
+  void flush() {
+    flush_buffer();
+    if (m_streambuf.pubsync() != 0) {
+      TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                            "Couldn't flush the serialization stream.");
+    }
+  }
+
+ private:
+  void flush_buffer() {
+    if (m_buffer_pos > 0) {
+      detail_sparse_stream::write_to_streambuf(m_streambuf, m_buffer.get(),
+                                               m_buffer_pos);
+      m_buffer_pos = 0;
+    }
+  }
+
+ private:
+  std::streambuf &m_streambuf;
+  std::unique_ptr<char[]> m_buffer;
+  std::size_t m_buffer_size;
+  std::size_t m_buffer_pos;
+};
+
+/**
+ * Buffered deserializer over a `std::istream` (or directly a
+ * `std::streambuf`) to use with the `deserialize` methods of `tsl::sparse_map`
+ * and `tsl::sparse_set`. It reads what `tsl::sh::stream_serializer` writes.
+ *
+ * The stream buffer is read by blocks of `buffer_size` bytes. Reads larger
+ * than the buffer, like the raw blocks of values, go directly from the stream
+ * buffer to their destination. The memory used by the deserializer is thus
+ * bounded by `buffer_size`, whatever the size of the map.
+ *
+ * The deserializer reads ahead of the serialized map. On destruction, it tries
+ * to move the position of the stream buffer back to the end of the bytes that
+ * were actually consumed, which only works on seekable streams. Throw
+ * `std::runtime_error` if the stream ends before the map is complete.
+ */
+class stream_deserializer
+    : public detail_sparse_stream::value_deserializer<stream_deserializer> {
+ public:
+  static const std::size_t DEFAULT_BUFFER_SIZE = 1024 * 1024;
+
+  explicit stream_deserializer(std::istream &istream,
+                               std::size_t buffer_size = DEFAULT_BUFFER_SIZE)
+      : stream_deserializer(*istream.rdbuf(), buffer_size) {}
+
+  explicit stream_deserializer(std::streambuf &streambuf,
+                               std::size_t buffer_size = DEFAULT_BUFFER_SIZE)
+      : m_streambuf(streambuf),
+        m_buffer(new char[std::max<std::size_t>(buffer_size, 1)]),
+        m_buffer_size(std::max<std::size_t>(buffer_size, 1)),
+        m_buffer_pos(0),
+        m_buffer_end(0) {}
+
+  stream_deserializer(const stream_deserializer &) = delete;
+  stream_deserializer &operator=(const stream_deserializer &) = delete;
+
+  ~stream_deserializer() {
+    if (m_buffer_pos < m_buffer_end) {
+      m_streambuf.pubseekoff(
+          -static_cast<std::streamoff>(m_buffer_end - m_buffer_pos),
+          std::ios_base::cur, std::ios_base::in);
+    }
+  }
+
+  void read_bytes(void *data, std::size_t size) {
+    char *bytes = static_cast<char *>(data);
+
+    const std::size_t nb_buffered =
+        std::min<std::size_t>(size, m_buffer_end - m_buffer_pos);
+    std::memcpy(bytes, m_buffer.get() + m_buffer_pos, nb_buffered);
+    m_buffer_pos += nb_buffered;
+    bytes += nb_buffered;
+    size -= nb_buffered;
+
+    if (size >= m_buffer_size) {
+      detail_sparse_stream::read_from_streambuf(m_streambuf, bytes, size);
+      return;
+    }
+
+    while (size > 0) {
+      fill_buffer();
+
+      const std::size_t nb_read =
+          std::min<std::size_t>(size, m_buffer_end - m_buffer_pos);
+      std::memcpy(bytes, m_buffer.get() + m_buffer_pos, nb_read);
+      m_buffer_pos += nb_read;
+      bytes += nb_read;
+      size -= nb_read;
+    }
+  }
+
+ private:
+  void fill_buffer() {
+    tsl_sh_assert(m_buffer_pos == m_buffer_end);
+
+    const std::streamsize nb_read = m_streambuf.sgetn(
+        m_buffer.get(), static_cast<std::streamsize>(m_buffer_size));
+    if (nb_read <= 0) {
+      TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                            "Unexpected end of the deserialization stream.");
+    }
+
+    m_buffer_pos = 0;
+    m_buffer_end = static_cast<std::size_t>(nb_read);
+  }
+
+ private:
+  std::streambuf &m_streambuf;
+  std::unique_ptr<char[]> m_buffer;
+  std::size_t m_buffer_size;
+  std::size_t m_buffer_pos;
+  std::size_t m_buffer_end;
+};
+
+/**
+ * Serializer writing a framed format where each block of at most
+ * `block_size` bytes is protected by a CRC32C checksum, to use with the
+ * `serialize` methods of `tsl::sparse_map` and `tsl::sparse_set`. The
+ * supported values are the same as in `tsl::sh::stream_serializer`.
+ *
+ * The format is:
+ * - a header with a magic number, the format version, an endianness marker
+ *   and the block size;
+ * - the blocks, each one being preceded by its size and its CRC32C on 32 bits;
+ * - an empty block marking the end of the blocks;
+ * - the index, the 64-bits offset of each block from the start of the header;
+ * - a footer with the offset of the index, the number of blocks, the CRC32C
+ *   of the index and a magic number.
+ *
+ * The CRC32C uses the SSE4.2 or ARMv8 CRC instructions when the CPU supports
+ * them. `tsl::sh::checksummed_stream_deserializer` checks each block before
+ * handing any of its bytes to the deserialization, a corrupted stream thus
+ * fails as soon as the corrupted block is reached. The whole stream can also
+ * be verified in parallel with `checksummed_stream_deserializer::verify`
+ * thanks to the index.
+ *
+ * `finish()` must be called once the serialization is done to write the last
+ * block and the index. Unlike `tsl::sh::stream_serializer`, the destructor
+ * doesn't write anything: a stream whose serialization was interrupted has no
+ * index and is rejected on deserialization.
+ */
+class checksummed_stream_serializer
+    : public detail_sparse_stream::value_serializer<
+          checksummed_stream_serializer> {
+ public:
+  static const std::size_t DEFAULT_BLOCK_SIZE = 1024 * 1024;
+
+  explicit checksummed_stream_serializer(
+      std::ostream &ostream, std::size_t block_size = DEFAULT_BLOCK_SIZE)
+      : checksummed_stream_serializer(*ostream.rdbuf(), block_size) {}
+
+  /**
+   * Write the header. Throw `std::invalid_argument` if `block_size` is 0 or
+   * greater than 1 GiB.
+   */
+  explicit checksummed_stream_serializer(
+      std::streambuf &streambuf, std::size_t block_size = DEFAULT_BLOCK_SIZE)
+      : m_streambuf(streambuf),
+        m_block_size(block_size),
+        m_buffer_pos(0),
+        m_offset(0),
+        m_finished(false) {
+    if (block_size == 0 ||
+        block_size > detail_sparse_stream::CHECKSUMMED_MAX_BLOCK_SIZE) {
+      TSL_SH_THROW_OR_ABORT(std::invalid_argument,
+                            "block_size must be in [1, 2^30].");
+    }
+
+    m_buffer.reset(new char[block_size]);
+
+    detail_sparse_stream::checksummed_header header;
+    std::memcpy(header.magic, detail_sparse_stream::checksummed_header_magic(),
+                sizeof(header.magic));
+    header.endianness = detail_sparse_stream::CHECKSUMMED_ENDIANNESS_MARKER;
+    header.version = detail_sparse_stream::CHECKSUMMED_VERSION;
+    header.block_size = block_size;
+    write(&header, sizeof(header));
+  }
+
+  checksummed_stream_serializer(const checksummed_stream_serializer &) =
+      delete;
+  checksummed_stream_serializer &operator=(
+      const checksummed_stream_serializer &) = delete;
+
+  void write_bytes(const void *data, std::size_t size) {
+    tsl_sh_assert(!m_finished);
+    const char *bytes = static_cast<const char *>(data);
+
+    while (size > 0) {
+      // Checksum the full blocks directly from `data` instead of copying them
+      if (m_buffer_pos == 0 && size >= m_block_size) {
+        write_block(bytes, m_block_size);
+        bytes += m_block_size;
+        size -= m_block_size;
+        continue;
+      }
+
+      const std::size_t nb_copied =
+          std::min<std::size_t>(size, m_block_size - m_buffer_pos);
+      std::memcpy(m_buffer.get() + m_buffer_pos, bytes, nb_copied);
+      m_buffer_pos += nb_copied;
+      bytes += nb_copied;
+      size -= nb_copied;
+
+      if (m_buffer_pos == m_block_size) {
+        write_block(m_buffer.get(), m_buffer_pos);
+        m_buffer_pos = 0;
+      }
+    }
+  }
+
+  /**
+   * Write the pending block, the end of the blocks, the index and the footer,
+   * and flush the stream buffer. No other write can be done afterwards.
+   */
+  void finish() {
+    tsl_sh_assert(!m_finished);
+
+    if (m_buffer_pos > 0) {
+      write_block(m_buffer.get(), m_buffer_pos);
+      m_buffer_pos = 0;
+    }
+
+    const detail_sparse_stream::checksummed_block_header end_of_blocks = {0, 0};
+    write(&end_of_blocks, sizeof(end_of_blocks));
+
+    detail_sparse_stream::checksummed_footer footer;
+    footer.index_offset = m_offset;
+    footer.nb_blocks = m_block_offsets.size();
+    footer.index_crc = detail_crc32c::crc32c(
+        0, m_block_offsets.data(),
+        m_block_offsets.size() * sizeof(std::uint64_t));
+    footer.endianness = detail_sparse_stream::CHECKSUMMED_ENDIANNESS_MARKER;
+    std::memcpy(footer.magic, detail_sparse_stream::checksummed_footer_magic(),
+                sizeof(footer.magic));
+
+    write(m_block_offsets.data(),
+          m_block_offsets.size() * sizeof(std::uint64_t));
+    write(&footer, sizeof(footer));
+
+    m_finished = true;
+    if (m_streambuf.pubsync() != 0) {
+      TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                            "Couldn't flush the serialization stream.");
+    }
+  }
+
+ private:
+  void write_block(const char *data, std::size_t size) {
+    tsl_sh_assert(size > 0 && size <= m_block_size);
+
+    detail_sparse_stream::checksummed_block_header block_header;
+    block_header.size = static_cast<std::uint32_t>(size);
+    block_header.crc = detail_crc32c::crc32c(0, data, size);
+
+    m_block_offsets.push_back(m_offset);
+    write(&block_header, sizeof(block_header));
+    write(data, size);
+  }
+
+  void write(const void *data, std::size_t size) {
+    detail_sparse_stream::write_to_streambuf(
+        m_streambuf, static_cast<const char *>(data), size);
+    m_offset += size;
+  }
+
+ private:
+  std::streambuf &m_streambuf;
+  std::unique_ptr<char[]> m_buffer;
+  std::size_t m_block_size;
+  std::size_t m_buffer_pos;
+  std::vector<std::uint64_t> m_block_offsets;
+  std::uint64_t m_offset;
+  bool m_finished;
+};
+
+/**
+ * Deserializer over a `std::istream` (or directly a `std::streambuf`) reading
+ * the format written by `tsl::sh::checksummed_stream_serializer`.
+ *
+ * The blocks are read one by one and the CRC32C of a block is checked before
+ * any of its bytes is handed to the deserialization. The memory used by the
+ * deserializer is bounded by the block size. Throw `std::runtime_error` if the
+ * stream is not a valid checksummed stream, if a checksum doesn't match or if
+ * the stream ends before the map is complete.
+ *
+ * `finish()` can be called once the deserialization is done to check that all
+ * the blocks were consumed and that the index is valid. It leaves the stream
+ * buffer just after the checksummed stream.
+ */
+class checksummed_stream_deserializer
+    : public detail_sparse_stream::value_deserializer<
+          checksummed_stream_deserializer> {
+ public:
+  explicit checksummed_stream_deserializer(std::istream &istream)
+      : checksummed_stream_deserializer(*istream.rdbuf()) {}
+
+  /**
+   * Read and check the header.
+   */
+  explicit checksummed_stream_deserializer(std::streambuf &streambuf)
+      : m_streambuf(streambuf),
+        m_block_size(0),
+        m_buffer_pos(0),
+        m_buffer_end(0),
+        m_block_crc(0),
+        m_offset(0),
+        m_end_of_blocks(false) {
+    detail_sparse_stream::checksummed_header header;
+    read(&header, sizeof(header));
+
+    m_block_size = detail_sparse_stream::check_checksummed_header(header);
+    m_buffer.reset(new char[m_block_size]);
+  }
+
+  checksummed_stream_deserializer(const checksummed_stream_deserializer &) =
+      delete;
+  checksummed_stream_deserializer &operator=(
+      const checksummed_stream_deserializer &) = delete;
+
+  void read_bytes(void *data, std::size_t size) {
+    char *bytes = static_cast<char *>(data);
+
+    while (size > 0) {
+      if (m_buffer_pos == m_buffer_end) {
+        read_block();
+      }
+
+      const std::size_t nb_read =
+          std::min<std::size_t>(size, m_buffer_end - m_buffer_pos);
+      std::memcpy(bytes, m_buffer.get() + m_buffer_pos, nb_read);
+      m_buffer_pos += nb_read;
+      bytes += nb_read;
+      size -= nb_read;
+    }
+  }
+
+  /**
+   * Check that all the blocks were consumed and read the index and the
+   * footer. Throw `std::runtime_error` if some bytes were not consumed or if
+   * the index doesn't match the blocks.
+   */
+  void finish() {
+    if (m_buffer_pos != m_buffer_end) {
+      TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                            "The checksummed stream has unread bytes.");
+    }
+
+    if (!m_end_of_blocks) {
+      read_block_header();
+      if (!m_end_of_blocks) {
+        TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                              "The checksummed stream has unread bytes.");
+      }
+    }
+
+    const std::uint64_t index_offset = m_offset;
+    std::vector<std::uint64_t> index(m_block_offsets.size());
+    read(index.data(), index.size() * sizeof(std::uint64_t));
+
+    detail_sparse_stream::checksummed_footer footer;
+    read(&footer, sizeof(footer));
+
+    if (std::memcmp(footer.magic,
+                    detail_sparse_stream::checksummed_footer_magic(),
+                    sizeof(footer.magic)) != 0 ||
+        footer.endianness !=
+            detail_sparse_stream::CHECKSUMMED_ENDIANNESS_MARKER ||
+        footer.index_offset != index_offset ||
+        footer.nb_blocks != m_block_offsets.size() ||
+        footer.index_crc !=
+            detail_crc32c::crc32c(0, index.data(),
+                                  index.size() * sizeof(std::uint64_t)) ||
+        index != m_block_offsets) {
+      TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                            "The index of the checksummed stream is invalid.");
+    }
+  }
+
+  /**
+   * Verify all the checksums of the checksummed stream stored in the `size`
+   * bytes at `data` (a file mapped in memory for example) without
+   * deserializing anything. The blocks are split between `nb_threads`
+   * threads thanks to the index, the calling thread being one of them.
+   *
+   * Throw `std::runtime_error` if the data is not a valid checksummed stream
+   * or if a checksum doesn't match.
+   */
+  static void verify(const void *data, std::size_t size,
+                     std::size_t nb_threads = 1) {
+    using namespace detail_sparse_stream;
+
+    const char *bytes = static_cast<const char *>(data);
+    if (size < sizeof(checksummed_header) + sizeof(checksummed_block_header) +
+                   sizeof(checksummed_footer)) {
+      TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                            "The checksummed stream is truncated.");
+    }
+
+    checksummed_header header;
+    std::memcpy(&header, bytes, sizeof(header));
+    const std::size_t block_size = check_checksummed_header(header);
+
+    checksummed_footer footer;
+    std::memcpy(&footer, bytes + size - sizeof(footer), sizeof(footer));
+    const std::size_t index_end = size - sizeof(footer);
+    if (std::memcmp(footer.magic, checksummed_footer_magic(),
+                    sizeof(footer.magic)) != 0 ||
+        footer.endianness != CHECKSUMMED_ENDIANNESS_MARKER ||
+        footer.index_offset <
+            sizeof(checksummed_header) + sizeof(checksummed_block_header) ||
+        footer.index_offset > index_end ||
+        footer.nb_blocks != (index_end - footer.index_offset) /
+                                sizeof(std::uint64_t) ||
+        (index_end - footer.index_offset) % sizeof(std::uint64_t) != 0) {
+      TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                            "The index of the checksummed stream is invalid.");
+    }
+
+    const std::size_t index_offset =
+        static_cast<std::size_t>(footer.index_offset);
+    const std::size_t nb_blocks = static_cast<std::size_t>(footer.nb_blocks);
+    std::vector<std::uint64_t> index(nb_blocks);
+    std::memcpy(index.data(), bytes + index_offset,
+                nb_blocks * sizeof(std::uint64_t));
+    if (footer.index_crc !=
+        detail_crc32c::crc32c(0, index.data(),
+                              nb_blocks * sizeof(std::uint64_t))) {
+      TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                            "The index of the checksummed stream is invalid.");
+    }
+
+    // Offset of the end of the blocks marker
+    const std::size_t blocks_end =
+        index_offset - sizeof(checksummed_block_header);
+    checksummed_block_header end_of_blocks;
+    std::memcpy(&end_of_blocks, bytes + blocks_end, sizeof(end_of_blocks));
+    if (end_of_blocks.size != 0 || end_of_blocks.crc != 0 ||
+        (nb_blocks == 0 && blocks_end != sizeof(checksummed_header)) ||
+        (nb_blocks > 0 && index[0] != sizeof(checksummed_header))) {
+      TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                            "The checksummed stream is corrupted.");
+    }
+
+    // Each block must end where the next one (or the end marker) starts.
+    auto verify_block = [&](std::size_t iblock) {
+      const std::uint64_t next_offset =
+          (iblock + 1 < nb_blocks) ? index[iblock + 1] : blocks_end;
+      const std::uint64_t offset = index[iblock];
+      if (offset >= next_offset || next_offset > blocks_end ||
+          next_offset - offset < sizeof(checksummed_block_header)) {
+        TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                              "The checksummed stream is corrupted.");
+      }
+
+      checksummed_block_header block_header;
+      std::memcpy(&block_header, bytes + offset, sizeof(block_header));
+      if (block_header.size == 0 || block_header.size > block_size ||
+          next_offset - offset !=
+              sizeof(checksummed_block_header) + block_header.size) {
+        TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                              "The checksummed stream is corrupted.");
+      }
+
+      if (detail_crc32c::crc32c(
+              0, bytes + offset + sizeof(checksummed_block_header),
+              block_header.size) != block_header.crc) {
+        TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                              "Checksum mismatch in the checksummed stream.");
+      }
+    };
+
+    nb_threads = std::max<std::size_t>(
+        1, std::min<std::size_t>(nb_threads, nb_blocks));
+    detail_sparse_hash::run_in_parallel(nb_threads, [&](std::size_t ithread) {
+      const auto range =
+          detail_sparse_hash::split_range(nb_blocks, nb_threads, ithread);
+      for (std::size_t iblock = range.first; iblock < range.second; iblock++) {
+        verify_block(iblock);
+      }
+    });
+  }
+
+ private:
+  /**
+   * Read the next block in the buffer and check its checksum.
+   */
+  void read_block() {
+    read_block_header();
+    if (m_end_of_blocks) {
+      TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                            "Unexpected end of the checksummed stream.");
+    }
+
+    read(m_buffer.get(), m_buffer_end);
+    if (detail_crc32c::crc32c(0, m_buffer.get(), m_buffer_end) !=
+        m_block_crc) {
+      TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                            "Checksum mismatch in the checksummed stream.");
+    }
+  }
+
+  void read_block_header() {
+    if (m_end_of_blocks) {
+      return;
+    }
+
+    const std::uint64_t offset = m_offset;
+
+    detail_sparse_stream::checksummed_block_header block_header;
+    read(&block_header, sizeof(block_header));
+    if (block_header.size == 0) {
+      if (block_header.crc != 0) {
+        TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                              "The checksummed stream is corrupted.");
+      }
+
+      m_end_of_blocks = true;
+      return;
+    }
+
+    if (block_header.size > m_block_size) {
+      TSL_SH_THROW_OR_ABORT(std::runtime_error,
+                            "The checksummed stream is corrupted.");
+    }
+
+    m_block_offsets.push_back(offset);
+    m_block_crc = block_header.crc;
+    m_buffer_pos = 0;
+    m_buffer_end = block_header.size;
+  }
+
+  void read(void *data, std::size_t size) {
+    detail_sparse_stream::read_from_streambuf(
+        m_streambuf, static_cast<char *>(data), size);
+    m_offset += size;
+  }
+
+ private:
+  std::streambuf &m_streambuf;
+  std::unique_ptr<char[]> m_buffer;
+  std::size_t m_block_size;
+  std::size_t m_buffer_pos;
+  std::size_t m_buffer_end;
+  std::uint32_t m_block_crc;
+  std::vector<std::uint64_t> m_block_offsets;
+  std::uint64_t m_offset;
+  bool m_end_of_blocks;
+};
+
+}  // end namespace sh
+}  // end namespace tsl
+
+#endif
@@ -0,0 +1,174 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2017 Thibaut Goetghebuer-Planchon <tessil@gmx.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <tsl/frozen_sparse_map.h>
+#include <tsl/sparse_map.h>
+
+#include <boost/test/unit_test.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include "utils.h"
+
+namespace {
+/**
+ * Freeze `map` into a buffer aligned like a memory mapped file would be.
+ */
+template <class FrozenMap, class Map>
+std::vector<std::uint64_t> freeze(const Map& map) {
+  std::vector<char> bytes;
+  const std::size_t size = FrozenMap::freeze(
+      map, [&](const char* data, std::size_t data_size) {
+        bytes.insert(bytes.end(), data, data + data_size);
+      });
+  BOOST_REQUIRE_EQUAL(size, bytes.size());
+
+  std::vector<std::uint64_t> buffer((bytes.size() + 7) / 8);
+  std::memcpy(buffer.data(), bytes.data(), bytes.size());
+  buffer.push_back(bytes.size());
+
+  return buffer;
+}
+
+std::size_t frozen_size(const std::vector<std::uint64_t>& buffer) {
+  return static_cast<std::size_t>(buffer.back());
+}
+
+struct point {
+  std::int32_t x;
+  std::int16_t y;
+};
+}  // namespace
+
+BOOST_AUTO_TEST_SUITE(test_frozen_sparse_map)
+
+BOOST_AUTO_TEST_CASE(test_freeze_find) {
+  using frozen_map = tsl::frozen_sparse_map<std::int64_t, std::int64_t>;
+  const std::size_t nb_values = 10000;
+
+  auto map =
+      utils::get_filled_hash_map<tsl::sparse_map<std::int64_t, std::int64_t>>(
+          nb_values);
+  map.erase(0);
+  map.erase(10);
+
+  const auto buffer = freeze<frozen_map>(map);
+  const frozen_map frozen(buffer.data(), frozen_size(buffer));
+
+  BOOST_CHECK_EQUAL(frozen.size(), nb_values - 2);
+  BOOST_CHECK(frozen.bucket_count() >= 2 * frozen.size());
+  BOOST_CHECK_EQUAL(std::distance(frozen.begin(), frozen.end()),
+                    nb_values - 2);
+
+  for (std::size_t i = 0; i < nb_values; i++) {
+    const std::int64_t key = utils::get_key<std::int64_t>(i);
+    if (i == 0 || i == 10) {
+      BOOST_CHECK(frozen.find(key) == frozen.end());
+      BOOST_CHECK(!frozen.contains(key));
+      TSL_SH_CHECK_THROW(frozen.at(key), std::out_of_range);
+    } else {
+      BOOST_CHECK_EQUAL(frozen.at(key), utils::get_value<std::int64_t>(i));
+      BOOST_CHECK_EQUAL(frozen.find(key)->first, key);
+      BOOST_CHECK_EQUAL(frozen.count(key), 1);
+    }
+  }
+
+  for (const auto& value : frozen) {
+    BOOST_CHECK_EQUAL(map.at(value.first), value.second);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_freeze_collisions) {
+  // From a std::unordered_map with a hash function with a lot of collisions
+  // and a struct as value.
+  using frozen_map =
+      tsl::frozen_sparse_map<std::int64_t, point, mod_hash<9>>;
+
+  std::unordered_map<std::int64_t, point> map;
+  for (std::int32_t i = 0; i < 1000; i++) {
+    map.insert({i, point{i, std::int16_t(i % 100)}});
+  }
+
+  const auto buffer = freeze<frozen_map>(map);
+  const frozen_map frozen(buffer.data(), frozen_size(buffer));
+
+  BOOST_CHECK_EQUAL(frozen.size(), 1000);
+  for (std::int32_t i = 0; i < 1000; i++) {
+    BOOST_CHECK_EQUAL(frozen.at(i).x, i);
+    BOOST_CHECK_EQUAL(frozen.at(i).y, i % 100);
+  }
+  BOOST_CHECK(frozen.find(1000) == frozen.end());
+}
+
+BOOST_AUTO_TEST_CASE(test_freeze_empty) {
+  using frozen_map = tsl::frozen_sparse_map<std::int64_t, std::int64_t>;
+
+  const frozen_map not_opened;
+  BOOST_CHECK(not_opened.empty());
+  BOOST_CHECK_EQUAL(not_opened.bucket_count(), 0);
+  BOOST_CHECK(not_opened.find(1) == not_opened.end());
+
+  const auto buffer =
+      freeze<frozen_map>(tsl::sparse_map<std::int64_t, std::int64_t>());
+  const frozen_map frozen(buffer.data(), frozen_size(buffer));
+  BOOST_CHECK(frozen.empty());
+  BOOST_CHECK(frozen.begin() == frozen.end());
+  BOOST_CHECK(frozen.find(1) == frozen.end());
+}
+
+BOOST_AUTO_TEST_CASE(test_open_invalid) {
+  using frozen_map = tsl::frozen_sparse_map<std::int64_t, std::int64_t>;
+
+  const auto buffer = freeze<frozen_map>(
+      utils::get_filled_hash_map<tsl::sparse_map<std::int64_t, std::int64_t>>(
+          100));
+
+  // Truncated
+  TSL_SH_CHECK_THROW(frozen_map(buffer.data(), frozen_size(buffer) - 8),
+                     std::runtime_error);
+  TSL_SH_CHECK_THROW(frozen_map(buffer.data(), 16), std::runtime_error);
+
+  // Different types
+  TSL_SH_CHECK_THROW(
+      (tsl::frozen_sparse_map<std::int64_t, std::int32_t>(
+          buffer.data(), frozen_size(buffer))),
+      std::runtime_error);
+
+  // Misaligned
+  std::vector<char> misaligned(frozen_size(buffer) + 1);
+  std::memcpy(misaligned.data() + 1, buffer.data(), frozen_size(buffer));
+  TSL_SH_CHECK_THROW(frozen_map(misaligned.data() + 1, frozen_size(buffer)),
+                     std::runtime_error);
+
+  // Not a frozen map
+  std::vector<std::uint64_t> garbage(buffer.size(), 42);
+  TSL_SH_CHECK_THROW(frozen_map(garbage.data(), frozen_size(buffer)),
+                     std::runtime_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,193 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2017 Thibaut Goetghebuer-Planchon <tessil@gmx.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <tsl/lazy_sparse_map.h>
+#include <tsl/sparse_map.h>
+
+#include <boost/test/unit_test.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include "utils.h"
+
+namespace {
+using lazy_map = tsl::lazy_sparse_map<std::int64_t, std::int64_t>;
+
+/**
+ * Freeze `map` into a buffer aligned like a memory mapped file would be. The
+ * size of the frozen block is stored in the last element.
+ */
+template <class Map>
+std::vector<std::uint64_t> freeze(const Map& map) {
+  std::vector<char> bytes;
+  lazy_map::frozen_map_type::freeze(
+      map, [&](const char* data, std::size_t data_size) {
+        bytes.insert(bytes.end(), data, data + data_size);
+      });
+
+  std::vector<std::uint64_t> buffer((bytes.size() + 7) / 8);
+  std::memcpy(buffer.data(), bytes.data(), bytes.size());
+  buffer.push_back(bytes.size());
+
+  return buffer;
+}
+
+lazy_map open(const std::vector<std::uint64_t>& buffer) {
+  return lazy_map(buffer.data(), static_cast<std::size_t>(buffer.back()));
+}
+}  // namespace
+
+BOOST_AUTO_TEST_SUITE(test_lazy_sparse_map)
+
+BOOST_AUTO_TEST_CASE(test_lookups_dont_copy) {
+  tsl::sparse_map<std::int64_t, std::int64_t> map;
+  for (std::int64_t i = 0; i < 5000; i++) {
+    map.insert({i, i * 3});
+  }
+
+  const auto buffer = freeze(map);
+  const lazy_map lazy = open(buffer);
+
+  BOOST_CHECK_EQUAL(lazy.size(), 5000);
+  for (std::int64_t i = 0; i < 5000; i++) {
+    BOOST_CHECK_EQUAL(lazy.at(i), i * 3);
+  }
+  BOOST_CHECK_EQUAL(lazy.count(5000), 0);
+  BOOST_CHECK(!lazy.contains(-1));
+  TSL_SH_CHECK_THROW(lazy.at(5000), std::out_of_range);
+
+  BOOST_CHECK_EQUAL(lazy.overlay_size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_modifications) {
+  tsl::sparse_map<std::int64_t, std::int64_t> map;
+  for (std::int64_t i = 0; i < 100; i++) {
+    map.insert({i, i});
+  }
+
+  const auto buffer = freeze(map);
+  lazy_map lazy = open(buffer);
+
+  // Only the accessed values are copied in the overlay
+  lazy[10] += 5;
+  lazy.at(11) = -11;
+  BOOST_CHECK_EQUAL(lazy.overlay_size(), 2);
+  BOOST_CHECK_EQUAL(lazy.at(10), 15);
+  BOOST_CHECK_EQUAL(lazy.at(11), -11);
+  BOOST_CHECK_EQUAL(lazy.size(), 100);
+
+  BOOST_CHECK(!lazy.insert_or_assign(12, 120));
+  BOOST_CHECK(lazy.insert_or_assign(1000, 1));
+  BOOST_CHECK_EQUAL(lazy[1001], 0);
+  BOOST_CHECK_EQUAL(lazy.size(), 102);
+
+  // Erase values from the snapshot, the overlay and both
+  BOOST_CHECK_EQUAL(lazy.erase(20), 1);
+  BOOST_CHECK_EQUAL(lazy.erase(20), 0);
+  BOOST_CHECK_EQUAL(lazy.erase(1000), 1);
+  BOOST_CHECK_EQUAL(lazy.erase(10), 1);
+  BOOST_CHECK_EQUAL(lazy.erase(5000), 0);
+  BOOST_CHECK_EQUAL(lazy.size(), 99);
+  BOOST_CHECK_EQUAL(lazy.count(20), 0);
+  BOOST_CHECK_EQUAL(lazy.count(10), 0);
+  TSL_SH_CHECK_THROW(lazy.at(20), std::out_of_range);
+
+  // An erased value of the snapshot doesn't come back on reinsertion
+  BOOST_CHECK_EQUAL(lazy[20], 0);
+  BOOST_CHECK(lazy.insert_or_assign(10, 7));
+  BOOST_CHECK_EQUAL(lazy.at(10), 7);
+  BOOST_CHECK_EQUAL(lazy.size(), 101);
+
+  lazy.clear();
+  BOOST_CHECK(lazy.empty());
+  BOOST_CHECK_EQUAL(lazy.count(0), 0);
+  BOOST_CHECK_EQUAL(lazy.count(1001), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_random_operations) {
+  std::unordered_map<std::int64_t, std::int64_t> reference;
+  for (std::int64_t i = 0; i < 2000; i++) {
+    reference.insert({i * 2, i});
+  }
+
+  const auto buffer = freeze(reference);
+  lazy_map lazy = open(buffer);
+
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<std::int64_t> key_dist(0, 6000);
+  std::uniform_int_distribution<int> op_dist(0, 3);
+  for (std::size_t i = 0; i < 20000; i++) {
+    const std::int64_t key = key_dist(gen);
+    switch (op_dist(gen)) {
+      case 0:
+        BOOST_CHECK_EQUAL(lazy.insert_or_assign(key, std::int64_t(i)),
+                          reference.count(key) == 0);
+        reference[key] = std::int64_t(i);
+        break;
+      case 1:
+        BOOST_CHECK_EQUAL(lazy.erase(key), reference.erase(key));
+        break;
+      case 2:
+        BOOST_CHECK_EQUAL(lazy[key]++, reference[key]++);
+        break;
+      default:
+        BOOST_CHECK_EQUAL(lazy.count(key), reference.count(key));
+        break;
+    }
+  }
+
+  BOOST_CHECK_EQUAL(lazy.size(), reference.size());
+
+  std::size_t nb_visited = 0;
+  lazy.for_each([&](std::int64_t key, std::int64_t value) {
+    nb_visited++;
+    BOOST_CHECK_EQUAL(reference.at(key), value);
+  });
+  BOOST_CHECK_EQUAL(nb_visited, reference.size());
+
+  const tsl::sparse_map<std::int64_t, std::int64_t> materialized =
+      lazy.materialize();
+  BOOST_CHECK_EQUAL(materialized.size(), reference.size());
+  for (const auto& value : reference) {
+    BOOST_CHECK_EQUAL(materialized.at(value.first), value.second);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_invalid_snapshot) {
+  const std::vector<std::uint64_t> buffer(64, 0);
+  TSL_SH_CHECK_THROW(lazy_map(buffer.data(), buffer.size() * 8),
+                     std::runtime_error);
+
+  lazy_map empty;
+  BOOST_CHECK(empty.empty());
+  empty[1] = 2;
+  BOOST_CHECK_EQUAL(empty.size(), 1);
+  BOOST_CHECK_EQUAL(empty.at(1), 2);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,163 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2017 Thibaut Goetghebuer-Planchon <tessil@gmx.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+// Must be defined before the inclusion of any header of the library. The
+// hash functions below are local to this file so that the map types built
+// with the statistics are not also built without them by other files.
+#define TSL_SH_STATS
+
+#include <tsl/sparse_map.h>
+#include <tsl/sparse_set.h>
+
+#include <boost/test/unit_test.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "utils.h"
+
+namespace {
+struct stats_identity_hash {
+  std::size_t operator()(std::int64_t value) const {
+    return static_cast<std::size_t>(value);
+  }
+};
+
+struct stats_constant_hash {
+  std::size_t operator()(std::int64_t) const { return 1; }
+};
+
+std::uint64_t histogram_sum(
+    const tsl::sh::probe_stats::operation_stats& op_stats) {
+  std::uint64_t sum = 0;
+  for (std::uint64_t count : op_stats.histogram) {
+    sum += count;
+  }
+
+  return sum;
+}
+}  // namespace
+
+BOOST_AUTO_TEST_SUITE(test_probe_stats)
+
+BOOST_AUTO_TEST_CASE(test_no_collision) {
+  // Each key lands in its own bucket, no probing is needed.
+  tsl::sparse_map<std::int64_t, std::int64_t, stats_identity_hash> map(256);
+  for (std::int64_t i = 0; i < 100; i++) {
+    map.insert({i, i});
+  }
+  for (std::int64_t i = 0; i < 100; i++) {
+    BOOST_CHECK_EQUAL(map.at(i), i);
+  }
+
+  const tsl::sh::probe_stats stats = map.stats();
+  BOOST_CHECK_EQUAL(stats.insert.nb_operations, 100);
+  BOOST_CHECK_EQUAL(stats.insert.nb_probes, 0);
+  BOOST_CHECK_EQUAL(stats.insert.histogram[0], 100);
+  BOOST_CHECK_EQUAL(stats.find.nb_operations, 100);
+  BOOST_CHECK_EQUAL(stats.find.histogram[0], 100);
+  BOOST_CHECK_EQUAL(stats.find.average_probes(), 0.0);
+  BOOST_CHECK_EQUAL(stats.erase.nb_operations, 0);
+  BOOST_CHECK_EQUAL(stats.nb_tombstones_skipped, 0);
+  BOOST_CHECK_EQUAL(stats.nb_key_comparisons, 100);
+}
+
+BOOST_AUTO_TEST_CASE(test_collisions) {
+  // All the keys have the same hash, the n-th inserted key probes the n
+  // buckets holding the previous keys.
+  const std::int64_t nb_values = 20;
+
+  tsl::sparse_map<std::int64_t, std::int64_t, stats_constant_hash> map;
+  for (std::int64_t i = 0; i < nb_values; i++) {
+    map.insert({i, i});
+  }
+
+  tsl::sh::probe_stats stats = map.stats();
+  BOOST_CHECK_EQUAL(stats.insert.nb_operations, nb_values);
+  BOOST_CHECK_EQUAL(stats.insert.nb_probes, nb_values * (nb_values - 1) / 2);
+  // The insertions which triggered a rehash compared the key before the
+  // rehash, but are only counted once.
+  BOOST_CHECK(stats.nb_key_comparisons >= stats.insert.nb_probes);
+  BOOST_CHECK_EQUAL(histogram_sum(stats.insert), nb_values);
+  BOOST_CHECK_EQUAL(stats.insert.histogram[0], 1);
+  BOOST_CHECK_EQUAL(
+      stats.insert.histogram[tsl::sh::probe_stats::HISTOGRAM_SIZE - 1],
+      nb_values - (tsl::sh::probe_stats::HISTOGRAM_SIZE - 1));
+  BOOST_CHECK_EQUAL(stats.insert.average_probes(), (nb_values - 1) / 2.0);
+
+  // A miss compares the key to all the values
+  map.reset_stats();
+  BOOST_CHECK(map.find(nb_values) == map.end());
+  stats = map.stats();
+  BOOST_CHECK_EQUAL(stats.find.nb_operations, 1);
+  BOOST_CHECK_EQUAL(stats.find.nb_probes, nb_values);
+  BOOST_CHECK_EQUAL(stats.nb_key_comparisons, nb_values);
+  BOOST_CHECK_EQUAL(stats.insert.nb_operations, 0);
+
+  // The buckets of the erased values are crossed by the following operations
+  BOOST_CHECK_EQUAL(map.erase(0), 1);
+  BOOST_CHECK_EQUAL(map.erase(1), 1);
+  BOOST_CHECK_EQUAL(map.stats().erase.nb_operations, 2);
+
+  map.reset_stats();
+  BOOST_CHECK_EQUAL(map.erase(-1), 0);
+  stats = map.stats();
+  BOOST_CHECK_EQUAL(stats.erase.nb_operations, 1);
+  BOOST_CHECK_EQUAL(stats.erase.nb_probes, nb_values);
+  BOOST_CHECK_EQUAL(stats.nb_tombstones_skipped, 2);
+  BOOST_CHECK_EQUAL(stats.nb_key_comparisons, nb_values - 2);
+}
+
+BOOST_AUTO_TEST_CASE(test_copy_and_rehash) {
+  tsl::sparse_map<std::int64_t, std::int64_t, stats_identity_hash> map;
+  for (std::int64_t i = 0; i < 1000; i++) {
+    map.insert({i, i});
+  }
+
+  // The inserts which triggered a rehash are only counted once
+  BOOST_CHECK_EQUAL(map.stats().insert.nb_operations, 1000);
+
+  // A copy starts with empty statistics, a rehash keeps them
+  const auto copy = map;
+  BOOST_CHECK_EQUAL(copy.stats().insert.nb_operations, 0);
+
+  map.rehash(map.bucket_count() * 2);
+  BOOST_CHECK_EQUAL(map.stats().insert.nb_operations, 1000);
+
+  map.reset_stats();
+  BOOST_CHECK_EQUAL(map.stats().insert.nb_operations, 0);
+  BOOST_CHECK_EQUAL(map.stats().insert.histogram[0], 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_set) {
+  tsl::sparse_set<std::int64_t, stats_constant_hash> set;
+  set.insert(1);
+  set.insert(2);
+  BOOST_CHECK_EQUAL(set.count(3), 0);
+
+  const tsl::sh::probe_stats stats = set.stats();
+  BOOST_CHECK_EQUAL(stats.insert.nb_probes, 1);
+  BOOST_CHECK_EQUAL(stats.find.nb_probes, 2);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
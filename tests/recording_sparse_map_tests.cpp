@@ -0,0 +1,193 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2017 Thibaut Goetghebuer-Planchon <tessil@gmx.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <tsl/recording_sparse_map.h>
+
+#include <boost/test/unit_test.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "utils.h"
+
+namespace {
+std::vector<tsl::sh::trace_record> read_trace(const std::string& trace,
+                                              bool expect_complete) {
+  std::stringbuf buffer(trace);
+  tsl::sh::trace_reader reader(buffer);
+
+  std::vector<tsl::sh::trace_record> records;
+  tsl::sh::trace_record record;
+  while (reader.read(record)) {
+    records.push_back(record);
+  }
+
+  BOOST_CHECK_EQUAL(reader.complete(), expect_complete);
+  BOOST_CHECK_EQUAL(reader.nb_records(), records.size());
+  BOOST_CHECK(!reader.read(record));
+
+  return records;
+}
+
+std::int64_t key_of(const tsl::sh::trace_record& record) {
+  BOOST_REQUIRE_EQUAL(record.key.size(), sizeof(std::int64_t));
+
+  std::int64_t key;
+  std::memcpy(&key, record.key.data(), sizeof(key));
+  return key;
+}
+}  // namespace
+
+BOOST_AUTO_TEST_SUITE(test_recording_sparse_map)
+
+BOOST_AUTO_TEST_CASE(test_record_operations) {
+  using map_type = tsl::recording_sparse_map<std::int64_t, std::int64_t>;
+
+  std::stringbuf trace;
+  {
+    map_type map(trace);
+    map.insert({1, 10});
+    map.insert_or_assign(2, 20);
+    map[3] = 30;
+    map.try_emplace(4, 40);
+    BOOST_CHECK(map.find(1) != map.end());
+    BOOST_CHECK_EQUAL(map.at(2), 20);
+    BOOST_CHECK_EQUAL(map.count(5), 0);
+    BOOST_CHECK(map.contains(3));
+    BOOST_CHECK_EQUAL(map.erase(4), 1);
+    BOOST_CHECK_EQUAL(map.size(), 3);
+    map.clear();
+    BOOST_CHECK(map.empty());
+    map.finish_trace();
+  }
+
+  std::stringbuf buffer(trace.str());
+  tsl::sh::trace_reader reader(buffer);
+  BOOST_CHECK_EQUAL(reader.key_size(), sizeof(std::int64_t));
+  BOOST_CHECK_EQUAL(reader.value_size(), sizeof(std::int64_t));
+
+  const auto records = read_trace(trace.str(), true);
+  const std::vector<tsl::sh::trace_op> expected_ops = {
+      tsl::sh::trace_op::insert, tsl::sh::trace_op::insert_or_assign,
+      tsl::sh::trace_op::insert, tsl::sh::trace_op::insert,
+      tsl::sh::trace_op::find,   tsl::sh::trace_op::find,
+      tsl::sh::trace_op::find,   tsl::sh::trace_op::find,
+      tsl::sh::trace_op::erase,  tsl::sh::trace_op::clear};
+  const std::vector<std::int64_t> expected_keys = {1, 2, 3, 4, 1, 2, 5, 3, 4};
+
+  BOOST_REQUIRE_EQUAL(records.size(), expected_ops.size());
+  for (std::size_t i = 0; i < records.size(); i++) {
+    BOOST_CHECK(records[i].op == expected_ops[i]);
+    if (records[i].op == tsl::sh::trace_op::clear) {
+      BOOST_CHECK(records[i].key.empty());
+      continue;
+    }
+
+    BOOST_CHECK_EQUAL(key_of(records[i]), expected_keys[i]);
+    BOOST_CHECK_EQUAL(records[i].hash,
+                      std::hash<std::int64_t>()(expected_keys[i]));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_record_string_keys) {
+  using map_type = tsl::recording_sparse_map<std::string, std::int64_t>;
+
+  std::stringbuf trace;
+  {
+    map_type map(trace);
+    for (std::size_t i = 0; i < 1000; i++) {
+      map.insert({utils::get_key<std::string>(i), std::int64_t(i)});
+    }
+    map.insert({"", 0});
+    // The destructor writes the end marker.
+  }
+
+  std::stringbuf buffer(trace.str());
+  tsl::sh::trace_reader reader(buffer);
+  BOOST_CHECK_EQUAL(reader.key_size(), 0);
+
+  const auto records = read_trace(trace.str(), true);
+  BOOST_REQUIRE_EQUAL(records.size(), 1001);
+  for (std::size_t i = 0; i < 1000; i++) {
+    const std::string key = utils::get_key<std::string>(i);
+    BOOST_CHECK(records[i].op == tsl::sh::trace_op::insert);
+    BOOST_CHECK_EQUAL(records[i].key, key);
+    BOOST_CHECK_EQUAL(records[i].hash, std::hash<std::string>()(key));
+  }
+  BOOST_CHECK(records.back().key.empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_interrupted_trace) {
+  using map_type = tsl::recording_sparse_map<std::int64_t, std::int64_t>;
+
+  std::stringbuf trace;
+  {
+    map_type map(trace);
+    for (std::int64_t i = 0; i < 100; i++) {
+      map.insert({i, i});
+    }
+    map.finish_trace();
+  }
+
+  // Without end marker, the records are still readable.
+  std::string interrupted = trace.str();
+  interrupted.pop_back();
+  BOOST_CHECK_EQUAL(read_trace(interrupted, false).size(), 100);
+
+  // The incomplete last record is dropped.
+  interrupted.pop_back();
+  BOOST_CHECK_EQUAL(read_trace(interrupted, false).size(), 99);
+}
+
+BOOST_AUTO_TEST_CASE(test_invalid_trace) {
+  std::stringbuf trace;
+  {
+    tsl::recording_sparse_map<std::string, std::int64_t> map(trace);
+    map.insert({"key", 1});
+    map.finish_trace();
+  }
+
+  // Invalid operation.
+  std::string corrupted = trace.str();
+  corrupted[24] = char(42);
+  std::stringbuf corrupted_buffer(corrupted);
+  tsl::sh::trace_reader reader(corrupted_buffer);
+  tsl::sh::trace_record record;
+  BOOST_CHECK_THROW(reader.read(record), std::runtime_error);
+
+
+  std::stringbuf not_a_trace(std::string(64, 'x'));
+  BOOST_CHECK_THROW(tsl::sh::trace_reader reader(not_a_trace),
+                    std::runtime_error);
+
+  std::stringbuf too_short(std::string("TSLTRACE"));
+  BOOST_CHECK_THROW(tsl::sh::trace_reader reader(too_short),
+                    std::runtime_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
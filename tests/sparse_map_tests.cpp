@@ -22,14 +22,21 @@
  * SOFTWARE.
  */
 #include <tsl/sparse_map.h>
+#include <tsl/sparse_stream.h>
 
 #include <boost/mpl/list.hpp>
 #include <boost/test/unit_test.hpp>
+#include <algorithm>
+#include <atomic>
+#include <climits>
 #include <cstddef>
 #include <cstdint>
 #include <functional>
+#include <future>
 #include <iterator>
+#include <map>
 #include <memory>
+#include <sstream>
 #include <stdexcept>
 #include <string>
 #include <tuple>
@@ -157,6 +164,23 @@ BOOST_AUTO_TEST_CASE(test_range_insert) {
   }
 }
 
+BOOST_AUTO_TEST_CASE(test_range_insert_pair_const_key) {
+  // The values of a std::map are std::pair<const Key, T>, they are converted
+  // to a temporary std::pair<Key, T> before the insertion.
+  std::map<std::string, int> values_to_insert;
+  for (int i = 0; i < 1000; i++) {
+    values_to_insert[utils::get_key<std::string>(std::size_t(i))] = i;
+  }
+
+  tsl::sparse_map<std::string, int> map;
+  map.insert(values_to_insert.begin(), values_to_insert.end());
+
+  BOOST_CHECK_EQUAL(map.size(), values_to_insert.size());
+  for (const auto& value : values_to_insert) {
+    BOOST_CHECK_EQUAL(map.at(value.first), value.second);
+  }
+}
+
 BOOST_AUTO_TEST_CASE(test_insert_with_hint) {
   tsl::sparse_map<int, int> map{{1, 0}, {2, 1}, {3, 2}};
 
@@ -931,6 +955,266 @@ BOOST_AUTO_TEST_CASE(test_access_operator) {
 /**
  * swap
  */
+BOOST_AUTO_TEST_CASE(test_memory_usage) {
+  using HMap = tsl::sparse_map<std::int64_t, std::int64_t>;
+  const std::size_t value_size = sizeof(HMap::value_type);
+
+  HMap map;
+  tsl::sh::memory_usage_info usage = map.memory_usage();
+  BOOST_CHECK_EQUAL(usage.total_bytes(), 0);
+  BOOST_CHECK_EQUAL(usage.nb_tombstones, 0);
+
+  map = utils::get_filled_hash_map<HMap>(1000);
+  usage = map.memory_usage();
+  BOOST_CHECK_EQUAL(usage.values_bytes, 1000 * value_size);
+  BOOST_CHECK_EQUAL(usage.slack_bytes % value_size, 0);
+  BOOST_CHECK(usage.metadata_bytes >= map.bucket_count() / 64);
+  BOOST_CHECK_EQUAL(usage.total_bytes(), usage.metadata_bytes +
+                                             usage.values_bytes +
+                                             usage.slack_bytes);
+  BOOST_CHECK_EQUAL(usage.nb_tombstones, 0);
+
+  for (std::int64_t i = 0; i < 100; i++) {
+    map.erase(i);
+  }
+  usage = map.memory_usage();
+  BOOST_CHECK_EQUAL(usage.values_bytes, 900 * value_size);
+  BOOST_CHECK_EQUAL(usage.nb_tombstones, 100);
+
+  // The reference counts of the groups are part of the metadata
+  map.structural_sharing(true);
+  BOOST_CHECK(map.memory_usage().metadata_bytes > usage.metadata_bytes);
+
+  map.rehash(0);
+  BOOST_CHECK_EQUAL(map.memory_usage().nb_tombstones, 0);
+
+  map.clear();
+  usage = map.memory_usage();
+  BOOST_CHECK_EQUAL(usage.values_bytes, 0);
+  BOOST_CHECK_EQUAL(usage.nb_tombstones, 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_group_occupancy) {
+  using HMap = tsl::sparse_map<std::int64_t, std::int64_t>;
+  const std::size_t value_size = sizeof(HMap::value_type);
+
+  HMap map = utils::get_filled_hash_map<HMap>(1000);
+  for (std::int64_t i = 0; i < 1000; i += 3) {
+    map.erase(i);
+  }
+
+  const tsl::sh::group_occupancy_info info = map.group_occupancy();
+  const std::size_t group_size = info.size_histogram.size() - 1;
+  BOOST_CHECK(group_size == 32 || group_size == 64);
+
+  std::size_t nb_groups = 0;
+  std::size_t nb_values = 0;
+  for (std::size_t n = 0; n < info.size_histogram.size(); n++) {
+    nb_groups += info.size_histogram[n];
+    nb_values += n * info.size_histogram[n];
+  }
+  BOOST_CHECK_EQUAL(nb_groups, map.bucket_count() / group_size);
+  BOOST_CHECK_EQUAL(nb_values, map.size());
+
+  std::size_t nb_groups_capacity = 0;
+  std::size_t capacity = 0;
+  for (std::size_t n = 0; n < info.capacity_histogram.size(); n++) {
+    nb_groups_capacity += info.capacity_histogram[n];
+    capacity += n * info.capacity_histogram[n];
+  }
+  BOOST_CHECK_EQUAL(nb_groups_capacity, nb_groups);
+  BOOST_CHECK_EQUAL((capacity - map.size()) * value_size,
+                    map.memory_usage().slack_bytes);
+
+  std::size_t nb_allocations = 0;
+  std::size_t allocated_bytes = 0;
+  for (std::size_t i = 0; i < info.allocation_sizes.size(); i++) {
+    BOOST_CHECK(i == 0 || info.allocation_sizes[i - 1].nb_bytes <
+                              info.allocation_sizes[i].nb_bytes);
+    nb_allocations += info.allocation_sizes[i].nb_allocations;
+    allocated_bytes += info.allocation_sizes[i].nb_bytes *
+                       info.allocation_sizes[i].nb_allocations;
+  }
+  BOOST_CHECK_EQUAL(nb_allocations, nb_groups - info.capacity_histogram[0]);
+  BOOST_CHECK_EQUAL(allocated_bytes, capacity * value_size);
+
+  // The groups of a map deserialized in an arena have no allocation of their
+  // own.
+  raw_serializer serial;
+  map.serialize(serial);
+  raw_deserializer dserial(serial.str());
+  const HMap map_arena = HMap::deserialize_in_arena(dserial);
+  BOOST_CHECK(map_arena.group_occupancy().allocation_sizes.empty());
+  BOOST_CHECK(map_arena.group_occupancy().size_histogram ==
+              info.size_histogram);
+
+  BOOST_CHECK(HMap().group_occupancy().allocation_sizes.empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_rehash_observer) {
+  using HMap = tsl::sparse_map<std::int64_t, std::int64_t>;
+
+  std::vector<tsl::sh::rehash_event> events;
+  HMap map;
+  map.rehash_observer(
+      [&](const tsl::sh::rehash_event& event) { events.push_back(event); });
+
+  for (std::int64_t i = 0; i < 1000; i++) {
+    map.insert({i, i});
+  }
+
+  BOOST_REQUIRE(!events.empty());
+  BOOST_REQUIRE_EQUAL(events.size() % 2, 0);
+  for (std::size_t i = 0; i < events.size(); i += 2) {
+    const tsl::sh::rehash_event& before = events[i];
+    const tsl::sh::rehash_event& after = events[i + 1];
+
+    BOOST_CHECK(before.reason == tsl::sh::rehash_reason::grow);
+    BOOST_CHECK(after.reason == tsl::sh::rehash_reason::grow);
+    BOOST_CHECK(!before.completed);
+    BOOST_CHECK(after.completed);
+    BOOST_CHECK_EQUAL(before.old_bucket_count, after.old_bucket_count);
+    BOOST_CHECK(after.new_bucket_count > after.old_bucket_count);
+    BOOST_CHECK_EQUAL(before.nb_elements, after.nb_elements);
+    BOOST_CHECK(before.elapsed.count() == 0);
+  }
+  BOOST_CHECK_EQUAL(events.back().new_bucket_count, map.bucket_count());
+
+  // Explicit rehashes are not notified
+  events.clear();
+  map.rehash(map.bucket_count() * 2);
+  map.reserve(map.size() * 4);
+  BOOST_CHECK(events.empty());
+
+  // Purge of the deleted buckets
+  std::int64_t key = 1000;
+  while (events.empty()) {
+    map.insert({key, key});
+    map.erase(key);
+    key++;
+  }
+  BOOST_REQUIRE_EQUAL(events.size(), 2);
+  BOOST_CHECK(events[1].reason == tsl::sh::rehash_reason::purge_deleted);
+  BOOST_CHECK_EQUAL(events[1].old_bucket_count, events[1].new_bucket_count);
+  BOOST_CHECK(events[1].nb_deleted_buckets > 0);
+
+  // The observer is copied with the map and kept on rehash
+  HMap copy = map;
+  BOOST_CHECK(copy.rehash_observer() != nullptr);
+  copy.rehash_observer(nullptr);
+
+  events.clear();
+  for (std::int64_t i = 0; i < 10000; i++) {
+    copy.insert({-i - 1, i});
+  }
+  BOOST_CHECK(events.empty());
+
+  std::vector<std::pair<std::int64_t, std::int64_t>> values;
+  for (std::int64_t i = 0; i < 10000; i++) {
+    values.push_back({i + 100000, i});
+  }
+  map.parallel_insert(values.begin(), values.end(), 4);
+  BOOST_CHECK(!events.empty());
+  BOOST_CHECK(map.rehash_observer() != nullptr);
+}
+
+BOOST_AUTO_TEST_CASE(test_hash_quality_monitor) {
+  // Only the high bits of the hash vary, with the power of two growth policy
+  // all the keys start their probing at the same bucket.
+  struct high_bits_hash {
+    std::size_t operator()(std::int64_t key) const {
+      return static_cast<std::size_t>(key)
+             << (sizeof(std::size_t) * CHAR_BIT / 2);
+    }
+  };
+  using HMap = tsl::sparse_map<std::int64_t, std::int64_t, high_bits_hash>;
+
+  std::vector<tsl::sh::hash_quality_event> events;
+  tsl::sh::hash_quality_monitor monitor;
+  monitor.max_average_probes = 8.0f;
+  monitor.sample_interval = 1;
+  monitor.window_size = 64;
+  monitor.observer = [&](const tsl::sh::hash_quality_event& event) {
+    events.push_back(event);
+  };
+
+  // Report only
+  HMap map;
+  map.hash_quality_monitor(monitor);
+  for (std::int64_t i = 0; i < 500; i++) {
+    map.insert({i, i});
+  }
+  BOOST_REQUIRE(!events.empty());
+  for (const tsl::sh::hash_quality_event& event : events) {
+    BOOST_CHECK(!event.reseeded);
+    BOOST_CHECK(event.average_probes > 8.0);
+    BOOST_CHECK_EQUAL(event.nb_samples, 64);
+  }
+  BOOST_CHECK_EQUAL(map.hash_seed(), 0);
+
+  // Reseed
+  events.clear();
+  std::vector<tsl::sh::rehash_event> rehash_events;
+  monitor.reseed = true;
+  HMap reseeded_map;
+  reseeded_map.hash_quality_monitor(monitor);
+  reseeded_map.rehash_observer([&](const tsl::sh::rehash_event& event) {
+    rehash_events.push_back(event);
+  });
+  for (std::int64_t i = 0; i < 2000; i++) {
+    reseeded_map.insert({i, i});
+  }
+  BOOST_REQUIRE_EQUAL(events.size(), 1);
+  BOOST_CHECK(events[0].reseeded);
+  BOOST_CHECK(reseeded_map.hash_seed() != 0);
+  BOOST_CHECK_EQUAL(
+      std::count_if(rehash_events.begin(), rehash_events.end(),
+                    [](const tsl::sh::rehash_event& event) {
+                      return event.reason == tsl::sh::rehash_reason::reseed;
+                    }),
+      2);
+
+  BOOST_CHECK_EQUAL(reseeded_map.size(), 2000);
+  std::size_t nb_found = 0;
+  for (std::int64_t i = 0; i < 2000; i++) {
+    auto it = reseeded_map.find(i, high_bits_hash()(i));
+    if (it != reseeded_map.end() && it->second == i &&
+        reseeded_map.at(i) == i) {
+      nb_found++;
+    }
+  }
+  BOOST_CHECK_EQUAL(nb_found, 2000);
+  BOOST_CHECK(reseeded_map.find(2000) == reseeded_map.end());
+
+  // The seed is kept by the copies and the hash compatible serialization
+  const HMap copy = reseeded_map;
+  BOOST_CHECK_EQUAL(copy.hash_seed(), reseeded_map.hash_seed());
+  BOOST_CHECK(copy == reseeded_map);
+
+  serializer serial;
+  reseeded_map.serialize(serial);
+
+  deserializer dserial(serial.str());
+  const HMap map_deserialized = HMap::deserialize(dserial, true);
+  BOOST_CHECK_EQUAL(map_deserialized.hash_seed(), reseeded_map.hash_seed());
+  BOOST_CHECK(map_deserialized == reseeded_map);
+
+  deserializer dserial2(serial.str());
+  const HMap map_deserialized2 = HMap::deserialize(dserial2, false);
+  BOOST_CHECK_EQUAL(map_deserialized2.hash_seed(), 0);
+  BOOST_CHECK(map_deserialized2 == reseeded_map);
+
+  // A good hash function isn't reported
+  events.clear();
+  tsl::sparse_map<std::int64_t, std::int64_t> good_map;
+  good_map.hash_quality_monitor(monitor);
+  for (std::int64_t i = 0; i < 20000; i++) {
+    good_map.insert({i, i});
+  }
+  BOOST_CHECK(events.empty());
+  BOOST_CHECK_EQUAL(good_map.hash_seed(), 0);
+}
+
 BOOST_AUTO_TEST_CASE(test_swap) {
   tsl::sparse_map<std::int64_t, std::int64_t> map = {{1, 10}, {8, 80}, {3, 30}};
   tsl::sparse_map<std::int64_t, std::int64_t> map2 = {{4, 40}, {5, 50}};
@@ -1071,6 +1355,637 @@ BOOST_AUTO_TEST_CASE(test_serialize_deserialize_with_different_hash) {
   }
 }
 
+BOOST_AUTO_TEST_CASE(test_serialize_deserialize_raw) {
+  // The values of a map of trivially copyable types are serialized as raw
+  // blocks if the serializer provides write_bytes.
+  using HMap = tsl::sparse_map<std::int64_t, std::int64_t>;
+  const std::size_t nb_values = 1000;
+
+  HMap map = utils::get_filled_hash_map<HMap>(nb_values + 40);
+  for (std::size_t i = nb_values; i < nb_values + 40; i++) {
+    map.erase(utils::get_key<std::int64_t>(i));
+  }
+
+  raw_serializer serial;
+  map.serialize(serial);
+  BOOST_CHECK(serial.nb_write_bytes_calls() >= map.bucket_count() / 64);
+
+  raw_deserializer dserial(serial.str());
+  auto map_deserialized = HMap::deserialize(dserial, true);
+  BOOST_CHECK(map_deserialized == map);
+  BOOST_CHECK_EQUAL(map_deserialized.bucket_count(), map.bucket_count());
+
+  raw_deserializer dserial2(serial.str());
+  map_deserialized = HMap::deserialize(dserial2, false);
+  BOOST_CHECK(map_deserialized == map);
+
+  // A deserializer without read_bytes can't read raw values.
+  deserializer dserial3(serial.str());
+  TSL_SH_CHECK_THROW(HMap::deserialize(dserial3, true), std::runtime_error);
+
+  // A map with non trivially copyable values is serialized value by value,
+  // write_bytes is only used for the varints of the sparse buckets.
+  auto map_str =
+      utils::get_filled_hash_map<tsl::sparse_map<std::string, std::string>>(
+          nb_values);
+  raw_serializer serial_str;
+  map_str.serialize(serial_str);
+  BOOST_CHECK(serial_str.nb_write_bytes_calls() <
+              3 * (map_str.bucket_count() / 64) + 1);
+
+  raw_deserializer dserial_str(serial_str.str());
+  BOOST_CHECK(decltype(map_str)::deserialize(dserial_str, true) == map_str);
+}
+
+BOOST_AUTO_TEST_CASE(test_deserialize_in_arena) {
+  // Deserialize in an arena, modify the map so that some groups move out of
+  // the arena and check against a map deserialized without arena.
+  using HMap = tsl::sparse_map<std::int64_t, std::int64_t>;
+  const std::size_t nb_values = 5000;
+
+  HMap map = utils::get_filled_hash_map<HMap>(nb_values + 40);
+  for (std::size_t i = nb_values; i < nb_values + 40; i++) {
+    map.erase(utils::get_key<std::int64_t>(i));
+  }
+
+  raw_serializer serial;
+  map.serialize(serial);
+
+  raw_deserializer dserial(serial.str());
+  HMap map_arena = HMap::deserialize_in_arena(dserial);
+  BOOST_CHECK(map_arena == map);
+  BOOST_CHECK_EQUAL(map_arena.bucket_count(), map.bucket_count());
+
+  for (std::size_t i = 0; i < nb_values; i += 7) {
+    map_arena.erase(utils::get_key<std::int64_t>(i));
+    map.erase(utils::get_key<std::int64_t>(i));
+  }
+  for (std::size_t i = 0; i < nb_values; i += 11) {
+    map_arena[utils::get_key<std::int64_t>(i + 1)] = -1;
+    map[utils::get_key<std::int64_t>(i + 1)] = -1;
+  }
+  map_arena.insert({-1, -1});
+  map.insert({-1, -1});
+  BOOST_CHECK(map_arena == map);
+
+  map_arena.rehash(map_arena.bucket_count() * 2);
+  BOOST_CHECK(map_arena == map);
+
+  map_arena.clear();
+  BOOST_CHECK(map_arena.empty());
+  map_arena.insert({1, 1});
+  BOOST_CHECK_EQUAL(map_arena.at(1), 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_deserialize_in_arena_string) {
+  using HMap = tsl::sparse_map<std::string, std::string>;
+  const std::size_t nb_values = 2000;
+
+  const HMap map = utils::get_filled_hash_map<HMap>(nb_values);
+
+  serializer serial;
+  map.serialize(serial);
+
+  deserializer dserial(serial.str());
+  HMap map_arena = HMap::deserialize_in_arena(dserial);
+  BOOST_CHECK(map_arena == map);
+
+  // The copy shares the groups, and thus the arena, of map_arena which must
+  // outlive map_arena.
+  map_arena.structural_sharing(true);
+  HMap copy = map_arena;
+  map_arena[utils::get_key<std::string>(0)] = "modified";
+  map_arena = HMap();
+
+  BOOST_CHECK(copy == map);
+  copy.erase(utils::get_key<std::string>(1));
+  BOOST_CHECK_EQUAL(copy.size(), nb_values - 1);
+
+  // Empty map
+  serializer serial_empty;
+  HMap().serialize(serial_empty);
+
+  deserializer dserial_empty(serial_empty.str());
+  BOOST_CHECK(HMap::deserialize_in_arena(dserial_empty).empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_serialize_deserialize_empty_group_deleted_buckets) {
+  // With a hash always returning 0, the values are all on the same probing
+  // sequence which goes over multiple sparse buckets. Erase the values of the
+  // second sparse bucket so that it only has deleted buckets, the values
+  // after it must still be found after a hash compatible deserialization.
+  using HMap = tsl::sparse_map<std::int64_t, std::int64_t, mod_hash<1>>;
+  HMap map(256);
+  for (std::int64_t i = 0; i < 20; i++) {
+    map.insert({i, i});
+  }
+
+  // Quadratic probing from bucket 0: bucket 0 + i * (i + 1) / 2 for the i-th
+  // value. The values 11 to 15 are in buckets [64, 128).
+  for (std::int64_t i = 11; i <= 15; i++) {
+    BOOST_CHECK_EQUAL(map.erase(i), 1);
+  }
+
+  serializer serial;
+  map.serialize(serial);
+  deserializer dserial(serial.str());
+  const auto map_deserialized = HMap::deserialize(dserial, true);
+
+  raw_serializer raw_serial;
+  map.serialize(raw_serial);
+  raw_deserializer raw_dserial(raw_serial.str());
+  const auto map_raw_deserialized = HMap::deserialize(raw_dserial, true);
+
+  for (std::int64_t i = 0; i < 20; i++) {
+    const bool erased = i >= 11 && i <= 15;
+    BOOST_CHECK_EQUAL(map_deserialized.count(i), erased ? 0 : 1);
+    BOOST_CHECK_EQUAL(map_raw_deserialized.count(i), erased ? 0 : 1);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_serialize_deserialize_unused_sparse_buckets) {
+  // A map with a low load has mostly unused sparse buckets, they must not
+  // take any space in the serialized map.
+  using HMap = tsl::sparse_map<std::int64_t, std::int64_t>;
+  HMap map(1 << 16);
+  for (std::int64_t i = 0; i < 100; i++) {
+    map.insert({i * 7919, i});
+  }
+  for (std::int64_t i = 0; i < 100; i += 3) {
+    map.erase(i * 7919);
+  }
+
+  const std::size_t nb_sparse_buckets = map.bucket_count() / 64;
+
+  serializer serial;
+  map.serialize(serial);
+  BOOST_CHECK(serial.str().size() < nb_sparse_buckets * sizeof(std::uint64_t));
+
+  raw_serializer raw_serial;
+  map.serialize(raw_serial);
+  BOOST_CHECK(raw_serial.str().size() < serial.str().size());
+
+  for (bool hash_compatible : {true, false}) {
+    deserializer dserial(serial.str());
+    const auto map_deserialized = HMap::deserialize(dserial, hash_compatible);
+    BOOST_CHECK(map_deserialized == map);
+
+    raw_deserializer raw_dserial(raw_serial.str());
+    const auto map_raw_deserialized =
+        HMap::deserialize(raw_dserial, hash_compatible);
+    BOOST_CHECK(map_raw_deserialized == map);
+
+    if (hash_compatible) {
+      BOOST_CHECK_EQUAL(map_deserialized.bucket_count(), map.bucket_count());
+      BOOST_CHECK_EQUAL(map_raw_deserialized.bucket_count(),
+                        map.bucket_count());
+    }
+  }
+
+  // The varints need a deserializer with read_bytes.
+  deserializer dserial(raw_serial.str());
+  TSL_SH_CHECK_THROW(HMap::deserialize(dserial, true), std::runtime_error);
+
+  // Empty map, only unused sparse buckets.
+  HMap empty_map(256);
+  raw_serializer empty_serial;
+  empty_map.serialize(empty_serial);
+  raw_deserializer empty_dserial(empty_serial.str());
+  const auto empty_map_deserialized = HMap::deserialize(empty_dserial, true);
+  BOOST_CHECK(empty_map_deserialized.empty());
+  BOOST_CHECK_EQUAL(empty_map_deserialized.bucket_count(),
+                    empty_map.bucket_count());
+}
+
+BOOST_AUTO_TEST_CASE(test_deserialize_invalid_unused_sparse_buckets) {
+  // Run of unused sparse buckets going past the last sparse bucket.
+  serializer serial;
+  serial(std::uint64_t(2));   // version
+  serial(std::uint64_t(2));   // flags, compact sparse buckets
+  serial(std::uint64_t(64));  // bucket_count
+  serial(std::uint64_t(1));   // nb_sparse_buckets
+  serial(std::uint64_t(0));   // nb_elements
+  serial(std::uint64_t(0));   // nb_deleted_buckets
+  serial(0.5f);               // max_load_factor
+  serial(std::uint64_t(2));   // nb_unused_sparse_buckets
+
+  deserializer dserial(serial.str());
+  TSL_SH_CHECK_THROW(
+      (tsl::sparse_map<std::int64_t, std::int64_t>::deserialize(dserial, true)),
+      std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(test_deserialize_protocol_v2_raw) {
+  // Stream in the version 2 of the protocol with raw values, without the
+  // compact sparse buckets.
+  raw_serializer serial;
+  serial(std::uint64_t(2));   // version
+  serial(std::uint64_t(1));   // flags, raw values
+  serial(std::uint64_t(sizeof(std::pair<std::int64_t, std::int64_t>)));
+  serial(std::uint64_t(64));  // bucket_count
+  serial(std::uint64_t(1));   // nb_sparse_buckets
+  serial(std::uint64_t(2));   // nb_elements
+  serial(std::uint64_t(0));   // nb_deleted_buckets
+  serial(0.5f);               // max_load_factor
+
+  const std::uint64_t header[3] = {2, 3, 0};
+  serial.write_bytes(header, sizeof(header));
+  const std::pair<std::int64_t, std::int64_t> values[2] = {{0, 10}, {1, 11}};
+  serial.write_bytes(values, sizeof(values));
+
+  for (bool hash_compatible : {true, false}) {
+    raw_deserializer dserial(serial.str());
+    const auto map =
+        tsl::sparse_map<std::int64_t, std::int64_t, mod_hash<64>>::deserialize(
+            dserial, hash_compatible);
+    BOOST_CHECK_EQUAL(map.size(), 2);
+    BOOST_CHECK_EQUAL(map.at(0), 10);
+    BOOST_CHECK_EQUAL(map.at(1), 11);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_parallel_deserialize) {
+  // More values than a single chunk of 4 threads to have multiple calls to
+  // parallel_insert.
+  using HMap = tsl::sparse_map<std::int64_t, std::int64_t>;
+  const std::size_t nb_values = 300000;
+
+  HMap map = utils::get_filled_hash_map<HMap>(nb_values);
+  for (std::size_t i = 0; i < nb_values; i += 5) {
+    map.erase(utils::get_key<std::int64_t>(i));
+  }
+
+  serializer serial;
+  map.serialize(serial);
+  raw_serializer raw_serial;
+  map.serialize(raw_serial);
+
+  for (std::size_t nb_threads : {1, 2, 4}) {
+    deserializer dserial(serial.str());
+    BOOST_CHECK(HMap::deserialize(dserial, false, nb_threads) == map);
+
+    raw_deserializer raw_dserial(raw_serial.str());
+    BOOST_CHECK(HMap::deserialize(raw_dserial, false, nb_threads) == map);
+  }
+
+  // Non trivially copyable values
+  using HMapStr = tsl::sparse_map<std::string, std::string>;
+  const HMapStr map_str = utils::get_filled_hash_map<HMapStr>(10000);
+
+  serializer serial_str;
+  map_str.serialize(serial_str);
+  deserializer dserial_str(serial_str.str());
+  const HMapStr map_str_deserialized =
+      HMapStr::deserialize(dserial_str, false, 3);
+  BOOST_CHECK(map_str_deserialized == map_str);
+
+  // nb_threads is ignored with a hash compatible deserialization
+  deserializer dserial_hash_compatible(serial.str());
+  const HMap map_hash_compatible =
+      HMap::deserialize(dserial_hash_compatible, true, 4);
+  BOOST_CHECK(map_hash_compatible == map);
+  BOOST_CHECK_EQUAL(map_hash_compatible.bucket_count(), map.bucket_count());
+}
+
+BOOST_AUTO_TEST_CASE(test_deserialize_protocol_v1) {
+  // Stream in the version 1 of the protocol, without flags.
+  serializer serial;
+  serial(std::uint64_t(1));   // version
+  serial(std::uint64_t(64));  // bucket_count
+  serial(std::uint64_t(1));   // nb_sparse_buckets
+  serial(std::uint64_t(2));   // nb_elements
+  serial(std::uint64_t(0));   // nb_deleted_buckets
+  serial(0.5f);               // max_load_factor
+  serial(std::uint64_t(2));   // sparse bucket size
+  serial(std::uint64_t(3));   // bitmap_vals
+  serial(std::uint64_t(0));   // bitmap_deleted_vals
+  serial(std::make_pair(std::int64_t(0), std::int64_t(10)));
+  serial(std::make_pair(std::int64_t(1), std::int64_t(11)));
+
+  for (bool hash_compatible : {true, false}) {
+    deserializer dserial(serial.str());
+    const auto map =
+        tsl::sparse_map<std::int64_t, std::int64_t, mod_hash<64>>::deserialize(
+            dserial, hash_compatible, 2);
+    BOOST_CHECK_EQUAL(map.size(), 2);
+    BOOST_CHECK_EQUAL(map.at(0), 10);
+    BOOST_CHECK_EQUAL(map.at(1), 11);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_serialize_delta) {
+  using HMap = tsl::sparse_map<std::int64_t, std::int64_t>;
+
+  HMap map = utils::get_filled_hash_map<HMap>(5000);
+  map.dirty_tracking(true);
+  BOOST_CHECK(map.dirty_tracking());
+
+  // The first delta contains the whole map
+  HMap replica;
+  raw_serializer serial_base;
+  map.serialize_delta(serial_base);
+  raw_deserializer dserial_base(serial_base.str());
+  replica.apply_delta(dserial_base);
+  BOOST_CHECK(replica == map);
+  BOOST_CHECK_EQUAL(replica.bucket_count(), map.bucket_count());
+
+  // Nothing changed
+  raw_serializer serial_empty;
+  map.serialize_delta(serial_empty);
+  BOOST_CHECK(serial_empty.str().size() < 100);
+
+  // Insert, erase and modify a mapped value through operator[] and find
+  map.insert({-1, -1});
+  map.erase(utils::get_key<std::int64_t>(10));
+  map[utils::get_key<std::int64_t>(20)] = 42;
+  map.find(utils::get_key<std::int64_t>(30)).value() = 43;
+
+  raw_serializer serial_delta;
+  map.serialize_delta(serial_delta);
+  BOOST_CHECK(serial_delta.str().size() < serial_base.str().size() / 10);
+
+  raw_deserializer dserial_delta(serial_delta.str());
+  replica.apply_delta(dserial_delta);
+  BOOST_CHECK(replica == map);
+
+  // A rehash marks all the groups as dirty
+  map.rehash(map.bucket_count() * 2);
+  map.insert({-2, -2});
+
+  serializer serial_rehash;
+  map.serialize_delta(serial_rehash);
+  deserializer dserial_rehash(serial_rehash.str());
+  replica.apply_delta(dserial_rehash);
+  BOOST_CHECK(replica == map);
+  BOOST_CHECK_EQUAL(replica.bucket_count(), map.bucket_count());
+
+  // Iterating over a const reference doesn't mark anything as dirty
+  std::int64_t sum = 0;
+  for (const auto &value : static_cast<const HMap &>(map)) {
+    sum += value.second;
+  }
+  BOOST_CHECK(sum != 0);
+
+  raw_serializer serial_iterate;
+  map.serialize_delta(serial_iterate);
+  BOOST_CHECK(serial_iterate.str().size() < 100);
+}
+
+BOOST_AUTO_TEST_CASE(test_serialize_delta_structural_sharing) {
+  using HMap = tsl::sparse_map<std::int64_t, std::int64_t>;
+
+  HMap map = utils::get_filled_hash_map<HMap>(1000);
+  map.dirty_tracking(true);
+
+  HMap replica;
+  replica.structural_sharing(true);
+
+  serializer serial_base;
+  map.serialize_delta(serial_base);
+  deserializer dserial_base(serial_base.str());
+  replica.apply_delta(dserial_base);
+
+  const HMap replica_copy = replica;
+
+  map.erase(utils::get_key<std::int64_t>(1));
+  map.insert({-1, -1});
+  serializer serial_delta;
+  map.serialize_delta(serial_delta);
+  deserializer dserial_delta(serial_delta.str());
+  replica.apply_delta(dserial_delta);
+
+  BOOST_CHECK(replica == map);
+  BOOST_CHECK(replica_copy == utils::get_filled_hash_map<HMap>(1000));
+}
+
+BOOST_AUTO_TEST_CASE(test_serialize_delta_invalid) {
+  using HMap = tsl::sparse_map<std::int64_t, std::int64_t>;
+
+  HMap map = utils::get_filled_hash_map<HMap>(1000);
+  serializer serial_no_tracking;
+  TSL_SH_CHECK_THROW(map.serialize_delta(serial_no_tracking), std::logic_error);
+
+  map.dirty_tracking(true);
+  serializer serial_base;
+  map.serialize_delta(serial_base);
+
+  for (std::int64_t i = 0; i < 10; i++) {
+    map.insert({-i - 1, i});
+  }
+  serializer serial_delta1;
+  map.serialize_delta(serial_delta1);
+
+  map.erase(utils::get_key<std::int64_t>(1));
+  serializer serial_delta2;
+  map.serialize_delta(serial_delta2);
+
+  // A delta can't be deserialized as a full map and a full map can't be
+  // applied as a delta.
+  deserializer dserial_as_full(serial_base.str());
+  TSL_SH_CHECK_THROW(HMap::deserialize(dserial_as_full, true),
+                     std::runtime_error);
+
+  serializer serial_full;
+  map.serialize(serial_full);
+  deserializer dserial_full(serial_full.str());
+  HMap replica;
+  TSL_SH_CHECK_THROW(replica.apply_delta(dserial_full), std::runtime_error);
+
+  // Skip the first delta
+  deserializer dserial_base(serial_base.str());
+  replica.apply_delta(dserial_base);
+  deserializer dserial_delta2(serial_delta2.str());
+  TSL_SH_CHECK_THROW(replica.apply_delta(dserial_delta2), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(test_snapshot_async) {
+  using HMap = tsl::sparse_map<std::int64_t, std::string>;
+
+  HMap map = utils::get_filled_hash_map<HMap>(20000);
+  map.structural_sharing(true);
+  const HMap expected = map;
+
+  serializer serial;
+  std::future<void> snapshot = map.snapshot_async(serial);
+
+  // Modify the map while the snapshot is being serialized
+  for (std::int64_t i = 0; i < 20000; i += 3) {
+    map.erase(i);
+    map[i + 1] = "modified";
+    map.insert({-i - 1, "new"});
+  }
+  snapshot.get();
+
+  deserializer dserial(serial.str());
+  BOOST_CHECK(HMap::deserialize(dserial) == expected);
+  BOOST_CHECK(!(map == expected));
+  BOOST_CHECK_EQUAL(map.at(1), "modified");
+}
+
+BOOST_AUTO_TEST_CASE(test_snapshot_async_without_structural_sharing) {
+  tsl::sparse_map<std::int64_t, std::int64_t> map = {{1, 2}};
+
+  serializer serial;
+  TSL_SH_CHECK_THROW(map.snapshot_async(serial), std::logic_error);
+}
+
+BOOST_AUTO_TEST_CASE(test_stream_serialize_deserialize) {
+  using HMap = tsl::sparse_map<std::int64_t, std::int64_t>;
+  using HMapString = tsl::sparse_map<std::string, std::int64_t>;
+
+  const HMap map = utils::get_filled_hash_map<HMap>(10000);
+  const HMapString map_string = utils::get_filled_hash_map<HMapString>(1000);
+
+  // Use small buffers to exercise the refills and the direct reads and writes
+  // of the blocks larger than the buffer.
+  for (std::size_t buffer_size :
+       {std::size_t(1), std::size_t(7), std::size_t(4096),
+        std::size_t(tsl::sh::stream_serializer::DEFAULT_BUFFER_SIZE)}) {
+    std::stringstream stream;
+    {
+      tsl::sh::stream_serializer serial(stream, buffer_size);
+      map.serialize(serial);
+      map_string.serialize(serial);
+      serial.flush();
+    }
+    stream << "end";
+
+    {
+      tsl::sh::stream_deserializer dserial(stream, buffer_size);
+      BOOST_CHECK(HMap::deserialize(dserial, true) == map);
+    }
+    {
+      // The previous deserializer gave back the bytes it read in advance
+      tsl::sh::stream_deserializer dserial(stream, buffer_size);
+      BOOST_CHECK(HMapString::deserialize(dserial) == map_string);
+    }
+
+    std::string end;
+    stream >> end;
+    BOOST_CHECK_EQUAL(end, "end");
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_stream_deserialize_truncated) {
+  using HMap = tsl::sparse_map<std::string, std::int64_t>;
+
+  const HMap map = utils::get_filled_hash_map<HMap>(1000);
+
+  std::stringstream stream;
+  tsl::sh::stream_serializer serial(stream);
+  map.serialize(serial);
+  serial.flush();
+
+  const std::string bytes = stream.str();
+  std::stringstream truncated_stream(bytes.substr(0, bytes.size() - 1));
+  tsl::sh::stream_deserializer dserial(truncated_stream, 64);
+  TSL_SH_CHECK_THROW(HMap::deserialize(dserial), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(test_crc32c) {
+  const std::string data = "123456789";
+  BOOST_CHECK_EQUAL(tsl::detail_crc32c::crc32c(0, data.data(), data.size()),
+                    0xE3069283u);
+  BOOST_CHECK_EQUAL(
+      tsl::detail_crc32c::fallback_crc32c(0, data.data(), data.size()),
+      0xE3069283u);
+
+  // Incremental computation and sizes not multiple of 8
+  const std::string long_data(1000, 'x');
+  for (std::size_t split : {0, 1, 7, 8, 999}) {
+    const std::uint32_t crc_start =
+        tsl::detail_crc32c::crc32c(0, long_data.data(), split);
+    BOOST_CHECK_EQUAL(
+        tsl::detail_crc32c::crc32c(crc_start, long_data.data() + split,
+                                   long_data.size() - split),
+        tsl::detail_crc32c::fallback_crc32c(0, long_data.data(),
+                                            long_data.size()));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_checksummed_stream_serialize_deserialize) {
+  using HMap = tsl::sparse_map<std::string, std::int64_t>;
+
+  const HMap map = utils::get_filled_hash_map<HMap>(5000);
+
+  for (std::size_t block_size :
+       {std::size_t(1), std::size_t(13), std::size_t(4096),
+        std::size_t(
+            tsl::sh::checksummed_stream_serializer::DEFAULT_BLOCK_SIZE)}) {
+    std::stringstream stream;
+    tsl::sh::checksummed_stream_serializer serial(stream, block_size);
+    map.serialize(serial);
+    serial.finish();
+    stream << "end";
+
+    const std::string bytes = stream.str();
+    for (std::size_t nb_threads : {1, 4}) {
+      tsl::sh::checksummed_stream_deserializer::verify(
+          bytes.data(), bytes.size() - 3, nb_threads);
+    }
+
+    tsl::sh::checksummed_stream_deserializer dserial(stream);
+    BOOST_CHECK(HMap::deserialize(dserial) == map);
+    dserial.finish();
+
+    std::string end;
+    stream >> end;
+    BOOST_CHECK_EQUAL(end, "end");
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_checksummed_stream_corrupted) {
+  using HMap = tsl::sparse_map<std::int64_t, std::int64_t>;
+
+  const HMap map = utils::get_filled_hash_map<HMap>(5000);
+
+  std::stringstream stream;
+  tsl::sh::checksummed_stream_serializer serial(stream, 1024);
+  map.serialize(serial);
+  serial.finish();
+  const std::string bytes = stream.str();
+
+  // Flip one bit in the middle of the blocks
+  std::string corrupted = bytes;
+  corrupted[corrupted.size() / 2] ^= 0x10;
+  TSL_SH_CHECK_THROW(tsl::sh::checksummed_stream_deserializer::verify(
+                         corrupted.data(), corrupted.size(), 4),
+                     std::runtime_error);
+
+  std::stringstream corrupted_stream(corrupted);
+  tsl::sh::checksummed_stream_deserializer dserial(corrupted_stream);
+  TSL_SH_CHECK_THROW(HMap::deserialize(dserial, true), std::runtime_error);
+
+  // Truncated stream
+  const std::string truncated = bytes.substr(0, bytes.size() - 1);
+  TSL_SH_CHECK_THROW(tsl::sh::checksummed_stream_deserializer::verify(
+                         truncated.data(), truncated.size()),
+                     std::runtime_error);
+
+  // Stream without index
+  std::stringstream unfinished_stream;
+  {
+    tsl::sh::checksummed_stream_serializer unfinished_serial(
+        unfinished_stream, 1024);
+    map.serialize(unfinished_serial);
+  }
+  const std::string unfinished = unfinished_stream.str();
+  TSL_SH_CHECK_THROW(tsl::sh::checksummed_stream_deserializer::verify(
+                         unfinished.data(), unfinished.size()),
+                     std::runtime_error);
+
+  tsl::sh::checksummed_stream_deserializer dserial_unfinished(
+      unfinished_stream);
+  TSL_SH_CHECK_THROW(HMap::deserialize(dserial_unfinished, true),
+                     std::runtime_error);
+
+  // Not a checksummed stream
+  std::stringstream plain_stream("not a checksummed stream");
+  TSL_SH_CHECK_THROW(
+      tsl::sh::checksummed_stream_deserializer dserial_plain(plain_stream),
+      std::runtime_error);
+}
+
 /**
  * KeyEqual
  */
@@ -1352,4 +2267,476 @@ BOOST_AUTO_TEST_CASE(test_precalculated_hash) {
   BOOST_CHECK_EQUAL(map.erase(3, map.hash_function()(3)), 1);
 }
 
+/**
+ * structural_sharing
+ */
+BOOST_AUTO_TEST_CASE(test_structural_sharing) {
+  using HMap = tsl::sparse_map<std::int64_t, std::int64_t>;
+  const std::size_t nb_values = 1000;
+
+  HMap map = utils::get_filled_hash_map<HMap>(nb_values);
+  BOOST_CHECK(!map.structural_sharing());
+  map.structural_sharing(true);
+  BOOST_CHECK(map.structural_sharing());
+
+  HMap map_copy = map;
+  BOOST_CHECK(map_copy.structural_sharing());
+  BOOST_CHECK(map_copy == map);
+
+  map_copy.erase(utils::get_key<std::int64_t>(0));
+  map_copy[utils::get_key<std::int64_t>(1)] = -1;
+  map_copy.find(utils::get_key<std::int64_t>(2)).value() = -2;
+  map_copy.at(utils::get_key<std::int64_t>(3)) = -3;
+  map_copy.insert({utils::get_key<std::int64_t>(nb_values),
+                   utils::get_value<std::int64_t>(nb_values)});
+
+  // Trigger a rehash while the buckets are shared
+  HMap map_copy_2 = map_copy;
+  for (std::size_t i = nb_values + 1; i < nb_values * 2; i++) {
+    map_copy_2.insert(
+        {utils::get_key<std::int64_t>(i), utils::get_value<std::int64_t>(i)});
+  }
+
+  BOOST_CHECK(map == utils::get_filled_hash_map<HMap>(nb_values));
+
+  BOOST_CHECK_EQUAL(map_copy.size(), nb_values);
+  BOOST_CHECK_EQUAL(map_copy.count(utils::get_key<std::int64_t>(0)), 0);
+  BOOST_CHECK_EQUAL(map_copy.at(utils::get_key<std::int64_t>(1)), -1);
+  BOOST_CHECK_EQUAL(map_copy.at(utils::get_key<std::int64_t>(2)), -2);
+  BOOST_CHECK_EQUAL(map_copy.at(utils::get_key<std::int64_t>(3)), -3);
+  BOOST_CHECK_EQUAL(map_copy.at(utils::get_key<std::int64_t>(nb_values)),
+                    utils::get_value<std::int64_t>(nb_values));
+
+  BOOST_CHECK_EQUAL(map_copy_2.size(), nb_values * 2 - 1);
+  BOOST_CHECK_EQUAL(map_copy_2.at(utils::get_key<std::int64_t>(1)), -1);
+  for (std::size_t i = 4; i < nb_values * 2; i++) {
+    BOOST_CHECK_EQUAL(map_copy_2.at(utils::get_key<std::int64_t>(i)),
+                      utils::get_value<std::int64_t>(i));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_structural_sharing_lifetime) {
+  using HMap = tsl::sparse_map<std::string, std::string, mod_hash<9>>;
+  const std::size_t nb_values = 300;
+
+  HMap map_copy;
+  {
+    HMap map = utils::get_filled_hash_map<HMap>(nb_values);
+    map.structural_sharing(true);
+
+    map_copy = map;
+    map.erase(utils::get_key<std::string>(5));
+
+    // Modify through a non-const iterator, unshare all the buckets
+    for (auto it = map.begin(); it != map.end(); ++it) {
+      it.value() = "modified";
+    }
+  }
+
+  BOOST_CHECK(map_copy == utils::get_filled_hash_map<HMap>(nb_values));
+
+  HMap map_copy_2(map_copy);
+  map_copy.structural_sharing(false);
+  BOOST_CHECK(!map_copy.structural_sharing());
+  BOOST_CHECK(map_copy_2.structural_sharing());
+
+  map_copy.clear();
+  BOOST_CHECK(map_copy_2 == utils::get_filled_hash_map<HMap>(nb_values));
+
+  HMap map_move(std::move(map_copy_2));
+  for (std::size_t i = 0; i < nb_values; i++) {
+    BOOST_CHECK_EQUAL(map_move.erase(utils::get_key<std::string>(i)), 1);
+  }
+  BOOST_CHECK(map_move.empty());
+}
+
+BOOST_AUTO_TEST_CASE_TEMPLATE(test_structural_sharing_no_copy, HMap,
+                              test_types) {
+  // Enabling the structural sharing on a map that is never copied, must also
+  // work with move-only types.
+  using key_t = typename HMap::key_type;
+  using value_t = typename HMap::mapped_type;
+  const std::size_t nb_values = 500;
+
+  HMap map;
+  map.structural_sharing(true);
+  for (std::size_t i = 0; i < nb_values; i++) {
+    map.insert({utils::get_key<key_t>(i), utils::get_value<value_t>(i)});
+  }
+
+  for (std::size_t i = 0; i < nb_values; i += 2) {
+    BOOST_CHECK_EQUAL(map.erase(utils::get_key<key_t>(i)), 1);
+  }
+
+  map.rehash(0);
+  BOOST_CHECK_EQUAL(map.size(), nb_values / 2);
+  for (std::size_t i = 1; i < nb_values; i += 2) {
+    BOOST_CHECK(map.find(utils::get_key<key_t>(i))->second ==
+                utils::get_value<value_t>(i));
+  }
+}
+
+/**
+ * parallel_rehash
+ */
+BOOST_AUTO_TEST_CASE_TEMPLATE(test_parallel_rehash, HMap, test_types) {
+  using key_t = typename HMap::key_type;
+  using value_t = typename HMap::mapped_type;
+  const std::size_t nb_values = 5000;
+
+  HMap map = utils::get_filled_hash_map<HMap>(nb_values);
+  for (std::size_t i = 0; i < nb_values; i += 3) {
+    BOOST_CHECK_EQUAL(map.erase(utils::get_key<key_t>(i)), 1);
+  }
+  const std::size_t nb_remaining = map.size();
+
+  for (std::size_t nb_threads : {0, 1, 2, 3, 8}) {
+    map.parallel_rehash(map.bucket_count() * 2, nb_threads);
+    BOOST_CHECK_EQUAL(map.size(), nb_remaining);
+
+    for (std::size_t i = 0; i < nb_values; i++) {
+      if (i % 3 == 0) {
+        BOOST_CHECK(map.find(utils::get_key<key_t>(i)) == map.end());
+      } else {
+        BOOST_CHECK(map.find(utils::get_key<key_t>(i))->second ==
+                    utils::get_value<value_t>(i));
+      }
+    }
+  }
+
+  map.parallel_rehash(0, 4);
+  BOOST_CHECK_EQUAL(map.size(), nb_remaining);
+  BOOST_CHECK_EQUAL(static_cast<std::size_t>(
+                        std::distance(map.cbegin(), map.cend())),
+                    nb_remaining);
+  for (std::size_t i = 1; i < nb_values; i += 3) {
+    BOOST_CHECK(map.find(utils::get_key<key_t>(i))->second ==
+                utils::get_value<value_t>(i));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_parallel_rehash_structural_sharing) {
+  // The shared values must be copied, the copy must stay untouched.
+  const std::size_t nb_values = 1000;
+  auto map =
+      utils::get_filled_hash_map<tsl::sparse_map<std::string, std::string>>(
+          nb_values);
+  map.structural_sharing(true);
+
+  const auto map_copy = map;
+  map.parallel_rehash(map.bucket_count() * 4, 4);
+  map.insert({"new key", "new value"});
+
+  BOOST_CHECK(map.structural_sharing());
+  BOOST_CHECK_EQUAL(map.size(), nb_values + 1);
+  BOOST_CHECK_EQUAL(map_copy.size(), nb_values);
+  for (std::size_t i = 0; i < nb_values; i++) {
+    BOOST_CHECK_EQUAL(map.at(utils::get_key<std::string>(i)),
+                      utils::get_value<std::string>(i));
+    BOOST_CHECK_EQUAL(map_copy.at(utils::get_key<std::string>(i)),
+                      utils::get_value<std::string>(i));
+  }
+}
+
+/**
+ * parallel_insert
+ */
+BOOST_AUTO_TEST_CASE_TEMPLATE(test_parallel_insert, HMap, test_types) {
+  // Insert keys in [0, 3000) twice, the values of the second half of the range
+  // must not replace the first ones. Half of the keys in [0, 1000) are already
+  // in the map and the other half are deleted buckets that can be reused.
+  using key_t = typename HMap::key_type;
+  using value_t = typename HMap::mapped_type;
+  const std::size_t nb_values = 3000;
+
+  for (std::size_t nb_threads : {1, 2, 7}) {
+    HMap map = utils::get_filled_hash_map<HMap>(1000);
+    for (std::size_t i = 0; i < 1000; i += 2) {
+      BOOST_CHECK_EQUAL(map.erase(utils::get_key<key_t>(i)), 1);
+    }
+
+    std::vector<std::pair<key_t, value_t>> values;
+    for (std::size_t i = 0; i < 2 * nb_values; i++) {
+      values.emplace_back(utils::get_key<key_t>(i % nb_values),
+                          utils::get_value<value_t>(i));
+    }
+
+    map.parallel_insert(std::make_move_iterator(values.begin()),
+                        std::make_move_iterator(values.end()), nb_threads);
+
+    BOOST_CHECK_EQUAL(map.size(), nb_values);
+    for (std::size_t i = 0; i < nb_values; i++) {
+      BOOST_CHECK(map.at(utils::get_key<key_t>(i)) ==
+                  utils::get_value<value_t>(i));
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_parallel_insert_structural_sharing) {
+  const std::size_t nb_values = 2000;
+  tsl::sparse_map<std::int64_t, std::int64_t> map;
+  map.structural_sharing(true);
+  map.insert({{1, -1}, {2, -2}});
+
+  const auto map_copy = map;
+
+  std::vector<std::pair<std::int64_t, std::int64_t>> values;
+  for (std::size_t i = 0; i < nb_values; i++) {
+    values.emplace_back(i, i);
+  }
+  map.parallel_insert(values.begin(), values.end(), 4);
+
+  BOOST_CHECK_EQUAL(map.size(), nb_values);
+  BOOST_CHECK_EQUAL(map.at(1), -1);
+  BOOST_CHECK_EQUAL(map.at(3), 3);
+  BOOST_CHECK(map_copy == (tsl::sparse_map<std::int64_t, std::int64_t>{
+                              {1, -1}, {2, -2}}));
+}
+
+/**
+ * for_each_parallel
+ */
+BOOST_AUTO_TEST_CASE(test_for_each_parallel) {
+  const std::size_t nb_values = 10000;
+  auto map =
+      utils::get_filled_hash_map<tsl::sparse_map<std::int64_t, std::int64_t>>(
+          nb_values);
+
+  for (std::size_t nb_threads : {0, 1, 3, 16}) {
+    std::atomic<std::int64_t> sum(0);
+    std::atomic<std::size_t> count(0);
+    map.for_each_parallel(
+        [&](const std::pair<std::int64_t, std::int64_t> &value) {
+          sum += value.second;
+          count++;
+        },
+        nb_threads);
+
+    BOOST_CHECK_EQUAL(count.load(), nb_values);
+    BOOST_CHECK_EQUAL(sum.load(),
+                      std::int64_t(nb_values * (nb_values - 1)));
+  }
+
+  const tsl::sparse_map<std::int64_t, std::int64_t> empty_map;
+  empty_map.for_each_parallel(
+      [](const std::pair<std::int64_t, std::int64_t> &) { BOOST_CHECK(false); },
+      4);
+}
+
+/**
+ * merge
+ */
+BOOST_AUTO_TEST_CASE_TEMPLATE(test_merge, HMap, test_types) {
+  // map1 has the even keys in [0, 1000), map2 the keys in [500, 1500) with
+  // different values. Both have the same bucket count, the values already in
+  // map1 must be kept.
+  using key_t = typename HMap::key_type;
+  using value_t = typename HMap::mapped_type;
+
+  HMap map1;
+  HMap map2;
+  map1.reserve(2000);
+  map2.reserve(2000);
+  for (std::size_t i = 0; i < 1000; i += 2) {
+    map1.insert({utils::get_key<key_t>(i), utils::get_value<value_t>(i)});
+  }
+  for (std::size_t i = 500; i < 1500; i++) {
+    map2.insert({utils::get_key<key_t>(i), utils::get_value<value_t>(i + 1)});
+  }
+  BOOST_REQUIRE_EQUAL(map1.bucket_count(), map2.bucket_count());
+
+  map1.merge(std::move(map2));
+  BOOST_CHECK(map2.empty());
+  BOOST_CHECK_EQUAL(map1.size(), 1250);
+  BOOST_CHECK_EQUAL(std::distance(map1.cbegin(), map1.cend()), 1250);
+
+  for (std::size_t i = 0; i < 1500; i++) {
+    const auto it = map1.find(utils::get_key<key_t>(i));
+    if (i < 500 && i % 2 == 1) {
+      BOOST_CHECK(it == map1.end());
+    } else if (i < 1000 && i % 2 == 0) {
+      BOOST_CHECK(it->second == utils::get_value<value_t>(i));
+    } else {
+      BOOST_CHECK(it->second == utils::get_value<value_t>(i + 1));
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_merge_copy) {
+  // Different bucket counts, deleted buckets and structural sharing.
+  using HMap = tsl::sparse_map<std::string, std::string>;
+  HMap map1 = utils::get_filled_hash_map<HMap>(100);
+  for (std::size_t i = 0; i < 100; i += 2) {
+    BOOST_CHECK_EQUAL(map1.erase(utils::get_key<std::string>(i)), 1);
+  }
+
+  HMap map2;
+  map2.structural_sharing(true);
+  map2.reserve(10000);
+  for (std::size_t i = 50; i < 1000; i++) {
+    map2.insert({utils::get_key<std::string>(i), "map2"});
+  }
+  const HMap map2_copy = map2;
+
+  map1.merge(map2);
+  map1.merge(map1);
+  BOOST_CHECK(map2 == map2_copy);
+  BOOST_CHECK_EQUAL(map1.size(), 25 + 950);
+
+  for (std::size_t i = 0; i < 1000; i++) {
+    const auto it = map1.find(utils::get_key<std::string>(i));
+    if (i < 50 && i % 2 == 0) {
+      BOOST_CHECK(it == map1.end());
+    } else if (i < 100 && i % 2 == 1) {
+      BOOST_CHECK_EQUAL(it->second, utils::get_value<std::string>(i));
+    } else {
+      BOOST_CHECK_EQUAL(it->second, "map2");
+    }
+  }
+
+  // Same bucket counts with the values of map2 shared with map2_copy.
+  HMap map3;
+  map3.reserve(10000);
+  map3.insert({"key", "value"});
+  map3.merge(std::move(map2));
+  BOOST_CHECK(map2.empty());
+  BOOST_CHECK_EQUAL(map3.size(), 951);
+  BOOST_CHECK_EQUAL(map2_copy.size(), 950);
+  for (const auto &value : map2_copy) {
+    BOOST_CHECK_EQUAL(map3.at(value.first), "map2");
+    BOOST_CHECK_EQUAL(value.second, "map2");
+  }
+}
+
+/**
+ * extract
+ */
+BOOST_AUTO_TEST_CASE_TEMPLATE(test_extract_insert_node, HMap, test_types) {
+  // Move the even keys from a "hot" map to a "cold" one.
+  using key_t = typename HMap::key_type;
+  using value_t = typename HMap::mapped_type;
+  const std::size_t nb_values = 1000;
+
+  HMap hot = utils::get_filled_hash_map<HMap>(nb_values);
+  HMap cold;
+
+  for (std::size_t i = 0; i < nb_values; i += 2) {
+    auto node = hot.extract(utils::get_key<key_t>(i));
+    BOOST_REQUIRE(!node.empty());
+    BOOST_CHECK(node.key() == utils::get_key<key_t>(i));
+    BOOST_CHECK(node.mapped() == utils::get_value<value_t>(i));
+
+    auto result = cold.insert(std::move(node));
+    BOOST_CHECK(result.inserted);
+    BOOST_CHECK(result.node.empty());
+    BOOST_CHECK(result.position->first == utils::get_key<key_t>(i));
+  }
+
+  BOOST_CHECK(hot.extract(utils::get_key<key_t>(0)).empty());
+  BOOST_CHECK(!cold.insert(typename HMap::node_type()).inserted);
+
+  BOOST_CHECK_EQUAL(hot.size(), nb_values / 2);
+  BOOST_CHECK_EQUAL(cold.size(), nb_values / 2);
+  for (std::size_t i = 0; i < nb_values; i++) {
+    const HMap &map = (i % 2 == 0) ? cold : hot;
+    BOOST_CHECK(map.at(utils::get_key<key_t>(i)) ==
+                utils::get_value<value_t>(i));
+  }
+
+  // Key already present, the node keeps its value.
+  hot.insert({utils::get_key<key_t>(0), utils::get_value<value_t>(1)});
+  auto result = cold.insert(hot.extract(hot.find(utils::get_key<key_t>(0))));
+  BOOST_CHECK(!result.inserted);
+  BOOST_CHECK(result.position->second == utils::get_value<value_t>(0));
+  BOOST_REQUIRE(!result.node.empty());
+  BOOST_CHECK(result.node.mapped() == utils::get_value<value_t>(1));
+  BOOST_CHECK(hot.find(utils::get_key<key_t>(0)) == hot.end());
+
+  hot.insert(hot.cbegin(), std::move(result.node));
+  BOOST_CHECK(result.node.empty());
+  BOOST_CHECK(hot.at(utils::get_key<key_t>(0)) == utils::get_value<value_t>(1));
+}
+
+BOOST_AUTO_TEST_CASE(test_extract_structural_sharing) {
+  // Extracting from a map sharing its buckets must not modify the copy.
+  auto map =
+      utils::get_filled_hash_map<tsl::sparse_map<std::string, std::string>>(
+          100);
+  map.structural_sharing(true);
+  const auto map_copy = map;
+
+  auto node = map.extract(utils::get_key<std::string>(10));
+  BOOST_CHECK_EQUAL(node.mapped(), utils::get_value<std::string>(10));
+  BOOST_CHECK_EQUAL(map.size(), 99);
+  BOOST_CHECK_EQUAL(map_copy.size(), 100);
+  BOOST_CHECK_EQUAL(map_copy.at(utils::get_key<std::string>(10)),
+                    utils::get_value<std::string>(10));
+}
+
+/**
+ * try_emplace_lazy and upsert
+ */
+BOOST_AUTO_TEST_CASE_TEMPLATE(test_try_emplace_lazy, HMap, test_types) {
+  using key_t = typename HMap::key_type;
+  using value_t = typename HMap::mapped_type;
+  const std::size_t nb_values = 1000;
+
+  HMap map = utils::get_filled_hash_map<HMap>(nb_values / 2);
+  for (std::size_t i = 0; i < nb_values / 2; i += 2) {
+    BOOST_CHECK_EQUAL(map.erase(utils::get_key<key_t>(i)), 1);
+  }
+
+  std::size_t nb_factory_calls = 0;
+  for (std::size_t i = 0; i < nb_values; i++) {
+    auto it = map.try_emplace_lazy(utils::get_key<key_t>(i), [&]() {
+      nb_factory_calls++;
+      return utils::get_value<value_t>(i + 1);
+    });
+
+    const bool should_insert = i >= nb_values / 2 || i % 2 == 0;
+    BOOST_CHECK_EQUAL(it.second, should_insert);
+    BOOST_CHECK(it.first->first == utils::get_key<key_t>(i));
+    BOOST_CHECK(it.first->second ==
+                utils::get_value<value_t>(should_insert ? i + 1 : i));
+  }
+
+  BOOST_CHECK_EQUAL(nb_factory_calls, nb_values / 2 + nb_values / 4);
+  BOOST_CHECK_EQUAL(map.size(), nb_values);
+}
+
+BOOST_AUTO_TEST_CASE(test_upsert) {
+  tsl::sparse_map<std::string, std::int64_t> counters;
+  const std::vector<std::string> words = {"a", "b", "a", "c", "a", "b"};
+
+  for (const auto &word : words) {
+    counters.upsert(
+        word, [] { return std::int64_t(1); },
+        [](std::int64_t &count) { count++; });
+  }
+
+  BOOST_CHECK(counters == (tsl::sparse_map<std::string, std::int64_t>{
+                              {"a", 3}, {"b", 2}, {"c", 1}}));
+
+  auto it = counters.upsert(
+      std::string("a"), []() -> std::int64_t {
+        BOOST_CHECK(false);
+        return 0;
+      },
+      [](std::int64_t &count) { count = -1; });
+  BOOST_CHECK(!it.second);
+  BOOST_CHECK_EQUAL(it.first->second, -1);
+}
+
+BOOST_AUTO_TEST_CASE(test_upsert_structural_sharing) {
+  tsl::sparse_map<std::string, std::int64_t> map = {{"a", 1}};
+  map.structural_sharing(true);
+  const auto map_copy = map;
+
+  map.upsert(
+      "a", [] { return std::int64_t(0); },
+      [](std::int64_t &value) { value = 2; });
+  BOOST_CHECK_EQUAL(map.at("a"), 2);
+  BOOST_CHECK_EQUAL(map_copy.at("a"), 1);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
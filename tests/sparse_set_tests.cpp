@@ -28,6 +28,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <functional>
+#include <future>
 #include <memory>
 #include <string>
 #include <tuple>
@@ -185,4 +186,41 @@ BOOST_AUTO_TEST_CASE(test_serialize_deserialize) {
   }
 }
 
+BOOST_AUTO_TEST_CASE(test_serialize_delta) {
+  tsl::sparse_set<move_only_test> set;
+  set.dirty_tracking(true);
+  for (std::size_t i = 0; i < 1000; i++) {
+    set.insert(utils::get_key<move_only_test>(i));
+  }
+
+  tsl::sparse_set<move_only_test> replica;
+  for (std::size_t i = 0; i < 3; i++) {
+    set.erase(utils::get_key<move_only_test>(i * 7));
+    set.insert(utils::get_key<move_only_test>(1000 + i));
+
+    serializer serial;
+    set.serialize_delta(serial);
+    deserializer dserial(serial.str());
+    replica.apply_delta(dserial);
+    BOOST_CHECK(replica == set);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_snapshot_async) {
+  tsl::sparse_set<std::string> set;
+  for (std::size_t i = 0; i < 1000; i++) {
+    set.insert(utils::get_key<std::string>(i));
+  }
+  set.structural_sharing(true);
+  const tsl::sparse_set<std::string> expected = set;
+
+  serializer serial;
+  std::future<void> snapshot = set.snapshot_async(serial);
+  set.clear();
+  snapshot.get();
+
+  deserializer dserial(serial.str());
+  BOOST_CHECK(tsl::sparse_set<std::string>::deserialize(dserial) == expected);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
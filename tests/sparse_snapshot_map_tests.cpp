@@ -0,0 +1,129 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2017 Thibaut Goetghebuer-Planchon <tessil@gmx.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <tsl/sparse_snapshot_map.h>
+
+#include <atomic>
+#include <boost/test/unit_test.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "utils.h"
+
+BOOST_AUTO_TEST_SUITE(test_sparse_snapshot_map)
+
+BOOST_AUTO_TEST_CASE(test_update_snapshot) {
+  tsl::sparse_snapshot_map<std::int64_t, std::int64_t> map;
+  BOOST_CHECK_EQUAL(map.size(), 0);
+
+  const auto snapshot_empty = map.snapshot();
+
+  map.update([](tsl::sparse_map<std::int64_t, std::int64_t>& m) {
+    for (std::int64_t i = 0; i < 1000; i++) {
+      m.insert({i, i * 2});
+    }
+  });
+
+  const auto snapshot_filled = map.snapshot();
+  map.update([](tsl::sparse_map<std::int64_t, std::int64_t>& m) {
+    m.erase(0);
+    m[1] = -1;
+  });
+
+  // Old snapshots are not affected by later updates
+  BOOST_CHECK(snapshot_empty->empty());
+  BOOST_CHECK_EQUAL(snapshot_filled->size(), 1000);
+  BOOST_CHECK_EQUAL(snapshot_filled->at(0), 0);
+  BOOST_CHECK_EQUAL(snapshot_filled->at(1), 2);
+
+  const auto snapshot_last = map.snapshot();
+  BOOST_CHECK_EQUAL(snapshot_last->size(), 999);
+  BOOST_CHECK_EQUAL(snapshot_last->count(0), 0);
+  BOOST_CHECK_EQUAL(snapshot_last->at(1), -1);
+  BOOST_CHECK_EQUAL(snapshot_last->at(999), 1998);
+}
+
+BOOST_AUTO_TEST_CASE(test_assign) {
+  tsl::sparse_snapshot_map<std::string, std::string> map(
+      tsl::sparse_map<std::string, std::string>{{"a", "1"}, {"b", "2"}});
+  const auto snapshot = map.snapshot();
+
+  map.assign(tsl::sparse_map<std::string, std::string>{{"c", "3"}});
+
+  BOOST_CHECK_EQUAL(snapshot->size(), 2);
+  BOOST_CHECK_EQUAL(map.size(), 1);
+  BOOST_CHECK_EQUAL(map.snapshot()->at("c"), "3");
+}
+
+BOOST_AUTO_TEST_CASE(test_concurrent_readers) {
+  // Readers must always see a consistent version where the value of each key
+  // is equal to the version number.
+  const std::int64_t nb_keys = 200;
+  const std::int64_t nb_versions = 50;
+
+  tsl::sparse_snapshot_map<std::int64_t, std::int64_t> map;
+  map.update([&](tsl::sparse_map<std::int64_t, std::int64_t>& m) {
+    for (std::int64_t i = 0; i < nb_keys; i++) {
+      m.insert({i, 0});
+    }
+  });
+
+  std::atomic<bool> stop(false);
+  std::atomic<std::size_t> nb_inconsistencies(0);
+  std::vector<std::thread> readers;
+  for (std::size_t ireader = 0; ireader < 4; ireader++) {
+    readers.emplace_back([&]() {
+      while (!stop.load()) {
+        const auto snapshot = map.snapshot();
+        const std::int64_t version = snapshot->at(0);
+        for (std::int64_t i = 0; i < nb_keys; i++) {
+          if (snapshot->at(i) != version) {
+            nb_inconsistencies++;
+          }
+        }
+      }
+    });
+  }
+
+  for (std::int64_t version = 1; version <= nb_versions; version++) {
+    map.update([&](tsl::sparse_map<std::int64_t, std::int64_t>& m) {
+      for (std::int64_t i = 0; i < nb_keys; i++) {
+        m[i] = version;
+      }
+    });
+  }
+
+  stop = true;
+  for (auto& reader : readers) {
+    reader.join();
+  }
+
+  BOOST_CHECK_EQUAL(nb_inconsistencies.load(), 0);
+  BOOST_CHECK_EQUAL(map.snapshot()->at(nb_keys - 1), nb_versions);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
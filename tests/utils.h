@@ -382,10 +382,28 @@ class serializer {
     m_ostream.write(reinterpret_cast<const char*>(&val), sizeof(val));
   }
 
- private:
+ protected:
   std::stringstream m_ostream;
 };
 
+/**
+ * Serializer providing the optional write_bytes method to serialize the
+ * trivially copyable values as raw blocks.
+ */
+class raw_serializer : public serializer {
+ public:
+  void write_bytes(const void* data, std::size_t size) {
+    m_ostream.write(static_cast<const char*>(data),
+                    boost::numeric_cast<std::streamsize>(size));
+    m_nb_write_bytes_calls++;
+  }
+
+  std::size_t nb_write_bytes_calls() const { return m_nb_write_bytes_calls; }
+
+ private:
+  std::size_t m_nb_write_bytes_calls = 0;
+};
+
 class deserializer {
  public:
   deserializer(const std::string& init_str = "") : m_istream(init_str) {
@@ -436,8 +454,21 @@ class deserializer {
     return val;
   }
 
- private:
+ protected:
   std::stringstream m_istream;
 };
 
+/**
+ * Deserializer providing the optional read_bytes method.
+ */
+class raw_deserializer : public deserializer {
+ public:
+  using deserializer::deserializer;
+
+  void read_bytes(void* data, std::size_t size) {
+    m_istream.read(static_cast<char*>(data),
+                   boost::numeric_cast<std::streamsize>(size));
+  }
+};
+
 #endif